@@ -0,0 +1,38 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _AES_H_
+#define _AES_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+#define AES_BLOCK_SIZE              16
+#define AES_KEY_SIZE                16
+
+/* aes-128, encryption only, that is all ctr mode needs */
+typedef struct
+{
+    uint32_t round_key[44];
+} aes_ctx_t;
+
+void aes_init(aes_ctx_t *ctx, const uint8_t key[AES_KEY_SIZE]);
+void aes_encrypt(const aes_ctx_t *ctx, const uint8_t in[AES_BLOCK_SIZE], uint8_t out[AES_BLOCK_SIZE]);
+
+/**
+ * @brief ctr mode, encrypts and decrypts in place
+ * @param[in] counter: initial counter block, incremented as a 128 bit big
+ *                     endian number
+ * @param[in] offset: stream position of pbuf, any offset works
+ */
+void aes_ctr_crypt(const aes_ctx_t *ctx, const uint8_t counter[AES_BLOCK_SIZE],
+                   uint32_t offset, uint8_t *pbuf, uint32_t len);
+
+END_DECLS
+
+#endif /* _AES_H_ */
@@ -0,0 +1,29 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "bkp.h"
+#include "stm32f10x.h"
+
+static void bkp_clock_enable(void)
+{
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR | RCC_APB1Periph_BKP, ENABLE);
+}
+
+uint16_t bkp_read(uint16_t reg)
+{
+    bkp_clock_enable();
+    return BKP_ReadBackupRegister(reg);
+}
+
+void bkp_write(uint16_t reg, uint16_t value)
+{
+    bkp_clock_enable();
+    /* keep the backup domain write protected between writes */
+    PWR_BackupAccessCmd(ENABLE);
+    BKP_WriteBackupRegister(reg, value);
+    PWR_BackupAccessCmd(DISABLE);
+}
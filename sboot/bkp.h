@@ -0,0 +1,24 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _BKP_H_
+#define _BKP_H_
+
+#include "types.h"
+#include "bkp_map.h"
+
+BEGIN_DECLS
+
+/**
+ * @brief backup data register access, see bkp_map.h for the registers
+ */
+uint16_t bkp_read(uint16_t reg);
+void bkp_write(uint16_t reg, uint16_t value);
+
+END_DECLS
+
+#endif /* _BKP_H_ */
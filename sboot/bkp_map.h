@@ -0,0 +1,32 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _BKP_MAP_H_
+#define _BKP_MAP_H_
+
+/**
+ * backup data registers shared between sboot and the app, they survive
+ * system reset as long as VBAT or VDD is present
+ */
+/* clock state sboot left the chip in, see clock.h */
+#define BKP_CLOCK_STATE                         BKP_DR1
+/* next app page to scrub, see flash_app_scrub */
+#define BKP_SCRUB_CURSOR                        BKP_DR2
+/* crc and header generation of the last verified app, see flash_app_verify
+ * and sdcard_upgrade, a power-on reset drops them */
+#define BKP_APP_CRC_LOW                         BKP_DR3
+#define BKP_APP_CRC_HIGH                        BKP_DR4
+#define BKP_APP_GENERATION                      BKP_DR5
+/* command from the app and its complement, see mailbox.h */
+#define BKP_MAILBOX_CMD                         BKP_DR6
+#define BKP_MAILBOX_KEY                         BKP_DR7
+/* next staging unit to erase, see flash_staging_preerase */
+#define BKP_PREERASE_CURSOR                     BKP_DR8
+/* app blocks the scrub found intact in a row since the last apply or repair */
+#define BKP_SCRUB_CLEAN                         BKP_DR9
+
+#endif /* _BKP_MAP_H_ */
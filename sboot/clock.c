@@ -0,0 +1,94 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "clock.h"
+#include "bkp.h"
+#include "delay.h"
+#include "stm32f10x.h"
+#define __TRACE_MODULE  "[clock]"
+#include "trace.h"
+
+static uint16_t state = CLOCK_STATE_HSI;
+/* cycle counter when the pll took over */
+static uint32_t boost_cycles;
+
+static bool clock_hse_start(void)
+{
+    RCC->CR |= RCC_CR_HSEON;
+    for (uint32_t i = 0; i < HSE_STARTUP_TIMEOUT; ++i)
+    {
+        if (0 != (RCC->CR & RCC_CR_HSERDY))
+        {
+            return true;
+        }
+    }
+
+    /* no crystal fitted or too slow, do not leave it half started */
+    RCC->CR &= ~RCC_CR_HSEON;
+    return false;
+}
+
+uint16_t clock_boost(void)
+{
+    if (CLOCK_STATE_HSI != state)
+    {
+        return state;
+    }
+
+    uint32_t pll;
+    if (clock_hse_start())
+    {
+        /* 8MHz * 9 */
+        pll = RCC_CFGR_PLLSRC_HSE | RCC_CFGR_PLLMULL9;
+        state = CLOCK_STATE_PLL_HSE;
+    }
+    else
+    {
+        /* 4MHz * 16 */
+        pll = RCC_CFGR_PLLSRC_HSI_Div2 | RCC_CFGR_PLLMULL16;
+        state = CLOCK_STATE_PLL_HSI;
+    }
+
+    /* two wait states above 48MHz */
+    FLASH->ACR = FLASH_ACR_PRFTBE | FLASH_ACR_LATENCY_2;
+
+    /* HCLK = SYSCLK, PCLK2 = HCLK, PCLK1 = HCLK / 2 */
+    RCC->CFGR &= ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2 |
+                   RCC_CFGR_PLLSRC | RCC_CFGR_PLLXTPRE | RCC_CFGR_PLLMULL);
+    RCC->CFGR |= RCC_CFGR_HPRE_DIV1 | RCC_CFGR_PPRE2_DIV1 | RCC_CFGR_PPRE1_DIV2 | pll;
+
+    RCC->CR |= RCC_CR_PLLON;
+    while (0 == (RCC->CR & RCC_CR_PLLRDY));
+
+    boost_cycles = delay_cycles();
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+    while (RCC_CFGR_SWS_PLL != (RCC->CFGR & RCC_CFGR_SWS));
+
+    SystemCoreClockUpdate();
+    return state;
+}
+
+uint16_t clock_state(void)
+{
+    return state;
+}
+
+uint32_t clock_elapsed_us(void)
+{
+    uint32_t cycles = delay_cycles();
+    if (CLOCK_STATE_HSI == state)
+    {
+        return cycles / (HSI_VALUE / 1000000);
+    }
+
+    return boost_cycles / (HSI_VALUE / 1000000) + (cycles - boost_cycles) / (SystemCoreClock / 1000000);
+}
+
+void clock_report(void)
+{
+    bkp_write(BKP_CLOCK_STATE, state);
+}
@@ -0,0 +1,50 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * sboot leaves reset on the 8MHz HSI and only starts the pll for upgrade
+ * work. The state handed to the app is stored in BKP_CLOCK_STATE, 0 means
+ * an older sboot that did not report it.
+ */
+#define CLOCK_STATE_HSI             0x0001
+/* 72MHz, pll on HSE */
+#define CLOCK_STATE_PLL_HSE         0x0002
+/* 64MHz, pll on HSI/2, crystal did not start */
+#define CLOCK_STATE_PLL_HSI         0x0003
+
+/**
+ * @brief run from the pll, HSE if it starts in time, else HSI
+ * @return clock state
+ */
+uint16_t clock_boost(void);
+
+/**
+ * @brief current clock state
+ */
+uint16_t clock_state(void);
+
+/**
+ * @brief time since delay_init, the cycles before clock_boost count at hsi
+ *        speed
+ */
+uint32_t clock_elapsed_us(void);
+
+/**
+ * @brief store clock state in backup register for the app
+ */
+void clock_report(void);
+
+END_DECLS
+
+#endif /* _CLOCK_H_ */
@@ -6,7 +6,25 @@
 * See the COPYING file for the terms of usage and distribution.
 */
 #include "crc32.h"
+#include "stm32f10x.h"
 
+#define CRC32_POLY                  0x04c11db7
+/* seeding the crc unit costs about as much as 16 table steps */
+#define CRC32_HW_MIN_LEN            64
+
+#ifdef __ENABLE_MINIMAL_BUILD
+/* bulk runs on the crc unit, bitwise steps for the few odd bytes save the table */
+static uint32_t crc32_byte(uint32_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    }
+
+    return crc;
+}
+#else
 static const uint32_t crc_table[256] =
 {
     0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
@@ -63,6 +81,42 @@ static const uint32_t crc_table[256] =
     0x2d02ef8dL
 };
 
+#define crc32_byte(crc, data)       (crc_table[((crc) ^ (data)) & 0xff] ^ ((crc) >> 8))
+#endif
+
+/**
+ * the crc unit runs the msb-first crc-32/mpeg-2 with the same polynomial,
+ * bit reversed data and state turn it into the lsb-first crc used here
+ */
+static uint32_t crc32_hw(uint32_t state, const uint32_t *pdata, uint32_t count)
+{
+    /* data register resets to 0xffffffff, find the word that moves it to state */
+    uint32_t seed = __RBIT(state);
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        seed = (seed & 1) ? (((seed ^ CRC32_POLY) >> 1) | 0x80000000) : (seed >> 1);
+    }
+
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+    CRC->CR = CRC_CR_RESET;
+    CRC->DR = seed ^ 0xffffffff;
+    while (count >= 4)
+    {
+        CRC->DR = __RBIT(pdata[0]);
+        CRC->DR = __RBIT(pdata[1]);
+        CRC->DR = __RBIT(pdata[2]);
+        CRC->DR = __RBIT(pdata[3]);
+        pdata += 4;
+        count -= 4;
+    }
+    while (count--)
+    {
+        CRC->DR = __RBIT(*pdata++);
+    }
+
+    return __RBIT(CRC->DR);
+}
+
 uint32_t crc32(uint32_t prev_crc, const uint8_t *pbuf, uint32_t len)
 {
     if (NULL == pbuf)
@@ -71,9 +125,21 @@ uint32_t crc32(uint32_t prev_crc, const uint8_t *pbuf, uint32_t len)
     }
 
     prev_crc ^= 0xffffffff;
+    if (len >= CRC32_HW_MIN_LEN)
+    {
+        while (0 != ((uint32_t)pbuf & 0x03))
+        {
+            prev_crc = crc32_byte(prev_crc, *pbuf++);
+            len --;
+        }
+        prev_crc = crc32_hw(prev_crc, (const uint32_t *)pbuf, len / 4);
+        pbuf += len & ~0x03;
+        len &= 0x03;
+    }
+
     for (uint32_t i = 0; i < len; i++)
     {
-        prev_crc = crc_table[(prev_crc ^ pbuf[i]) & 0xff] ^ (prev_crc >> 8);
+        prev_crc = crc32_byte(prev_crc, pbuf[i]);
     }
 
     return prev_crc ^ 0xffffffff;
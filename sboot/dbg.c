@@ -7,17 +7,48 @@
 */
 #include <string.h>
 #include <stdarg.h>
+#ifndef __ENABLE_MINIMAL_BUILD
 #include <stdio.h>
+#endif
 #include "stm32f10x.h"
 #include "dbg.h"
 
+#define DBG_BAUDRATE                115200
+
+/* vsprintf relies on the library init that the lean startup skips */
+#if defined(__ENABLE_LEAN_STARTUP) && defined(__ENABLE_TRACE) && !defined(__ENABLE_MINIMAL_BUILD)
+#error "lean startup traces need the __ENABLE_MINIMAL_BUILD formatter"
+#endif
+
+#ifdef __ENABLE_MINIMAL_BUILD
+void dbg_init(void)
+{
+    /* TX PB10 alternate push-pull 50MHz, RX PB11 stays floating input from reset */
+    RCC->APB2ENR |= RCC_APB2ENR_IOPBEN;
+    GPIOB->CRH = (GPIOB->CRH & ~0x00000f00) | 0x00000b00;
+
+    /* PCLK1 prescaler: 0xx /1, 100 /2, 101 /4, 110 /8, 111 /16 */
+    uint32_t ppre1 = (RCC->CFGR & RCC_CFGR_PPRE1) >> 8;
+    uint32_t pclk1 = SystemCoreClock >> ((0 != (ppre1 & 0x04)) ? ((ppre1 & 0x03) + 1) : 0);
+
+    RCC->APB1ENR |= RCC_APB1ENR_USART3EN;
+    USART3->CR1 = 0;
+    USART3->BRR = (pclk1 + DBG_BAUDRATE / 2) / DBG_BAUDRATE;
+    USART3->CR1 = USART_CR1_UE | USART_CR1_TE;
+}
 
+static void dbg_putchar(char data)
+{
+    USART3->DR = data;
+    while (0 == (USART3->SR & USART_SR_TXE));
+}
+#else
 void dbg_init(void)
 {
     GPIO_InitTypeDef GPIO_InitStructure;
     USART_InitTypeDef USART_InitStructure;
 
-    USART_InitStructure.USART_BaudRate = 115200;
+    USART_InitStructure.USART_BaudRate = DBG_BAUDRATE;
     USART_InitStructure.USART_WordLength = USART_WordLength_8b;
     USART_InitStructure.USART_StopBits = USART_StopBits_1;
     USART_InitStructure.USART_Parity = USART_Parity_No;
@@ -46,6 +77,7 @@ static void dbg_putchar(char data)
     USART_SendData(USART3, data);
     while (RESET == USART_GetFlagStatus(USART3, USART_FLAG_TXE));
 }
+#endif
 
 static void dbg_putstring(const char *string, uint32_t length)
 {
@@ -55,6 +87,15 @@ static void dbg_putstring(const char *string, uint32_t length)
     }
 }
 
+void dbg_write(const char *pstr, uint32_t len)
+{
+    /* waiting for TXE of a disabled uart never ends */
+    if (0 != (USART3->CR1 & USART_CR1_UE))
+    {
+        dbg_putstring(pstr, len);
+    }
+}
+
 #ifdef USE_FULL_ASSERT
 void assert_failed(const char *file, const char *line)
 {
@@ -68,13 +109,118 @@ void assert_failed(const char *file, const char *line)
 #endif
 
 #ifdef __ENABLE_TRACE
+#ifdef __ENABLE_MINIMAL_BUILD
+/**
+ * @brief just what the traces use instead of vsprintf:
+ *        %d %u %x %s %c, '0' flag, width, precision for %s
+ */
+static int dbg_format(char *buf, uint32_t size, const char *fmt, va_list argptr)
+{
+    uint32_t cnt = 0;
+    char digits[10];
+
+    for (; ('\0' != *fmt) && (cnt < size - 1); ++fmt)
+    {
+        if ('%' != *fmt)
+        {
+            buf[cnt++] = *fmt;
+            continue;
+        }
+
+        char pad = ' ';
+        uint32_t width = 0;
+        uint32_t precision = 0xffffffff;
+        if ('0' == *++fmt)
+        {
+            pad = '0';
+        }
+        while ((*fmt >= '0') && (*fmt <= '9'))
+        {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        if ('.' == *fmt)
+        {
+            precision = 0;
+            while ((*++fmt >= '0') && (*fmt <= '9'))
+            {
+                precision = precision * 10 + (*fmt - '0');
+            }
+        }
+
+        const char *pstr = digits;
+        uint32_t len = 0;
+        switch (*fmt)
+        {
+        case 's':
+            pstr = va_arg(argptr, const char *);
+            while ((len < precision) && ('\0' != pstr[len]))
+            {
+                len ++;
+            }
+            break;
+        case 'c':
+            digits[0] = (char)va_arg(argptr, int);
+            len = 1;
+            break;
+        case 'd':
+        case 'u':
+        case 'x':
+        {
+            uint32_t value = va_arg(argptr, uint32_t);
+            uint32_t base = ('x' == *fmt) ? 16 : 10;
+            bool negative = ('d' == *fmt) && ((int32_t)value < 0);
+            if (negative)
+            {
+                value = -value;
+            }
+            do
+            {
+                digits[sizeof(digits) - 1 - len++] = "0123456789abcdef"[value % base];
+                value /= base;
+            } while (0 != value);
+            if (negative)
+            {
+                buf[cnt++] = '-';
+                width = (width > 0) ? width - 1 : 0;
+            }
+            pstr = digits + sizeof(digits) - len;
+            break;
+        }
+        case '\0':
+            fmt --;
+            continue;
+        default:
+            digits[0] = *fmt;
+            len = 1;
+            break;
+        }
+
+        for (; (width > len) && (cnt < size - 1); --width)
+        {
+            buf[cnt++] = pad;
+        }
+        for (uint32_t i = 0; (i < len) && (cnt < size - 1); ++i)
+        {
+            buf[cnt++] = pstr[i];
+        }
+    }
+
+    buf[cnt] = '\0';
+    return cnt;
+}
+#endif
+
 void trace(const char *module, const char *fmt, ...)
 {
     char buf[80];
     va_list argptr;
     int cnt;
     va_start(argptr, fmt);
+#ifdef __ENABLE_MINIMAL_BUILD
+    cnt = dbg_format(buf, sizeof(buf), fmt, argptr);
+#else
     cnt = vsprintf(buf, fmt, argptr);
+#endif
     va_end(argptr);
     dbg_putstring(buf, cnt);
     dbg_putchar('\n');
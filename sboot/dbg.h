@@ -17,6 +17,11 @@ BEGIN_DECLS
  */
 void dbg_init(void);
 
+/**
+ * @brief raw output, nothing is sent while the uart is disabled
+ */
+void dbg_write(const char *pstr, uint32_t len);
+
 END_DECLS
 
 #endif /* _DBG_H_ */
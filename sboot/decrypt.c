@@ -0,0 +1,82 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "decrypt.h"
+#include "aes.h"
+#include "keys.h"
+#define __TRACE_MODULE  "[decrypt]"
+#include "trace.h"
+
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+static aes_ctx_t aes;
+static uint8_t counter[AES_BLOCK_SIZE];
+static uint32_t stream_offset;
+/* the source may hand in read-only flash, decrypt a copy */
+static uint8_t decrypt_buffer[DECRYPT_BUFFER_SIZE];
+
+void decrypt_wipe(void)
+{
+    /* volatile, a plain memset of memory never read again may be dropped */
+    volatile uint8_t *pdata = (volatile uint8_t *)&aes;
+    for (uint32_t i = 0; i < sizeof(aes); ++i)
+    {
+        pdata[i] = 0;
+    }
+}
+
+static bool decrypt_open(pipe_stage_t *pstage, const flash_image_header_t *pheader)
+{
+    UNUSED(pstage);
+    aes_init(&aes, image_aes_key);
+    memcpy(counter, pheader->nonce, sizeof(counter));
+    stream_offset = 0;
+    return true;
+}
+
+static bool decrypt_write(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t count = MIN(len, sizeof(decrypt_buffer));
+        memcpy(decrypt_buffer, pdata, count);
+        aes_ctr_crypt(&aes, counter, stream_offset, decrypt_buffer, count);
+        stream_offset += count;
+        if (!pipe_push(pstage, decrypt_buffer, count))
+        {
+            return false;
+        }
+        pdata += count;
+        len -= count;
+    }
+
+    return true;
+}
+
+static bool decrypt_close(pipe_stage_t *pstage)
+{
+    /* programming takes near 2000 cycles per byte at 72MHz, this should be a few dozen */
+    if (0 != stream_offset)
+    {
+        TRACE("%d cycles per byte", pstage->cycles / stream_offset);
+    }
+
+    decrypt_wipe();
+    return true;
+}
+
+pipe_stage_t decrypt_stage =
+{
+    "decrypt",
+    FLASH_FLAG_ENCRYPTED,
+    decrypt_open,
+    decrypt_write,
+    decrypt_close,
+    NULL,
+    0,
+};
+#endif
@@ -0,0 +1,31 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _DECRYPT_H_
+#define _DECRYPT_H_
+
+#include "types.h"
+#include "pipeline.h"
+
+BEGIN_DECLS
+
+/**
+ * aes-128-ctr decryption of images with the encrypted flag, the key is
+ * image_aes_key and the header carries the initial counter block
+ */
+extern pipe_stage_t decrypt_stage;
+#define DECRYPT_BUFFER_SIZE         PIPE_CHUNK_SIZE
+
+/**
+ * @brief clear the expanded key from ram, the stage does it on close, every
+ *        path that may leave before that calls it too
+ */
+void decrypt_wipe(void);
+
+END_DECLS
+
+#endif /* _DECRYPT_H_ */
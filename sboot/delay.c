@@ -6,24 +6,45 @@
 * See the COPYING file for the terms of usage and distribution.
 */
 #include "delay.h"
+#include "stm32f10x.h"
 
-void delay_us(uint16_t time)
+/* core_cm3.h of this cmsis version has no DWT definition */
+#define DWT_CTRL                    (*(__IO uint32_t *)0xe0001000)
+#define DWT_CYCCNT                  (*(__IO uint32_t *)0xe0001004)
+#define DWT_CTRL_CYCCNTENA          0x00000001
+
+void delay_init(void)
 {
-    uint16_t i = 0;
-    while (time--)
-    {
-        i = 10;
-        while (i--);
-    }
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
 }
 
-void delay_ms(uint16_t time)
+uint32_t delay_deadline(uint32_t time)
+{
+    return DWT_CYCCNT + time * (SystemCoreClock / 1000000);
+}
+
+bool delay_expired(uint32_t deadline)
+{
+    return ((int32_t)(DWT_CYCCNT - deadline) >= 0);
+}
+
+uint32_t delay_cycles(void)
+{
+    return DWT_CYCCNT;
+}
+
+void delay_us(uint32_t time)
+{
+    uint32_t deadline = delay_deadline(time);
+    while (!delay_expired(deadline));
+}
+
+void delay_ms(uint32_t time)
 {
-    uint16_t i = 0;
     while (time--)
     {
-        i = 12000;
-        while (i--);
+        delay_us(1000);
     }
 }
-
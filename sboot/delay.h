@@ -12,8 +12,31 @@
 
 BEGIN_DECLS
 
-void delay_us(uint16_t time);
-void delay_ms(uint16_t time);
+/**
+ * time base on the DWT cycle counter, scaled with SystemCoreClock on every
+ * call so it stays right across clock_boost(). A deadline counts cycles, do
+ * not carry one over a clock switch. The longest deadline is 2^31 cycles,
+ * about 29s at 72MHz.
+ */
+
+/**
+ * @brief start the cycle counter
+ */
+void delay_init(void);
+
+void delay_us(uint32_t time);
+void delay_ms(uint32_t time);
+
+/**
+ * @brief deadline time us from now, for delay_expired
+ */
+uint32_t delay_deadline(uint32_t time);
+bool delay_expired(uint32_t deadline);
+
+/**
+ * @brief raw cycle count, for profiling
+ */
+uint32_t delay_cycles(void);
 
 END_DECLS
 
@@ -0,0 +1,868 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "ed25519.h"
+/**
+ * verification only, so nothing here needs constant time. field elements
+ * are 10 signed limbs of alternately 26 and 25 bits (ref10 layout), every
+ * limb product is one 32x32->64 bit smull/smlal on cortex-m3. add and sub
+ * carry straight away, mul and sqr never see limbs much past 2^25.
+ * [h](-A) + [S]B is a single straus pass over sliding window digits of both
+ * scalars with the odd multiples up to 15 of each point, about 1900 field
+ * mul and 1500 sqr per verify. big temporaries, the two 8 point tables
+ * included, are static to stay inside the 1 KB boot stack.
+ */
+typedef int32_t fe_t[10];
+
+/* extended coordinates, x = X / Z, y = Y / Z, x * y = T / Z */
+typedef struct
+{
+    fe_t x;
+    fe_t y;
+    fe_t z;
+    fe_t t;
+} ge_t;
+
+/* addend form of a point, Y + X, Y - X, Z, 2 * d * T */
+typedef struct
+{
+    fe_t yplusx;
+    fe_t yminusx;
+    fe_t z;
+    fe_t t2d;
+} ge_cached_t;
+
+static const fe_t fe_zero = {0};
+static const fe_t fe_one = {1};
+
+/* curve constant d, sqrt(-1) and the base point, little endian */
+static const uint8_t d_bytes[32] =
+{
+    0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d, 0xeb, 0x75,
+    0xab, 0xd8, 0x41, 0x41, 0x4d, 0x0a, 0x70, 0x00,
+    0x98, 0xe8, 0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c,
+    0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c, 0x03, 0x52
+};
+
+static const uint8_t sqrtm1_bytes[32] =
+{
+    0xb0, 0xa0, 0x0e, 0x4a, 0x27, 0x1b, 0xee, 0xc4,
+    0x78, 0xe4, 0x2f, 0xad, 0x06, 0x18, 0x43, 0x2f,
+    0xa7, 0xd7, 0xfb, 0x3d, 0x99, 0x00, 0x4d, 0x2b,
+    0x0b, 0xdf, 0xc1, 0x4f, 0x80, 0x24, 0x83, 0x2b
+};
+
+static const uint8_t base_x_bytes[32] =
+{
+    0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9,
+    0xb2, 0xa7, 0x25, 0x95, 0x60, 0xc7, 0x2c, 0x69,
+    0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0,
+    0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21
+};
+
+static const uint8_t base_y_bytes[32] =
+{
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66
+};
+
+static fe_t fe_d;
+static fe_t fe_d2;
+static fe_t fe_sqrtm1;
+
+/* group order */
+static const int64_t order[32] =
+{
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+    0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+};
+
+static const uint64_t sha512_k[80] =
+{
+    0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full,
+    0xe9b5dba58189dbbcull, 0x3956c25bf348b538ull, 0x59f111f1b605d019ull,
+    0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull, 0xd807aa98a3030242ull,
+    0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+    0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull,
+    0xc19bf174cf692694ull, 0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull,
+    0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull, 0x2de92c6f592b0275ull,
+    0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+    0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full,
+    0xbf597fc7beef0ee4ull, 0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull,
+    0x06ca6351e003826full, 0x142929670a0e6e70ull, 0x27b70a8546d22ffcull,
+    0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+    0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull,
+    0x92722c851482353bull, 0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull,
+    0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull, 0xd192e819d6ef5218ull,
+    0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+    0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull,
+    0x34b0bcb5e19b48a8ull, 0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull,
+    0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull, 0x748f82ee5defb2fcull,
+    0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+    0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull,
+    0xc67178f2e372532bull, 0xca273eceea26619cull, 0xd186b8c721c0c207ull,
+    0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull, 0x06f067aa72176fbaull,
+    0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+    0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull,
+    0x431d67c49c100d4cull, 0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull,
+    0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull
+};
+
+static const uint64_t sha512_iv[8] =
+{
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull,
+    0xa54ff53a5f1d36f1ull, 0x510e527fade682d1ull, 0x9b05688c2b3e6c1full,
+    0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+};
+
+typedef struct
+{
+    uint64_t state[8];
+    uint32_t length;
+    uint8_t buffer[128];
+} sha512_ctx_t;
+
+#define ROR64(x, n)     (((x) >> (n)) | ((x) << (64 - (n))))
+
+static uint64_t load_be64(const uint8_t *pdata)
+{
+    uint64_t val = 0;
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        val = (val << 8) | pdata[i];
+    }
+
+    return val;
+}
+
+static void sha512_transform(uint64_t *pstate, const uint8_t *pdata)
+{
+    uint64_t w[16];
+    uint64_t v[8];
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        w[i] = load_be64(pdata + i * 8);
+    }
+    memcpy(v, pstate, sizeof(v));
+
+    for (uint32_t i = 0; i < 80; ++i)
+    {
+        if (i >= 16)
+        {
+            uint64_t s0 = ROR64(w[(i - 15) & 15], 1) ^ ROR64(w[(i - 15) & 15], 8) ^ (w[(i - 15) & 15] >> 7);
+            uint64_t s1 = ROR64(w[(i - 2) & 15], 19) ^ ROR64(w[(i - 2) & 15], 61) ^ (w[(i - 2) & 15] >> 6);
+            w[i & 15] += s0 + s1 + w[(i - 7) & 15];
+        }
+
+        uint64_t t1 = v[7] + (ROR64(v[4], 14) ^ ROR64(v[4], 18) ^ ROR64(v[4], 41)) +
+                      (v[6] ^ (v[4] & (v[5] ^ v[6]))) + sha512_k[i] + w[i & 15];
+        uint64_t t2 = (ROR64(v[0], 28) ^ ROR64(v[0], 34) ^ ROR64(v[0], 39)) +
+                      ((v[0] & v[1]) | (v[2] & (v[0] | v[1])));
+        memmove(v + 1, v, 7 * sizeof(uint64_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        pstate[i] += v[i];
+    }
+}
+
+static void sha512_init(sha512_ctx_t *pctx)
+{
+    memcpy(pctx->state, sha512_iv, sizeof(sha512_iv));
+    pctx->length = 0;
+}
+
+static void sha512_update(sha512_ctx_t *pctx, const uint8_t *pdata, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t used = pctx->length % 128;
+        uint32_t fill = MIN(128 - used, len);
+        memcpy(pctx->buffer + used, pdata, fill);
+        pctx->length += fill;
+        pdata += fill;
+        len -= fill;
+        if (0 == pctx->length % 128)
+        {
+            sha512_transform(pctx->state, pctx->buffer);
+        }
+    }
+}
+
+static void sha512_final(sha512_ctx_t *pctx, uint8_t *pdigest)
+{
+    uint32_t used = pctx->length % 128;
+    pctx->buffer[used++] = 0x80;
+    if (used > 112)
+    {
+        memset(pctx->buffer + used, 0, 128 - used);
+        sha512_transform(pctx->state, pctx->buffer);
+        used = 0;
+    }
+    memset(pctx->buffer + used, 0, 128 - used);
+    pctx->buffer[123] = pctx->length >> 29;
+    pctx->buffer[124] = pctx->length >> 21;
+    pctx->buffer[125] = pctx->length >> 13;
+    pctx->buffer[126] = pctx->length >> 5;
+    pctx->buffer[127] = pctx->length << 3;
+    sha512_transform(pctx->state, pctx->buffer);
+
+    for (uint32_t i = 0; i < 64; ++i)
+    {
+        pdigest[i] = pctx->state[i / 8] >> (56 - 8 * (i % 8));
+    }
+}
+
+static void fe_copy(fe_t o, const fe_t a)
+{
+    memcpy(o, a, sizeof(fe_t));
+}
+
+/* carry every limb into the next, the top carry wraps around times 19 */
+static void fe_reduce(fe_t o)
+{
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        uint32_t width = (i & 1) ? 25 : 26;
+        int32_t c = (o[i] + (1 << (width - 1))) >> width;
+        o[i] -= c * (1 << width);
+        if (i < 9)
+        {
+            o[i + 1] += c;
+        }
+        else
+        {
+            o[0] += 19 * c;
+        }
+    }
+}
+
+/* same for the 64 bit column sums of mul and sqr */
+static void fe_carry(fe_t o, int64_t *t)
+{
+    int64_t c;
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        uint32_t width = (i & 1) ? 25 : 26;
+        c = (t[i] + ((int64_t)1 << (width - 1))) >> width;
+        t[i] -= c * ((int64_t)1 << width);
+        if (i < 9)
+        {
+            t[i + 1] += c;
+        }
+        else
+        {
+            t[0] += 19 * c;
+        }
+    }
+
+    c = (t[0] + (1 << 25)) >> 26;
+    t[0] -= c * (1 << 26);
+    t[1] += c;
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        o[i] = (int32_t)t[i];
+    }
+}
+
+static void fe_add(fe_t o, const fe_t a, const fe_t b)
+{
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        o[i] = a[i] + b[i];
+    }
+    fe_reduce(o);
+}
+
+static void fe_sub(fe_t o, const fe_t a, const fe_t b)
+{
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        o[i] = a[i] - b[i];
+    }
+    fe_reduce(o);
+}
+
+/**
+ * limb i sits at bit ceil(25.5 * i), so an odd limb times an odd limb lands
+ * one bit short and takes a doubled factor, and 2^255 wraps to 19
+ */
+static void fe_mul(fe_t o, const fe_t f, const fe_t g)
+{
+    int32_t g19[10];
+    int64_t t[10];
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        g19[i] = 19 * g[i];
+        t[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        int32_t fi = f[i];
+        int32_t fi2 = (i & 1) ? 2 * fi : fi;
+        for (uint32_t j = 0; j < 10 - i; ++j)
+        {
+            t[i + j] += (int64_t)((j & 1) ? fi2 : fi) * g[j];
+        }
+        for (uint32_t j = 10 - i; j < 10; ++j)
+        {
+            t[i + j - 10] += (int64_t)((j & 1) ? fi2 : fi) * g19[j];
+        }
+    }
+
+    fe_carry(o, t);
+}
+
+/* 55 limb products instead of 100, cross terms count twice */
+static void fe_sqr(fe_t o, const fe_t f)
+{
+    int32_t f19[10];
+    int64_t t[10];
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        f19[i] = 19 * f[i];
+        t[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        int32_t fi = f[i];
+        int32_t fi2 = 2 * fi;
+        int32_t fi4 = (i & 1) ? 2 * fi2 : fi2;
+        if (i < 5)
+        {
+            t[2 * i] += (int64_t)((i & 1) ? fi2 : fi) * fi;
+        }
+        else
+        {
+            t[2 * i - 10] += (int64_t)((i & 1) ? fi2 : fi) * f19[i];
+        }
+
+        for (uint32_t j = i + 1; j < 10; ++j)
+        {
+            if (i + j < 10)
+            {
+                t[i + j] += (int64_t)((j & 1) ? fi4 : fi2) * f[j];
+            }
+            else
+            {
+                t[i + j - 10] += (int64_t)((j & 1) ? fi4 : fi2) * f19[j];
+            }
+        }
+    }
+
+    fe_carry(o, t);
+}
+
+/* n squarings in a row */
+static void fe_sqrn(fe_t o, const fe_t a, uint32_t n)
+{
+    fe_sqr(o, a);
+    while (--n)
+    {
+        fe_sqr(o, o);
+    }
+}
+
+/* canonical little endian encoding, fully reduced below p */
+static void fe_pack(uint8_t *o, const fe_t n)
+{
+    int32_t h[10];
+    int32_t q;
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+    uint32_t k = 0;
+    memcpy(h, n, sizeof(h));
+
+    /* q is 1 when h is p or more, then h + 19 * q carries q past 2^255 */
+    q = (19 * h[9] + (1 << 24)) >> 25;
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        q = (h[i] + q) >> ((i & 1) ? 25 : 26);
+    }
+
+    h[0] += 19 * q;
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        uint32_t width = (i & 1) ? 25 : 26;
+        int32_t c = h[i] >> width;
+        h[i] -= c * (1 << width);
+        if (i < 9)
+        {
+            h[i + 1] += c;
+        }
+    }
+
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        acc |= (uint64_t)(uint32_t)h[i] << bits;
+        bits += (i & 1) ? 25 : 26;
+        while (bits >= 8)
+        {
+            o[k++] = (uint8_t)acc;
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+    o[k] = (uint8_t)acc;
+}
+
+/* the top bit is the sign of x in a point and is left out */
+static void fe_unpack(fe_t o, const uint8_t *n)
+{
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+        uint32_t width = (i & 1) ? 25 : 26;
+        while (bits < width)
+        {
+            acc |= (uint64_t)((31 == k) ? (n[k] & 0x7f) : n[k]) << bits;
+            k++;
+            bits += 8;
+        }
+        o[i] = (int32_t)(acc & ((1ul << width) - 1));
+        acc >>= width;
+        bits -= width;
+    }
+    fe_reduce(o);
+}
+
+static bool fe_iszero(const fe_t a)
+{
+    static const uint8_t zero[32] = {0};
+    uint8_t d[32];
+    fe_pack(d, a);
+    return 0 == memcmp(d, zero, 32);
+}
+
+static uint8_t fe_parity(const fe_t a)
+{
+    uint8_t d[32];
+    fe_pack(d, a);
+    return d[0] & 1;
+}
+
+/* z^(p - 2), 254 sqr and 11 mul */
+static void fe_invert(fe_t o, const fe_t z)
+{
+    static fe_t t0;
+    static fe_t t1;
+    static fe_t t2;
+    static fe_t t3;
+    fe_sqr(t0, z);
+    fe_sqrn(t1, t0, 2);
+    fe_mul(t1, z, t1);
+    fe_mul(t0, t0, t1);
+    fe_sqr(t2, t0);
+    fe_mul(t1, t1, t2);
+    fe_sqrn(t2, t1, 5);
+    fe_mul(t1, t2, t1);
+    fe_sqrn(t2, t1, 10);
+    fe_mul(t2, t2, t1);
+    fe_sqrn(t3, t2, 20);
+    fe_mul(t2, t3, t2);
+    fe_sqrn(t2, t2, 10);
+    fe_mul(t1, t2, t1);
+    fe_sqrn(t2, t1, 50);
+    fe_mul(t2, t2, t1);
+    fe_sqrn(t3, t2, 100);
+    fe_mul(t2, t3, t2);
+    fe_sqrn(t2, t2, 50);
+    fe_mul(t1, t2, t1);
+    fe_sqrn(t1, t1, 5);
+    fe_mul(o, t1, t0);
+}
+
+/* z^((p - 5) / 8), the square root exponent */
+static void fe_pow22523(fe_t o, const fe_t z)
+{
+    static fe_t t0;
+    static fe_t t1;
+    static fe_t t2;
+    fe_sqr(t0, z);
+    fe_sqrn(t1, t0, 2);
+    fe_mul(t1, z, t1);
+    fe_mul(t0, t0, t1);
+    fe_sqr(t0, t0);
+    fe_mul(t0, t1, t0);
+    fe_sqrn(t1, t0, 5);
+    fe_mul(t0, t1, t0);
+    fe_sqrn(t1, t0, 10);
+    fe_mul(t1, t1, t0);
+    fe_sqrn(t2, t1, 20);
+    fe_mul(t1, t2, t1);
+    fe_sqrn(t1, t1, 10);
+    fe_mul(t0, t1, t0);
+    fe_sqrn(t1, t0, 50);
+    fe_mul(t1, t1, t0);
+    fe_sqrn(t2, t1, 100);
+    fe_mul(t1, t2, t1);
+    fe_sqrn(t1, t1, 50);
+    fe_mul(t0, t1, t0);
+    fe_sqrn(t0, t0, 2);
+    fe_mul(o, t0, z);
+}
+
+static void ge_identity(ge_t *p)
+{
+    fe_copy(p->x, fe_zero);
+    fe_copy(p->y, fe_one);
+    fe_copy(p->z, fe_one);
+    fe_copy(p->t, fe_zero);
+}
+
+static void ge_to_cached(ge_cached_t *c, const ge_t *p)
+{
+    fe_add(c->yplusx, p->y, p->x);
+    fe_sub(c->yminusx, p->y, p->x);
+    fe_copy(c->z, p->z);
+    fe_mul(c->t2d, p->t, fe_d2);
+}
+
+/* r = p + q, or p - q with neg set, r may be p */
+static void ge_add(ge_t *r, const ge_t *p, const ge_cached_t *q, bool neg)
+{
+    static fe_t a;
+    static fe_t b;
+    static fe_t c;
+    static fe_t d;
+    static fe_t e;
+    static fe_t f;
+    static fe_t g;
+    static fe_t h;
+
+    /* -q swaps Y + X with Y - X and negates T */
+    fe_sub(a, p->y, p->x);
+    fe_mul(a, a, neg ? q->yplusx : q->yminusx);
+    fe_add(b, p->y, p->x);
+    fe_mul(b, b, neg ? q->yminusx : q->yplusx);
+    fe_mul(c, p->t, q->t2d);
+    fe_mul(d, p->z, q->z);
+    fe_add(d, d, d);
+    fe_sub(e, b, a);
+    fe_add(h, b, a);
+    if (neg)
+    {
+        fe_add(f, d, c);
+        fe_sub(g, d, c);
+    }
+    else
+    {
+        fe_sub(f, d, c);
+        fe_add(g, d, c);
+    }
+
+    fe_mul(r->x, e, f);
+    fe_mul(r->y, g, h);
+    fe_mul(r->t, e, h);
+    fe_mul(r->z, f, g);
+}
+
+/* r = 2p, 4 sqr and 4 mul, r may be p */
+static void ge_dbl(ge_t *r, const ge_t *p)
+{
+    static fe_t a;
+    static fe_t b;
+    static fe_t c;
+    static fe_t e;
+    static fe_t f;
+    static fe_t g;
+    static fe_t h;
+
+    fe_sqr(a, p->x);
+    fe_sqr(b, p->y);
+    fe_sqr(c, p->z);
+    fe_add(c, c, c);
+    fe_add(e, p->x, p->y);
+    fe_sqr(e, e);
+    fe_sub(e, e, a);
+    fe_sub(e, e, b);
+    fe_sub(g, b, a);
+    fe_sub(f, g, c);
+    fe_sub(h, fe_zero, a);
+    fe_sub(h, h, b);
+
+    fe_mul(r->x, e, f);
+    fe_mul(r->y, g, h);
+    fe_mul(r->t, e, h);
+    fe_mul(r->z, f, g);
+}
+
+/* odd multiples p, 3p, ..., 15p for the sliding window */
+static void ge_table(ge_cached_t *ptable, const ge_t *p)
+{
+    static ge_t q;
+    static ge_cached_t p2;
+
+    ge_dbl(&q, p);
+    ge_to_cached(&p2, &q);
+    ge_to_cached(&ptable[0], p);
+    q = *p;
+    for (uint32_t i = 1; i < 8; ++i)
+    {
+        ge_add(&q, &q, &p2, false);
+        ge_to_cached(&ptable[i], &q);
+    }
+}
+
+static void ge_pack(uint8_t *r, const ge_t *p)
+{
+    static fe_t zi;
+    static fe_t tx;
+    static fe_t ty;
+    fe_invert(zi, p->z);
+    fe_mul(tx, p->x, zi);
+    fe_mul(ty, p->y, zi);
+    fe_pack(r, ty);
+    r[31] ^= fe_parity(tx) << 7;
+}
+
+/* decode a point and negate it, false when it is not a canonical curve point */
+static bool ge_unpack_neg(ge_t *r, const uint8_t *p)
+{
+    static fe_t u;
+    static fe_t v;
+    static fe_t v3;
+    static fe_t chk;
+    uint8_t y[32];
+
+    fe_unpack(r->y, p);
+    fe_pack(y, r->y);
+    y[31] |= p[31] & 0x80;
+    if (0 != memcmp(y, p, 32))
+    {
+        return false;
+    }
+
+    fe_copy(r->z, fe_one);
+    fe_sqr(u, r->y);
+    fe_mul(v, u, fe_d);
+    fe_sub(u, u, r->z);
+    fe_add(v, v, r->z);
+
+    /* x = u * v^3 * (u * v^7)^((p - 5) / 8) */
+    fe_sqr(v3, v);
+    fe_mul(v3, v3, v);
+    fe_sqr(r->x, v3);
+    fe_mul(r->x, r->x, v);
+    fe_mul(r->x, r->x, u);
+    fe_pow22523(r->x, r->x);
+    fe_mul(r->x, r->x, v3);
+    fe_mul(r->x, r->x, u);
+
+    fe_sqr(chk, r->x);
+    fe_mul(chk, chk, v);
+    fe_sub(v3, chk, u);
+    if (!fe_iszero(v3))
+    {
+        fe_add(v3, chk, u);
+        if (!fe_iszero(v3))
+        {
+            return false;
+        }
+        fe_mul(r->x, r->x, fe_sqrtm1);
+    }
+
+    if (fe_iszero(r->x) && (p[31] >> 7))
+    {
+        return false;
+    }
+
+    if (fe_parity(r->x) == (p[31] >> 7))
+    {
+        fe_sub(r->x, fe_zero, r->x);
+    }
+
+    fe_mul(r->t, r->x, r->y);
+    return true;
+}
+
+/* reduce 64 byte little endian number modulo the group order */
+static void sc_reduce(uint8_t *r)
+{
+    static int64_t x[64];
+    int64_t carry;
+    int i;
+    int j;
+    for (i = 0; i < 64; ++i)
+    {
+        x[i] = r[i];
+    }
+
+    for (i = 63; i >= 32; --i)
+    {
+        carry = 0;
+        for (j = i - 32; j < i - 12; ++j)
+        {
+            x[j] += carry - 16 * x[i] * order[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+
+    carry = 0;
+    for (j = 0; j < 32; ++j)
+    {
+        x[j] += carry - (x[31] >> 4) * order[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; ++j)
+    {
+        x[j] -= carry * order[j];
+    }
+    for (i = 0; i < 32; ++i)
+    {
+        x[i + 1] += x[i] >> 8;
+        r[i] = x[i] & 255;
+    }
+    memset(r + 32, 0, 32);
+}
+
+/* S < L, RFC 8032 rejects a signature with S reduced any less */
+static bool sc_canonical(const uint8_t *s)
+{
+    for (int i = 31; i >= 0; --i)
+    {
+        if (s[i] != order[i])
+        {
+            return s[i] < order[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * signed digits of a scalar below 2^255, each one zero or odd in -15..15
+ * with at least four zeros after every nonzero one (ref10 slide)
+ */
+static void sc_slide(int8_t *r, const uint8_t *a)
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        r[i] = 1 & (a[i >> 3] >> (i & 7));
+    }
+
+    for (int i = 0; i < 256; ++i)
+    {
+        if (!r[i])
+        {
+            continue;
+        }
+
+        for (int b = 1; (b <= 6) && (i + b < 256); ++b)
+        {
+            if (!r[i + b])
+            {
+                continue;
+            }
+
+            if (r[i] + r[i + b] * (1 << b) <= 15)
+            {
+                r[i] += r[i + b] << b;
+                r[i + b] = 0;
+            }
+            else if (r[i] - r[i + b] * (1 << b) >= -15)
+            {
+                r[i] -= r[i + b] << b;
+                for (int k = i + b; k < 256; ++k)
+                {
+                    if (!r[k])
+                    {
+                        r[k] = 1;
+                        break;
+                    }
+                    r[k] = 0;
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+}
+
+bool ed25519_verify(const uint8_t *psig, const uint8_t *pmsg, uint32_t len, const uint8_t *pkey)
+{
+    static ge_t p;
+    static ge_t q;
+    static ge_cached_t a_table[8];
+    static ge_cached_t b_table[8];
+    static int8_t a_slide[256];
+    static int8_t b_slide[256];
+    static sha512_ctx_t ctx;
+    uint8_t h[64];
+    uint8_t r[32];
+    int i;
+
+    if (!sc_canonical(psig + 32))
+    {
+        return false;
+    }
+
+    fe_unpack(fe_d, d_bytes);
+    fe_add(fe_d2, fe_d, fe_d);
+    fe_unpack(fe_sqrtm1, sqrtm1_bytes);
+
+    if (!ge_unpack_neg(&q, pkey))
+    {
+        return false;
+    }
+
+    /* h = H(R || A || M) */
+    sha512_init(&ctx);
+    sha512_update(&ctx, psig, 32);
+    sha512_update(&ctx, pkey, 32);
+    sha512_update(&ctx, pmsg, len);
+    sha512_final(&ctx, h);
+    sc_reduce(h);
+
+    ge_table(a_table, &q);
+    fe_unpack(p.x, base_x_bytes);
+    fe_unpack(p.y, base_y_bytes);
+    fe_copy(p.z, fe_one);
+    fe_mul(p.t, p.x, p.y);
+    ge_table(b_table, &p);
+
+    /* R == [h](-A) + [S]B, doublings shared between both scalars */
+    sc_slide(a_slide, h);
+    sc_slide(b_slide, psig + 32);
+    ge_identity(&p);
+    for (i = 255; (i >= 0) && !a_slide[i] && !b_slide[i]; --i)
+    {
+    }
+
+    for (; i >= 0; --i)
+    {
+        ge_dbl(&p, &p);
+        if (a_slide[i])
+        {
+            ge_add(&p, &p, &a_table[(a_slide[i] < 0 ? -a_slide[i] : a_slide[i]) / 2], a_slide[i] < 0);
+        }
+        if (b_slide[i])
+        {
+            ge_add(&p, &p, &b_table[(b_slide[i] < 0 ? -b_slide[i] : b_slide[i]) / 2], b_slide[i] < 0);
+        }
+    }
+
+    ge_pack(r, &p);
+    return 0 == memcmp(psig, r, 32);
+}
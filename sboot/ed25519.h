@@ -0,0 +1,30 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _ED25519_H_
+#define _ED25519_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+#define ED25519_KEY_SIZE            32
+#define ED25519_SIGNATURE_SIZE      64
+
+/**
+ * @brief verify ed25519 signature (RFC 8032), not reentrant
+ * @param[in] psig: signature, R || S
+ * @param[in] pmsg: signed message
+ * @param[in] len: message length
+ * @param[in] pkey: public key
+ * @return true if signature is valid
+ */
+bool ed25519_verify(const uint8_t *psig, const uint8_t *pmsg, uint32_t len, const uint8_t *pkey);
+
+END_DECLS
+
+#endif /* _ED25519_H_ */
@@ -0,0 +1,261 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "fat.h"
+#define __TRACE_MODULE  "[fat]"
+#include "trace.h"
+
+#define FAT_DIR_ENTRY_SIZE          32
+#define FAT_ATTR_LONG_NAME          0x0f
+#define FAT_ATTR_VOLUME_ID          0x08
+#define FAT_ATTR_DIRECTORY          0x10
+#define FAT_ENTRY_DELETED           0xe5
+#define FAT_SECTOR_NONE             0xffffffff
+
+static uint16_t get_u16(const uint8_t *pdata)
+{
+    return pdata[0] | (pdata[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *pdata)
+{
+    return pdata[0] | (pdata[1] << 8) | (pdata[2] << 16) | ((uint32_t)pdata[3] << 24);
+}
+
+static const uint8_t *fat_sector_read(fat_volume_t *pvol, uint32_t sector)
+{
+    if (sector != pvol->cached_sector)
+    {
+        if (!sdcard_read(sector, (uint8_t *)pvol->sector, 1))
+        {
+            pvol->cached_sector = FAT_SECTOR_NONE;
+            return NULL;
+        }
+        pvol->cached_sector = sector;
+    }
+
+    return (const uint8_t *)pvol->sector;
+}
+
+static bool fat_cluster_valid(const fat_volume_t *pvol, uint32_t cluster)
+{
+    return (cluster >= 2) && (cluster < pvol->cluster_count + 2);
+}
+
+/* returns 0 at the end of chain or on error */
+static uint32_t fat_next_cluster(fat_volume_t *pvol, uint32_t cluster)
+{
+    uint32_t offset = cluster * (pvol->fat32 ? 4 : 2);
+    const uint8_t *psector = fat_sector_read(pvol, pvol->fat_start + offset / SDCARD_SECTOR_SIZE);
+    if (NULL == psector)
+    {
+        return 0;
+    }
+
+    offset %= SDCARD_SECTOR_SIZE;
+    uint32_t next = pvol->fat32 ? (get_u32(psector + offset) & 0x0fffffff) : get_u16(psector + offset);
+    return fat_cluster_valid(pvol, next) ? next : 0;
+}
+
+static uint32_t fat_cluster_sector(const fat_volume_t *pvol, uint32_t cluster)
+{
+    return pvol->data_start + ((cluster - 2) << pvol->cluster_shift);
+}
+
+bool fat_mount(fat_volume_t *pvol)
+{
+    const uint8_t *psector;
+    uint32_t lba = 0;
+
+    pvol->cached_sector = FAT_SECTOR_NONE;
+    psector = fat_sector_read(pvol, 0);
+    if ((NULL == psector) || (0xaa55 != get_u16(psector + 510)))
+    {
+        TRACE("no valid boot sector");
+        return false;
+    }
+
+    /* no volume boot record at sector 0, take the first partition */
+    if (((0xeb != psector[0]) && (0xe9 != psector[0])) ||
+        (SDCARD_SECTOR_SIZE != get_u16(psector + 11)))
+    {
+        lba = get_u32(psector + 446 + 8);
+        psector = fat_sector_read(pvol, lba);
+        if ((NULL == psector) || (0xaa55 != get_u16(psector + 510)) ||
+            (SDCARD_SECTOR_SIZE != get_u16(psector + 11)))
+        {
+            TRACE("unsupported partition");
+            return false;
+        }
+    }
+
+    uint8_t sectors_per_cluster = psector[13];
+    uint16_t reserved = get_u16(psector + 14);
+    uint8_t fat_count = psector[16];
+    uint16_t root_entries = get_u16(psector + 17);
+    uint32_t total = get_u16(psector + 19);
+    uint32_t fat_size = get_u16(psector + 22);
+    if (0 == total)
+    {
+        total = get_u32(psector + 32);
+    }
+    if (0 == fat_size)
+    {
+        fat_size = get_u32(psector + 36);
+    }
+
+    pvol->cluster_shift = 0;
+    while ((1u << pvol->cluster_shift) < sectors_per_cluster)
+    {
+        pvol->cluster_shift ++;
+    }
+    if ((0 == sectors_per_cluster) || ((1u << pvol->cluster_shift) != sectors_per_cluster))
+    {
+        TRACE("invalid cluster size %d", sectors_per_cluster);
+        return false;
+    }
+
+    pvol->root_cluster = get_u32(psector + 44);
+    pvol->fat_start = lba + reserved;
+    pvol->root_start = pvol->fat_start + fat_count * fat_size;
+    pvol->root_sectors = (root_entries * FAT_DIR_ENTRY_SIZE + SDCARD_SECTOR_SIZE - 1) / SDCARD_SECTOR_SIZE;
+    pvol->data_start = pvol->root_start + pvol->root_sectors;
+    pvol->cluster_count = (total - (pvol->data_start - lba)) >> pvol->cluster_shift;
+    pvol->fat32 = (pvol->cluster_count >= 65525);
+    if (pvol->cluster_count < 4085)
+    {
+        TRACE("fat12 not supported");
+        return false;
+    }
+
+    TRACE("fat%d mounted, %d clusters", pvol->fat32 ? 32 : 16, pvol->cluster_count);
+    return true;
+}
+
+static bool fat_dir_match(fat_volume_t *pvol, uint32_t sector, const char *name,
+                          fat_file_t *pfile, bool *pend)
+{
+    const uint8_t *psector = fat_sector_read(pvol, sector);
+    if (NULL == psector)
+    {
+        *pend = true;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < SDCARD_SECTOR_SIZE; i += FAT_DIR_ENTRY_SIZE)
+    {
+        const uint8_t *pentry = psector + i;
+        if (0 == pentry[0])
+        {
+            *pend = true;
+            return false;
+        }
+
+        if ((FAT_ENTRY_DELETED == pentry[0]) ||
+            (0 != (pentry[11] & (FAT_ATTR_VOLUME_ID | FAT_ATTR_DIRECTORY))) ||
+            (0 != memcmp(pentry, name, 11)))
+        {
+            continue;
+        }
+
+        pfile->pvol = pvol;
+        pfile->size = get_u32(pentry + 28);
+        pfile->first_cluster = (get_u16(pentry + 20) << 16) | get_u16(pentry + 26);
+        if (!pvol->fat32)
+        {
+            pfile->first_cluster &= 0xffff;
+        }
+        pfile->cluster = pfile->first_cluster;
+        pfile->cluster_index = 0;
+        return true;
+    }
+
+    return false;
+}
+
+bool fat_open(fat_volume_t *pvol, const char *name, fat_file_t *pfile)
+{
+    bool end = false;
+    if (pvol->fat32)
+    {
+        for (uint32_t cluster = pvol->root_cluster; fat_cluster_valid(pvol, cluster) && !end;
+             cluster = fat_next_cluster(pvol, cluster))
+        {
+            for (uint32_t i = 0; (i < (1u << pvol->cluster_shift)) && !end; ++i)
+            {
+                if (fat_dir_match(pvol, fat_cluster_sector(pvol, cluster) + i, name, pfile, &end))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; (i < pvol->root_sectors) && !end; ++i)
+        {
+            if (fat_dir_match(pvol, pvol->root_start + i, name, pfile, &end))
+            {
+                return true;
+            }
+        }
+    }
+
+    TRACE("file %.11s not found", name);
+    return false;
+}
+
+uint32_t fat_map(fat_file_t *pfile, uint32_t offset, uint32_t *pcount)
+{
+    fat_volume_t *pvol = pfile->pvol;
+    uint32_t sector = offset / SDCARD_SECTOR_SIZE;
+    uint32_t cluster_index = sector >> pvol->cluster_shift;
+    uint32_t cluster_sectors = 1u << pvol->cluster_shift;
+
+    /* streaming moves forward, restart the chain only when going back */
+    if (cluster_index < pfile->cluster_index)
+    {
+        pfile->cluster = pfile->first_cluster;
+        pfile->cluster_index = 0;
+    }
+
+    while (pfile->cluster_index < cluster_index)
+    {
+        pfile->cluster = fat_next_cluster(pvol, pfile->cluster);
+        pfile->cluster_index ++;
+        if (0 == pfile->cluster)
+        {
+            pfile->cluster_index = 0;
+            pfile->cluster = pfile->first_cluster;
+            return 0;
+        }
+    }
+
+    if (!fat_cluster_valid(pvol, pfile->cluster))
+    {
+        return 0;
+    }
+
+    /* merge physically contiguous clusters into one multi-block read */
+    sector &= cluster_sectors - 1;
+    uint32_t count = cluster_sectors - sector;
+    uint32_t cluster = pfile->cluster;
+    while (count < *pcount)
+    {
+        uint32_t next = fat_next_cluster(pvol, cluster);
+        if (next != cluster + 1)
+        {
+            break;
+        }
+        cluster = next;
+        count += cluster_sectors;
+    }
+
+    *pcount = MIN(count, *pcount);
+    return fat_cluster_sector(pvol, pfile->cluster) + sector;
+}
@@ -0,0 +1,62 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _FAT_H_
+#define _FAT_H_
+
+#include "types.h"
+#include "sdcard.h"
+
+BEGIN_DECLS
+
+/* minimal read-only FAT16/FAT32 reader, root directory and 8.3 names only */
+typedef struct
+{
+    uint32_t fat_start;
+    uint32_t root_start;
+    uint32_t root_sectors;
+    uint32_t root_cluster;
+    uint32_t data_start;
+    uint32_t cluster_count;
+    uint8_t cluster_shift;
+    bool fat32;
+    uint32_t cached_sector;
+    uint32_t sector[SDCARD_SECTOR_SIZE / 4];
+} fat_volume_t;
+
+typedef struct
+{
+    fat_volume_t *pvol;
+    uint32_t size;
+    uint32_t first_cluster;
+    uint32_t cluster;
+    uint32_t cluster_index;
+} fat_file_t;
+
+/**
+ * @brief mount first partition, or a card without partition table
+ */
+bool fat_mount(fat_volume_t *pvol);
+
+/**
+ * @brief open file in root directory
+ * @param[in] name: 8.3 name padded with spaces, e.g. "FIRMWAREBIN"
+ */
+bool fat_open(fat_volume_t *pvol, const char *name, fat_file_t *pfile);
+
+/**
+ * @brief map file offset to card sectors
+ * @param[in] offset: sector aligned file offset
+ * @param[in,out] pcount: wanted sector count, returns contiguous sectors
+ *                        available from the returned sector
+ * @return first card sector, 0 if offset is outside the cluster chain
+ */
+uint32_t fat_map(fat_file_t *pfile, uint32_t offset, uint32_t *pcount);
+
+END_DECLS
+
+#endif /* _FAT_H_ */
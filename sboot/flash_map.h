@@ -9,13 +9,80 @@
 #define _FLASH_MAP_H_
 
 #define SBOOT_IMAGE_ADDR                        0x08000000
+#ifdef __ENABLE_MINIMAL_BUILD
+/**
+ * size optimised build fits in 8KB, the app starts 2 pages earlier. It only
+ * upgrades from internal flash staging: the service table, key-value store
+ * and scheduler are compiled out, the app keeps the key-value store pages,
+ * and the options below do not fit
+ */
+#define SBOOT_IMAGE_SIZE                        0x00002000
+#if defined(__ENABLE_CAN_UPGRADE) || defined(__ENABLE_SDCARD_UPGRADE) || defined(__ENABLE_SPI_FLASH) || \
+    defined(__ENABLE_ENCRYPTED_IMAGE) || defined(__ENABLE_SIGNED_IMAGE) || defined(__ENABLE_FLASH_TELEMETRY)
+#error "option does not fit the 8KB __ENABLE_MINIMAL_BUILD"
+#endif
+#define KV_STORE_SIZE                           0x00000000
+#else
 #define SBOOT_IMAGE_SIZE                        0x00004000
-#define APP_IMAGE_ADDR                          0x08004000
-#define APP_IMAGE_SIZE                          0x0003E000
+/* two pages behind the app for the key-value store, see kv.h */
+#define KV_STORE_SIZE                           0x00001000
+#endif
+/* service table for the app after the vector table, see service.h */
+#define SBOOT_SERVICE_ADDR                      (SBOOT_IMAGE_ADDR + 0x00000200)
+/* last sboot page holds nothing but the image key, see keys.h */
+#define SBOOT_KEYS_SIZE                         0x00000800
+#define SBOOT_KEYS_ADDR                         (SBOOT_IMAGE_ADDR + SBOOT_IMAGE_SIZE - SBOOT_KEYS_SIZE)
+#ifdef STM32F10X_XL
+/**
+ * xl parts have two 512KB banks, the app gets bank 2 and sboot runs from
+ * bank 1 with the staging area, so programming the app never stalls it
+ */
+#define APP_IMAGE_ADDR                          0x08080000
+#else
+#define APP_IMAGE_ADDR                          (SBOOT_IMAGE_ADDR + SBOOT_IMAGE_SIZE)
+#endif
+
+#if defined(STM32F10X_XL)
+#define APP_IMAGE_SIZE                          (0x00080000 - KV_STORE_SIZE)
+#ifdef __ENABLE_SPI_FLASH
+#define UPGRADE_IMAGE_HEADER_ADDR               0x00000000
+#define UPGRADE_IMAGE_HEADER_SIZE               0x00001000
+#define UPGRADE_IMAGE_ADDR                      0x00001000
+#define UPGRADE_IMAGE_SIZE                      0x0007C000
+#define UPGRADE_IMAGE_MAPPED                    0
+#else
+#define UPGRADE_IMAGE_HEADER_ADDR               (SBOOT_IMAGE_ADDR + SBOOT_IMAGE_SIZE)
+#define UPGRADE_IMAGE_HEADER_SIZE               0x00000800
+#define UPGRADE_IMAGE_ADDR                      (UPGRADE_IMAGE_HEADER_ADDR + UPGRADE_IMAGE_HEADER_SIZE)
+#define UPGRADE_IMAGE_SIZE                      (0x08080000 - UPGRADE_IMAGE_ADDR)
+#define UPGRADE_IMAGE_MAPPED                    1
+#endif
+#elif defined(__ENABLE_SPI_FLASH)
+/* upgrade image lives in external spi flash, app gets the rest of internal flash */
+#define APP_IMAGE_SIZE                          (0x08080000 - KV_STORE_SIZE - APP_IMAGE_ADDR)
+#define UPGRADE_IMAGE_HEADER_ADDR               0x00000000
+#define UPGRADE_IMAGE_HEADER_SIZE               0x00001000
+#define UPGRADE_IMAGE_ADDR                      0x00001000
+#define UPGRADE_IMAGE_SIZE                      0x0007C000
+/* staging device is not memory mapped, see storage.h */
+#define UPGRADE_IMAGE_MAPPED                    0
+#else
+#define APP_IMAGE_SIZE                          (0x08042000 - KV_STORE_SIZE - APP_IMAGE_ADDR)
 #define UPGRADE_IMAGE_HEADER_ADDR               0x08042000
 #define UPGRADE_IMAGE_HEADER_SIZE               0x00000800
 #define UPGRADE_IMAGE_ADDR                      0x08042800
 #define UPGRADE_IMAGE_SIZE                      0x0003D800
+#define UPGRADE_IMAGE_MAPPED                    1
+#endif
+
+#ifndef __ENABLE_MINIMAL_BUILD
+#define KV_STORE_ADDR                           (APP_IMAGE_ADDR + APP_IMAGE_SIZE)
+#endif
+
+/* per-block crc manifest behind the header */
+#define UPGRADE_IMAGE_MANIFEST_ADDR             (UPGRADE_IMAGE_HEADER_ADDR + 0x80)
+/* state record in the last bytes of the header page, reset with the header */
+#define UPGRADE_IMAGE_STATE_ADDR                (UPGRADE_IMAGE_HEADER_ADDR + UPGRADE_IMAGE_HEADER_SIZE - 0x40)
 
 
 #endif /* _FLASH_MAP_H_ */
@@ -0,0 +1,66 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "keys.h"
+#include "stm32f10x.h"
+#include "stm32f10x_flash.h"
+
+/**
+ * replace with the product signing key before release, the placeholder is
+ * not a curve point so every image is rejected
+ */
+const uint8_t image_public_key[32] =
+{
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#ifdef __CC_ARM
+#define KEYS_PLACE                  __attribute__((at(SBOOT_KEYS_ADDR)))
+#else
+#define KEYS_PLACE                  __attribute__((section(".sboot_keys")))
+#endif
+
+/* a write protection bit covers 4KB, these cover the sboot image */
+#define KEYS_WRP_PAGES              ((1ul << (SBOOT_IMAGE_SIZE / 0x1000)) - 1)
+
+/**
+ * replace with the product image key before release. It keeps images on the
+ * bus, the sd card or the staging spi flash private. Readout protection
+ * stops debugger and system bootloader reads and write protection stops
+ * replacing it. The app runs from the same flash though and could still
+ * read the page, code running on the part must be trusted with the key.
+ * The expanded key is wiped from ram before the app starts
+ */
+const uint8_t image_aes_key[SBOOT_KEYS_SIZE] KEYS_PLACE =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+void keys_protect(void)
+{
+#ifndef __DEBUG
+    if ((SET == FLASH_GetReadOutProtectionStatus()) &&
+        (0 == (FLASH_GetWriteProtectionOptionByte() & KEYS_WRP_PAGES)))
+    {
+        return;
+    }
+
+    FLASH_Unlock();
+    /* erases the option bytes first, write protection goes on after it */
+    FLASH_ReadOutProtection(ENABLE);
+    FLASH_EnableWriteProtection(KEYS_WRP_PAGES);
+    FLASH_Lock();
+    /* option bytes load on reset */
+    NVIC_SystemReset();
+#endif
+}
+#endif
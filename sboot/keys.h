@@ -0,0 +1,36 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _KEYS_H_
+#define _KEYS_H_
+
+#include "types.h"
+#include "flash_map.h"
+
+BEGIN_DECLS
+
+/* ed25519 public key of the image signer */
+extern const uint8_t image_public_key[32];
+
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+/**
+ * aes-128 key of encrypted images in the first 16 bytes, padded to fill the
+ * SBOOT_KEYS_ADDR page alone
+ */
+extern const uint8_t image_aes_key[SBOOT_KEYS_SIZE];
+
+/**
+ * @brief readout protect the part and write protect the sboot pages, the
+ *        key page included. Programs the option bytes and resets if either
+ *        is missing, debug builds leave the part open for the debugger
+ */
+void keys_protect(void);
+#endif
+
+END_DECLS
+
+#endif /* _KEYS_H_ */
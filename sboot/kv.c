@@ -0,0 +1,276 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "kv.h"
+#include "flash_map.h"
+#include "storage.h"
+#include "crc32.h"
+
+/* only the service table and telemetry use it, neither is in the minimal build */
+#ifndef __ENABLE_MINIMAL_BUILD
+
+#define KV_PAGE_SIZE                (KV_STORE_SIZE / 2)
+#define KV_MAGIC                    0x4b565331
+#define KV_KEY_BLANK                0xffff
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t generation;
+} kv_page_header_t;
+
+/* followed by len value bytes, padded to a word */
+typedef struct
+{
+    uint16_t key;
+    uint16_t len;
+    uint32_t crc;
+} kv_record_t;
+
+#define KV_RECORD_SIZE(len)         (sizeof(kv_record_t) + (((len) + 3) & ~0x03))
+
+static uint32_t kv_record_crc(const kv_record_t *precord)
+{
+    uint32_t crc_val = crc32(0, (const uint8_t *)precord, 4);
+    return crc32(crc_val, (const uint8_t *)(precord + 1), precord->len);
+}
+
+static const kv_record_t *kv_record(const kv_store_t *pkv, uint32_t offset)
+{
+    return (const kv_record_t *)(pkv->page + offset);
+}
+
+static bool kv_page_valid(uint32_t page)
+{
+    const kv_page_header_t *pheader = (const kv_page_header_t *)page;
+    return (KV_MAGIC == pheader->magic) && (0xffffffff != pheader->generation);
+}
+
+static uint32_t kv_page_generation(uint32_t page)
+{
+    return ((const kv_page_header_t *)page)->generation;
+}
+
+/**
+ * @brief programmed after the records, it makes the page the active one
+ */
+static FLASH_Status kv_page_activate(kv_store_t *pkv, uint32_t page, uint32_t generation)
+{
+    kv_page_header_t header = {KV_MAGIC, generation};
+    FLASH_Status status = flash_standalone_program(page, (const uint8_t *)&header, sizeof(header));
+    if (FLASH_COMPLETE == status)
+    {
+        pkv->page = page;
+        pkv->generation = generation;
+    }
+
+    return status;
+}
+
+static void kv_scan(kv_store_t *pkv)
+{
+    memset(pkv->index, 0, sizeof(pkv->index));
+    uint32_t offset = sizeof(kv_page_header_t);
+    while (offset + sizeof(kv_record_t) <= KV_PAGE_SIZE)
+    {
+        const kv_record_t *precord = kv_record(pkv, offset);
+        if (KV_KEY_BLANK == precord->key)
+        {
+            break;
+        }
+
+        if ((precord->len > KV_VALUE_MAX) || (offset + KV_RECORD_SIZE(precord->len) > KV_PAGE_SIZE))
+        {
+            /* torn record header, append nothing behind it */
+            offset = KV_PAGE_SIZE;
+            break;
+        }
+
+        if ((precord->key < KV_MAX_KEYS) && (kv_record_crc(precord) == precord->crc))
+        {
+            pkv->index[precord->key] = (0 == precord->len) ? 0 : offset;
+        }
+        offset += KV_RECORD_SIZE(precord->len);
+    }
+
+    pkv->free = offset;
+}
+
+FLASH_Status kv_mount(kv_store_t *pkv)
+{
+    uint32_t first = KV_STORE_ADDR;
+    uint32_t second = KV_STORE_ADDR + KV_PAGE_SIZE;
+    bool first_valid = kv_page_valid(first);
+    bool second_valid = kv_page_valid(second);
+    if (!first_valid && !second_valid)
+    {
+        memset(pkv->index, 0, sizeof(pkv->index));
+        pkv->free = sizeof(kv_page_header_t);
+        FLASH_Status status = flash_standalone_erase(first);
+        if (FLASH_COMPLETE == status)
+        {
+            status = kv_page_activate(pkv, first, 1);
+        }
+        return status;
+    }
+
+    /* the page a compaction finished last */
+    if (second_valid && (!first_valid || (kv_page_generation(second) > kv_page_generation(first))))
+    {
+        first = second;
+    }
+    pkv->page = first;
+    pkv->generation = kv_page_generation(first);
+    kv_scan(pkv);
+    return FLASH_COMPLETE;
+}
+
+uint16_t kv_read(const kv_store_t *pkv, uint16_t key, void *pbuf, uint16_t size)
+{
+    if ((key >= KV_MAX_KEYS) || (0 == pkv->index[key]))
+    {
+        return 0;
+    }
+
+    const kv_record_t *precord = kv_record(pkv, pkv->index[key]);
+    uint16_t len = MIN(precord->len, size);
+    memcpy(pbuf, precord + 1, len);
+    return len;
+}
+
+/**
+ * @brief record a compaction copies for key, pnew replaces the latest one
+ *        of its key
+ * @return NULL if the key has no value
+ */
+static const kv_record_t *kv_live_record(const kv_store_t *pkv, uint16_t key, const kv_record_t *pnew)
+{
+    if (key == pnew->key)
+    {
+        return (0 == pnew->len) ? NULL : pnew;
+    }
+
+    return (0 == pkv->index[key]) ? NULL : kv_record(pkv, pkv->index[key]);
+}
+
+/**
+ * @brief page bytes a compaction with pnew leaves in use
+ */
+static uint32_t kv_live_size(const kv_store_t *pkv, const kv_record_t *pnew)
+{
+    uint32_t size = sizeof(kv_page_header_t);
+    for (uint16_t key = 0; key < KV_MAX_KEYS; ++key)
+    {
+        const kv_record_t *precord = kv_live_record(pkv, key, pnew);
+        if (NULL != precord)
+        {
+            size += KV_RECORD_SIZE(precord->len);
+        }
+    }
+
+    return size;
+}
+
+/**
+ * @brief copy the latest record of every key into the other page, which
+ *        becomes the active one. pnew goes in instead of the old record of
+ *        its key, the old value stays active until the page header is
+ *        programmed
+ */
+static FLASH_Status kv_compact(kv_store_t *pkv, const kv_record_t *pnew)
+{
+    uint32_t target = (KV_STORE_ADDR == pkv->page) ? (KV_STORE_ADDR + KV_PAGE_SIZE) : KV_STORE_ADDR;
+    uint16_t index[KV_MAX_KEYS];
+    uint32_t offset = sizeof(kv_page_header_t);
+    FLASH_Status status = flash_standalone_erase(target);
+    for (uint16_t key = 0; (key < KV_MAX_KEYS) && (FLASH_COMPLETE == status); ++key)
+    {
+        index[key] = 0;
+        const kv_record_t *precord = kv_live_record(pkv, key, pnew);
+        if (NULL == precord)
+        {
+            continue;
+        }
+
+        status = flash_standalone_program(target + offset, (const uint8_t *)precord,
+                                          KV_RECORD_SIZE(precord->len));
+        index[key] = offset;
+        offset += KV_RECORD_SIZE(precord->len);
+    }
+
+    if (FLASH_COMPLETE == status)
+    {
+        status = kv_page_activate(pkv, target, pkv->generation + 1);
+    }
+
+    if (FLASH_COMPLETE == status)
+    {
+        memcpy(pkv->index, index, sizeof(index));
+        pkv->free = offset;
+    }
+
+    return status;
+}
+
+FLASH_Status kv_write(kv_store_t *pkv, uint16_t key, const void *pdata, uint16_t len)
+{
+    if ((key >= KV_MAX_KEYS) || (len > KV_VALUE_MAX))
+    {
+        return FLASH_ERROR_PG;
+    }
+
+    if (0 == pkv->index[key])
+    {
+        if (0 == len)
+        {
+            return FLASH_COMPLETE;
+        }
+    }
+    else
+    {
+        const kv_record_t *precord = kv_record(pkv, pkv->index[key]);
+        if ((len == precord->len) && (0 == memcmp(precord + 1, pdata, len)))
+        {
+            return FLASH_COMPLETE;
+        }
+    }
+
+    uint32_t record[(sizeof(kv_record_t) + KV_VALUE_MAX) / 4];
+    kv_record_t *precord = (kv_record_t *)record;
+    precord->key = key;
+    precord->len = len;
+    memset(precord + 1, 0xff, KV_RECORD_SIZE(len) - sizeof(kv_record_t));
+    memcpy(precord + 1, pdata, len);
+    precord->crc = kv_record_crc(precord);
+
+    if (pkv->free + KV_RECORD_SIZE(len) > KV_PAGE_SIZE)
+    {
+        /* live values fill a whole page, compacting would only cost an erase */
+        if (kv_live_size(pkv, precord) > KV_PAGE_SIZE)
+        {
+            return FLASH_ERROR_PG;
+        }
+        return kv_compact(pkv, precord);
+    }
+
+    FLASH_Status status = flash_standalone_program(pkv->page + pkv->free, (const uint8_t *)record,
+                                                   KV_RECORD_SIZE(len));
+    if (FLASH_COMPLETE == status)
+    {
+        pkv->index[key] = (0 == len) ? 0 : pkv->free;
+        pkv->free += KV_RECORD_SIZE(len);
+    }
+    else
+    {
+        /* whatever landed is garbage, the next write compacts */
+        pkv->free = KV_PAGE_SIZE;
+    }
+
+    return status;
+}
+#endif
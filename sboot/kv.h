@@ -0,0 +1,65 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _KV_H_
+#define _KV_H_
+
+#include "types.h"
+#include "stm32f10x_flash.h"
+
+BEGIN_DECLS
+
+/**
+ * log-structured settings in the two KV_STORE_ADDR pages. Writes append a
+ * record to the active page, a full page is compacted into the other one,
+ * which is the only time a page is erased. The page header is programmed
+ * last, so a reset during compaction keeps the old page active, and a torn
+ * record fails its crc and is ignored.
+ *
+ * All state is in kv_store_t, the caller owns it, so the app can use the
+ * store through the service table as well.
+ *
+ * Live records share one 2 KB page: 8 bytes of header, then 8 bytes plus
+ * the padded value per key. With __ENABLE_FLASH_TELEMETRY the sboot keys
+ * take 608 bytes, or 1184 bytes on XL parts, leaving the app about 1.4 KB
+ * or 850 bytes. A write that does not fit fails with FLASH_ERROR_PG and
+ * erases nothing.
+ */
+#define KV_MAX_KEYS                 64
+#define KV_VALUE_MAX                64
+/* keys below belong to sboot, see telemetry.h */
+#define KV_KEY_APP_FIRST            32
+
+typedef struct
+{
+    uint32_t page;
+    uint32_t generation;
+    uint32_t free;
+    /* page offset of the latest record of each key, 0 if there is none */
+    uint16_t index[KV_MAX_KEYS];
+} kv_store_t;
+
+/**
+ * @brief find the active page and index its records, a blank store is
+ *        formatted
+ */
+FLASH_Status kv_mount(kv_store_t *pkv);
+
+/**
+ * @param[in] key: 0 to KV_MAX_KEYS - 1
+ * @return value length copied to pbuf, 0 if the key has no value
+ */
+uint16_t kv_read(const kv_store_t *pkv, uint16_t key, void *pbuf, uint16_t size);
+
+/**
+ * @brief len 0 deletes the key, an unchanged value is not written again
+ */
+FLASH_Status kv_write(kv_store_t *pkv, uint16_t key, const void *pdata, uint16_t len);
+
+END_DECLS
+
+#endif /* _KV_H_ */
@@ -0,0 +1,33 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "mailbox.h"
+#include "bkp.h"
+#include "stm32f10x.h"
+#define __TRACE_MODULE  "[mailbox]"
+#include "trace.h"
+
+uint16_t mailbox_take(void)
+{
+    uint16_t command = bkp_read(BKP_MAILBOX_CMD);
+    if (SBOOT_CMD_NONE == command)
+    {
+        return SBOOT_CMD_NONE;
+    }
+
+    /* random backup domain content after a tamper or first power up is no command */
+    uint16_t key = bkp_read(BKP_MAILBOX_KEY);
+    bkp_write(BKP_MAILBOX_CMD, SBOOT_CMD_NONE);
+    bkp_write(BKP_MAILBOX_KEY, 0);
+    if ((uint16_t)~command != key)
+    {
+        return SBOOT_CMD_NONE;
+    }
+
+    TRACE("app command %d", command);
+    return command;
+}
@@ -0,0 +1,36 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * request channel from the app, no flash write involved. the app writes the
+ * command to BKP_MAILBOX_CMD, its complement to BKP_MAILBOX_KEY and resets.
+ * sboot clears the mailbox when it takes a command, so it runs only once.
+ */
+#define SBOOT_CMD_NONE              0x0000
+/* stay in the receiver for CAN_IDLE_TIMEOUT_MS instead of CAN_LISTEN_MS */
+#define SBOOT_CMD_RECEIVE           0x0001
+/* program the staged image, also when it has been applied already */
+#define SBOOT_CMD_APPLY             0x0002
+/* jump to the app at once, no receivers, upgrade or app checks */
+#define SBOOT_CMD_FAST              0x0003
+
+/**
+ * @brief fetch and clear the pending command
+ * @return command, SBOOT_CMD_NONE if there is none or the key is wrong
+ */
+uint16_t mailbox_take(void);
+
+END_DECLS
+
+#endif /* _MAILBOX_H_ */
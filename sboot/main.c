@@ -8,7 +8,25 @@
 #include "stm32f10x.h"
 #include "dbg.h"
 #include "sboot.h"
+#include "clock.h"
+#include "delay.h"
+#include "mailbox.h"
 #include "upgrade_flash.h"
+#include "watermark.h"
+#define __TRACE_MODULE  "[main]"
+#include "trace.h"
+#ifdef __ENABLE_CAN_UPGRADE
+#include "upgrade_can.h"
+#endif
+#ifdef __ENABLE_SDCARD_UPGRADE
+#include "upgrade_sdcard.h"
+#endif
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#include "keys.h"
+#endif
+
+/* cycles from reset to main, on hsi */
+static uint32_t startup_cycles;
 
 /**
  * @brief config board hardware
@@ -18,28 +36,134 @@ static void board_cfg(void)
     NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
     /* Configure HCLK clock as SysTick clock source. */
     SysTick_CLKSourceConfig(SysTick_CLKSource_HCLK);
+    /* time base for delays and timeouts */
+    delay_init();
+}
+
+/**
+ * @brief boot time of this clock policy ends here
+ */
+static void app_start(void)
+{
+    TRACE("reset to app: %d us", startup_cycles / (HSI_VALUE / 1000000) + clock_elapsed_us());
+    sboot_run_app();
+}
+
+/**
+ * @brief full speed for upgrade work, uart baudrate follows the new clock
+ */
+static void upgrade_clock(void)
+{
+    uint16_t prev = clock_state();
+    if (prev != clock_boost())
+    {
+        dbg_init();
+    }
 }
 
 int main(int argc, char **argv)
 {
+    /* Reset_Handler starts the cycle counter, board_cfg restarts it */
+    startup_cycles = delay_cycles();
+    WATERMARK_INIT();
     board_cfg();
+#ifdef __ENABLE_EAGER_CLOCK
+    /* previous policy, pll up before anything else */
+    clock_boost();
+#endif
     dbg_init();
+    TRACE("reset to main: %d cycles", startup_cycles);
+
+#ifdef __ENABLE_APP_VERIFY
+    /* the verdict survives on vbat, flash may have been changed with power off */
+    if (RESET != RCC_GetFlagStatus(RCC_FLAG_PORRST))
+    {
+        flash_app_verdict_invalidate();
+    }
+    RCC_ClearFlag();
+#endif
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+    /* lock the part before the image key is ever used */
+    keys_protect();
+#endif
+
+    /* app request through backup registers, before any other work */
+    uint16_t command = mailbox_take();
+    if (SBOOT_CMD_FAST == command)
+    {
+        app_start();
+    }
+
+#ifdef __ENABLE_CAN_UPGRADE
+    /* fleet upgrade over can bus, listen at the reset clock */
+    if (can_upgrade_detect((SBOOT_CMD_RECEIVE == command) ? CAN_IDLE_TIMEOUT_MS : CAN_LISTEN_MS))
+    {
+        upgrade_clock();
+        if (can_upgrade_run())
+        {
+            WATERMARK("can");
+            sboot_reboot();
+        }
+    }
+    WATERMARK("can");
+#endif
+
+#ifdef __ENABLE_SDCARD_UPGRADE
+    /* field service image on sd card, probed at the reset clock */
+    if (sdcard_probe())
+    {
+        upgrade_clock();
+        if (sdcard_upgrade())
+        {
+            WATERMARK("sdcard");
+            sboot_reboot();
+        }
+    }
+    WATERMARK("sdcard");
+#endif
 
     /* check image */
-    if (flash_image_check())
+    bool staged = flash_image_check();
+    WATERMARK("check");
+    if (staged || (SBOOT_CMD_APPLY == command))
     {
-        if (flash_image_upgrade())
+        upgrade_clock();
+        bool upgraded = flash_image_upgrade();
+        WATERMARK("upgrade");
+        if (upgraded)
         {
             sboot_reboot();
         }
         else
         {
-            sboot_run_app();
+            app_start();
         }
     }
     else
     {
-        sboot_run_app();
+#ifdef __ENABLE_APP_SCRUB
+        /* a page or two per boot, corrupted pages come back from staging */
+        flash_app_scrub();
+#endif
+#ifdef __ENABLE_APP_VERIFY
+        /* program the applied image again if the app no longer matches it */
+        bool verified = flash_app_verify();
+        WATERMARK("verify");
+        if (!verified)
+        {
+            upgrade_clock();
+            if (flash_image_upgrade())
+            {
+                WATERMARK("upgrade");
+                sboot_reboot();
+            }
+        }
+#endif
+#ifdef __ENABLE_STAGING_PREERASE
+        /* the next download finds staging blank */
+        flash_staging_preerase();
+#endif
+        app_start();
     }
 
     return 0;
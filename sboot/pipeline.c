@@ -0,0 +1,129 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "pipeline.h"
+#include "stm32f10x.h"
+#include "delay.h"
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#include "decrypt.h"
+#endif
+#define __TRACE_MODULE  "[pipeline]"
+#include "trace.h"
+
+/* filters in chain order, NULL terminated */
+static pipe_stage_t *const pipe_filters[] =
+{
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+    &decrypt_stage,
+#endif
+    NULL,
+};
+
+/* the terminator stands for the sink */
+typedef char pipe_stages_fit[(N_ELEMENTS(pipe_filters) <= PIPE_MAX_STAGES) ? 1 : -1];
+
+/* static buffers of every stage this build links in */
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#define PIPE_BUFFERS_SIZE           (PIPE_SINK_BUFFER_SIZE + DECRYPT_BUFFER_SIZE)
+#else
+#define PIPE_BUFFERS_SIZE           PIPE_SINK_BUFFER_SIZE
+#endif
+typedef char pipe_memory_fits[(PIPE_BUFFERS_SIZE <= PIPE_MEMORY_SIZE) ? 1 : -1];
+
+pipe_stage_t *pipe_build(uint32_t flags, pipe_stage_t *psink)
+{
+    pipe_stage_t *phead = psink;
+    pipe_stage_t **plink = &phead;
+    uint32_t unhandled = flags & FLASH_FLAG_TRANSFORMS;
+    for (uint8_t i = 0; NULL != pipe_filters[i]; ++i)
+    {
+        pipe_stage_t *pstage = pipe_filters[i];
+        if (0 != (flags & pstage->flags))
+        {
+            *plink = pstage;
+            plink = &pstage->pnext;
+            unhandled &= ~pstage->flags;
+        }
+    }
+    *plink = psink;
+    psink->pnext = NULL;
+
+    /* never program data a stage of this build should have transformed */
+    if (0 != unhandled)
+    {
+        TRACE("image flags 0x%08x not supported", unhandled);
+        return NULL;
+    }
+
+    return phead;
+}
+
+bool pipe_open(pipe_stage_t *phead, const flash_image_header_t *pheader)
+{
+    for (pipe_stage_t *pstage = phead; NULL != pstage; pstage = pstage->pnext)
+    {
+        pstage->cycles = 0;
+        if ((NULL != pstage->open) && !pstage->open(pstage, pheader))
+        {
+            TRACE("open stage %s failed", pstage->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pipe_write(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len)
+{
+    uint32_t start = delay_cycles();
+    bool ret = pstage->write(pstage, pdata, len);
+    pstage->cycles += delay_cycles() - start;
+    return ret;
+}
+
+bool pipe_push(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len)
+{
+    uint32_t start = delay_cycles();
+    bool ret = pipe_write(pstage->pnext, pdata, len);
+    /* booked on the next stage already */
+    pstage->cycles -= delay_cycles() - start;
+    return ret;
+}
+
+bool pipe_close(pipe_stage_t *phead)
+{
+    for (pipe_stage_t *pstage = phead; NULL != pstage; pstage = pstage->pnext)
+    {
+        if (NULL == pstage->close)
+        {
+            continue;
+        }
+
+        uint32_t start = delay_cycles();
+        bool ret = pstage->close(pstage);
+        pstage->cycles += delay_cycles() - start;
+        if (!ret)
+        {
+            TRACE("close stage %s failed", pstage->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void pipe_report(const pipe_stage_t *phead, uint32_t total)
+{
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    UNUSED(cycles_per_us);
+    for (const pipe_stage_t *pstage = phead; NULL != pstage; pstage = pstage->pnext)
+    {
+        TRACE("%s: %d us", pstage->name, pstage->cycles / cycles_per_us);
+        total -= pstage->cycles;
+    }
+    TRACE("source: %d us", total / cycles_per_us);
+}
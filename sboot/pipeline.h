@@ -0,0 +1,84 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "types.h"
+#include "upgrade_flash.h"
+
+BEGIN_DECLS
+
+/**
+ * streaming upgrade pipeline: the source pushes staged image chunks into a
+ * chain of filter stages selected by the image header flags, the last stage
+ * is the sink that programs the app. Stages pass data on with pipe_push,
+ * in place or from a buffer of their own. A stage owns at most one static
+ * PIPE_CHUNK_SIZE buffer, so the whole pipeline never needs more than
+ * PIPE_MEMORY_SIZE of ram, next to the 1KB stack of startup_stm32f10x.s.
+ */
+#define PIPE_CHUNK_SIZE             FLASH_BLOCK_SIZE
+#define PIPE_MAX_STAGES             4
+#define PIPE_MEMORY_SIZE            (PIPE_MAX_STAGES * PIPE_CHUNK_SIZE)
+/* block gathered by the sink in upgrade_flash.c */
+#define PIPE_SINK_BUFFER_SIZE       FLASH_BLOCK_SIZE
+
+typedef struct pipe_stage pipe_stage_t;
+struct pipe_stage
+{
+    const char *name;
+    /* header flags selecting this filter, unused for the sink */
+    uint32_t flags;
+    /* optional */
+    bool (*open)(pipe_stage_t *pstage, const flash_image_header_t *pheader);
+    bool (*write)(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len);
+    /* optional, flush buffered data */
+    bool (*close)(pipe_stage_t *pstage);
+    pipe_stage_t *pnext;
+    /* cycles spent in this stage, downstream stages not included */
+    uint32_t cycles;
+};
+
+/**
+ * sink that programs the app block by block, in upgrade_flash.c. every
+ * upgrade source feeds it through pipe_build, so all of them get the same
+ * filters
+ */
+extern pipe_stage_t sink_stage;
+
+/**
+ * @brief chain the filters the header flags ask for in front of the sink
+ * @return first stage, NULL if this build lacks a stage the flags ask for
+ */
+pipe_stage_t *pipe_build(uint32_t flags, pipe_stage_t *psink);
+
+bool pipe_open(pipe_stage_t *phead, const flash_image_header_t *pheader);
+
+/**
+ * @brief feed a stage, the source calls it on the first stage
+ */
+bool pipe_write(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len);
+
+/**
+ * @brief pass stage output on to the next stage
+ */
+bool pipe_push(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len);
+
+/**
+ * @brief close every stage in chain order, so flushed data reaches the sink
+ */
+bool pipe_close(pipe_stage_t *phead);
+
+/**
+ * @brief trace where the time went
+ * @param[in] total: cycles of the whole run, the rest is booked on the source
+ */
+void pipe_report(const pipe_stage_t *phead, uint32_t total);
+
+END_DECLS
+
+#endif /* _PIPELINE_H_ */
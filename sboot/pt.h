@@ -0,0 +1,49 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _PT_H_
+#define _PT_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * stackless protothreads: a thread is a function that resumes at the line
+ * it left through a switch on the saved line number. Locals do not survive
+ * a wait, keep them static, and do not wait inside a switch statement.
+ */
+typedef struct
+{
+    uint16_t lc;
+} pt_t;
+
+#define PT_WAITING                  0
+#define PT_YIELDED                  1
+#define PT_EXITED                   2
+#define PT_ENDED                    3
+
+#define PT_THREAD(name_args)        char name_args
+
+#define PT_INIT(pt)                 ((pt)->lc = 0)
+
+#define PT_BEGIN(pt)                { char pt_yield_flag = 1; UNUSED(pt_yield_flag); \
+                                      switch ((pt)->lc) { case 0:
+
+#define PT_END(pt)                  } pt_yield_flag = 0; PT_INIT(pt); return PT_ENDED; }
+
+#define PT_WAIT_UNTIL(pt, cond)     do { (pt)->lc = __LINE__; case __LINE__: \
+                                         if (!(cond)) { return PT_WAITING; } } while (0)
+
+#define PT_YIELD(pt)                do { pt_yield_flag = 0; (pt)->lc = __LINE__; case __LINE__: \
+                                         if (0 == pt_yield_flag) { return PT_YIELDED; } } while (0)
+
+#define PT_EXIT(pt)                 do { PT_INIT(pt); return PT_EXITED; } while (0)
+
+END_DECLS
+
+#endif /* _PT_H_ */
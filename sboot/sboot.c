@@ -12,12 +12,22 @@
 #include "stm32f10x.h"
 #include "stm32f10x_flash.h"
 #include "crc32.h"
+#include "clock.h"
+#ifdef __ENABLE_FLASH_TELEMETRY
+#include "telemetry.h"
+#endif
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#include "decrypt.h"
+#endif
 
 typedef void (*app_entry_t)(void);
 
 void sboot_reboot(void)
 {
     TRACE("rebooting...");
+#ifdef __ENABLE_FLASH_TELEMETRY
+    telemetry_save();
+#endif
     __set_FAULTMASK(1);
     NVIC_SystemReset();
 }
@@ -25,10 +35,18 @@ void sboot_reboot(void)
 void sboot_run_app(void)
 {
     TRACE("run app...");
+#ifdef __ENABLE_FLASH_TELEMETRY
+    telemetry_save();
+#endif
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+    /* the app owns sboot ram from here on */
+    decrypt_wipe();
+#endif
 
     /* Check if valid stack address (RAM address) then jump to user application */
     if (((*(__IO uint32_t *)APP_IMAGE_ADDR) & 0x2FFE0000) == 0x20000000)
     {
+        clock_report();
         /* disable irq */
         __disable_irq();
         /* get user application */
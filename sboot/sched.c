@@ -0,0 +1,138 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "sched.h"
+#include "stm32f10x.h"
+#include "delay.h"
+#define __TRACE_MODULE  "[sched]"
+#include "trace.h"
+
+/* can upgrade is the only task set, not in the minimal build */
+#ifndef __ENABLE_MINIMAL_BUILD
+
+static sched_task_t *sched_tasks;
+static uint8_t sched_count;
+static sched_task_t *sched_current;
+/* task work done while another task waited on a device */
+static uint32_t sched_overlap;
+
+static void sched_step(sched_task_t *ptask)
+{
+    sched_task_t *pouter = sched_current;
+    sched_current = ptask;
+    ptask->running = true;
+    uint32_t start = delay_cycles();
+    char ret = ptask->run(&ptask->pt);
+    uint32_t elapsed = delay_cycles() - start;
+    ptask->running = false;
+    sched_current = pouter;
+
+    ptask->cycles += elapsed;
+    if (NULL != pouter)
+    {
+        /* the outer task was only waiting */
+        pouter->cycles -= elapsed;
+        sched_overlap += elapsed;
+    }
+
+    if (ret >= PT_EXITED)
+    {
+        ptask->done = true;
+    }
+}
+
+void sched_run(sched_task_t *ptasks, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        PT_INIT(&ptasks[i].pt);
+        ptasks[i].running = false;
+        ptasks[i].done = false;
+        ptasks[i].cycles = 0;
+    }
+    sched_tasks = ptasks;
+    sched_count = count;
+    sched_current = NULL;
+    sched_overlap = 0;
+
+    uint32_t start = delay_cycles();
+    bool pending;
+    do
+    {
+        pending = false;
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            if (!ptasks[i].done)
+            {
+                sched_step(&ptasks[i]);
+                pending = pending || !ptasks[i].done;
+            }
+        }
+    } while (pending);
+    uint32_t wall = delay_cycles() - start;
+    sched_tasks = NULL;
+
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        TRACE("%s: %d us", ptasks[i].name, ptasks[i].cycles / cycles_per_us);
+    }
+    TRACE("wall %d us, %d us overlapped with device waits", wall / cycles_per_us,
+          sched_overlap / cycles_per_us);
+    UNUSED(wall);
+    UNUSED(cycles_per_us);
+}
+
+void sched_idle(void)
+{
+    if (NULL == sched_tasks)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < sched_count; ++i)
+    {
+        if (!sched_tasks[i].done && !sched_tasks[i].running)
+        {
+            sched_step(&sched_tasks[i]);
+        }
+    }
+}
+
+void sched_queue_init(sched_queue_t *pqueue, uint8_t *pitems, uint8_t size)
+{
+    pqueue->pitems = pitems;
+    pqueue->size = size;
+    pqueue->head = 0;
+    pqueue->count = 0;
+}
+
+bool sched_queue_push(sched_queue_t *pqueue, uint8_t item)
+{
+    if (pqueue->count >= pqueue->size)
+    {
+        return false;
+    }
+
+    pqueue->pitems[(pqueue->head + pqueue->count) % pqueue->size] = item;
+    pqueue->count ++;
+    return true;
+}
+
+bool sched_queue_pop(sched_queue_t *pqueue, uint8_t *pitem)
+{
+    if (0 == pqueue->count)
+    {
+        return false;
+    }
+
+    *pitem = pqueue->pitems[pqueue->head];
+    pqueue->head = (pqueue->head + 1) % pqueue->size;
+    pqueue->count --;
+    return true;
+}
+#endif
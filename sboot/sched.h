@@ -0,0 +1,66 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "types.h"
+#include "pt.h"
+
+BEGIN_DECLS
+
+/**
+ * cooperative round robin scheduler for protothreads. A task that waits on
+ * a device runs the other tasks through sched_idle, so blocking drivers
+ * become overlap points without being rewritten as threads.
+ */
+typedef struct
+{
+    const char *name;
+    PT_THREAD((*run)(pt_t *pt));
+    pt_t pt;
+    /* on the call stack, not stepped again until it returns */
+    bool running;
+    bool done;
+    /* cycles in this task, nested tasks not included */
+    uint32_t cycles;
+} sched_task_t;
+
+/**
+ * bounded fifo of small indices, e.g. buffers handed from task to task
+ */
+typedef struct
+{
+    uint8_t *pitems;
+    uint8_t size;
+    uint8_t head;
+    uint8_t count;
+} sched_queue_t;
+
+/**
+ * @brief run tasks until every one of them exited, then trace where the
+ *        time went and how much task work ran inside device waits
+ */
+void sched_run(sched_task_t *ptasks, uint8_t count);
+
+/**
+ * @brief step every task that is not on the call stack, busy waits call it,
+ *        does nothing outside sched_run
+ */
+#ifdef __ENABLE_MINIMAL_BUILD
+#define sched_idle()
+#else
+void sched_idle(void);
+#endif
+
+void sched_queue_init(sched_queue_t *pqueue, uint8_t *pitems, uint8_t size);
+bool sched_queue_push(sched_queue_t *pqueue, uint8_t item);
+bool sched_queue_pop(sched_queue_t *pqueue, uint8_t *pitem);
+
+END_DECLS
+
+#endif /* _SCHED_H_ */
@@ -0,0 +1,269 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "sdcard.h"
+#include "stm32f10x.h"
+#define __TRACE_MODULE  "[sdcard]"
+#include "trace.h"
+
+#define SD_CMD_GO_IDLE_STATE        0
+#define SD_CMD_ALL_SEND_CID         2
+#define SD_CMD_SEND_REL_ADDR        3
+#define SD_CMD_APP_SET_BUS_WIDTH    6
+#define SD_CMD_SELECT_CARD          7
+#define SD_CMD_SEND_IF_COND         8
+#define SD_CMD_STOP_TRANSMISSION    12
+#define SD_CMD_SET_BLOCKLEN         16
+#define SD_CMD_READ_MULT_BLOCK      18
+#define SD_CMD_APP_SEND_OP_COND     41
+#define SD_CMD_APP_CMD              55
+
+#define SD_CHECK_PATTERN            0x000001aa
+#define SD_OCR_VOLTAGE              0x00100000
+#define SD_OCR_HIGH_CAPACITY        0x40000000
+#define SD_OCR_POWER_UP             0x80000000
+#define SD_OP_COND_RETRY            0x4000
+
+/* SDIO_CK = HCLK / (div + 2), 24MHz at 72MHz and 4MHz on the 8MHz hsi */
+#define SD_INIT_CLK_HZ              400000
+#define SD_TRANSFER_CLK_HZ          24000000
+/* about 100ms at 24MHz, 600ms at 4MHz */
+#define SD_DATA_TIMEOUT             2400000
+
+#define SD_STATIC_FLAGS             0x000005ff
+#define SD_DATA_ERROR_FLAGS         (SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | \
+                                     SDIO_FLAG_RXOVERR | SDIO_FLAG_STBITERR)
+
+static bool high_capacity;
+static bool ready;
+static uint32_t read_count;
+
+static uint8_t sd_clk_div(uint32_t hz)
+{
+    uint32_t div = (SystemCoreClock + hz - 1) / hz;
+    return (div > 2) ? (uint8_t)(div - 2) : 0;
+}
+
+static bool sd_command(uint8_t index, uint32_t arg, uint32_t response)
+{
+    SDIO_CmdInitTypeDef SDIO_CmdInitStructure;
+    uint32_t status;
+
+    SDIO_CmdInitStructure.SDIO_Argument = arg;
+    SDIO_CmdInitStructure.SDIO_CmdIndex = index;
+    SDIO_CmdInitStructure.SDIO_Response = response;
+    SDIO_CmdInitStructure.SDIO_Wait = SDIO_Wait_No;
+    SDIO_CmdInitStructure.SDIO_CPSM = SDIO_CPSM_Enable;
+    SDIO_SendCommand(&SDIO_CmdInitStructure);
+
+    /* hardware times out after 64 SDIO_CK without response */
+    if (SDIO_Response_No == response)
+    {
+        while (RESET == SDIO_GetFlagStatus(SDIO_FLAG_CMDSENT));
+        SDIO_ClearFlag(SD_STATIC_FLAGS);
+        return true;
+    }
+
+    do
+    {
+        status = SDIO->STA;
+    } while (0 == (status & (SDIO_FLAG_CMDREND | SDIO_FLAG_CCRCFAIL | SDIO_FLAG_CTIMEOUT)));
+    SDIO_ClearFlag(SD_STATIC_FLAGS);
+
+    if (0 != (status & SDIO_FLAG_CTIMEOUT))
+    {
+        return false;
+    }
+
+    /* R3 carries no crc */
+    if (0 != (status & SDIO_FLAG_CCRCFAIL))
+    {
+        return (SD_CMD_APP_SEND_OP_COND == index);
+    }
+
+    return true;
+}
+
+static void sd_bus_config(uint32_t bus_wide, uint8_t clk_div)
+{
+    SDIO_InitTypeDef SDIO_InitStructure;
+    SDIO_InitStructure.SDIO_ClockEdge = SDIO_ClockEdge_Rising;
+    SDIO_InitStructure.SDIO_ClockBypass = SDIO_ClockBypass_Disable;
+    SDIO_InitStructure.SDIO_ClockPowerSave = SDIO_ClockPowerSave_Disable;
+    SDIO_InitStructure.SDIO_BusWide = bus_wide;
+    SDIO_InitStructure.SDIO_HardwareFlowControl = SDIO_HardwareFlowControl_Disable;
+    SDIO_InitStructure.SDIO_ClockDiv = clk_div;
+    SDIO_Init(&SDIO_InitStructure);
+}
+
+bool sdcard_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStructure;
+    uint32_t rca;
+    uint32_t ocr = 0;
+    bool v2_card;
+
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_SDIO | RCC_AHBPeriph_DMA2, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOC | RCC_APB2Periph_GPIOD, ENABLE);
+
+    /* config pin: D0-D3 PC8-PC11, CK PC12, CMD PD2 */
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_8 | GPIO_Pin_9 | GPIO_Pin_10 | GPIO_Pin_11 | GPIO_Pin_12;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+    GPIO_Init(GPIOC, &GPIO_InitStructure);
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_2;
+    GPIO_Init(GPIOD, &GPIO_InitStructure);
+
+    ready = false;
+    SDIO_DeInit();
+    sd_bus_config(SDIO_BusWide_1b, sd_clk_div(SD_INIT_CLK_HZ));
+    SDIO_SetPowerState(SDIO_PowerState_ON);
+    SDIO_ClockCmd(ENABLE);
+
+    sd_command(SD_CMD_GO_IDLE_STATE, 0, SDIO_Response_No);
+    v2_card = sd_command(SD_CMD_SEND_IF_COND, SD_CHECK_PATTERN, SDIO_Response_Short) &&
+              ((SDIO_GetResponse(SDIO_RESP1) & 0xfff) == SD_CHECK_PATTERN);
+
+    for (uint32_t i = 0; i < SD_OP_COND_RETRY; ++i)
+    {
+        if (!sd_command(SD_CMD_APP_CMD, 0, SDIO_Response_Short) ||
+            !sd_command(SD_CMD_APP_SEND_OP_COND,
+                        SD_OCR_POWER_UP | SD_OCR_VOLTAGE | (v2_card ? SD_OCR_HIGH_CAPACITY : 0),
+                        SDIO_Response_Short))
+        {
+            TRACE("no sd card");
+            return false;
+        }
+
+        ocr = SDIO_GetResponse(SDIO_RESP1);
+        if (0 != (ocr & SD_OCR_POWER_UP))
+        {
+            break;
+        }
+    }
+
+    if (0 == (ocr & SD_OCR_POWER_UP))
+    {
+        TRACE("sd card not ready");
+        return false;
+    }
+    high_capacity = (0 != (ocr & SD_OCR_HIGH_CAPACITY));
+
+    if (!sd_command(SD_CMD_ALL_SEND_CID, 0, SDIO_Response_Long) ||
+        !sd_command(SD_CMD_SEND_REL_ADDR, 0, SDIO_Response_Short))
+    {
+        return false;
+    }
+    rca = SDIO_GetResponse(SDIO_RESP1) & 0xffff0000;
+
+    if (!sd_command(SD_CMD_SELECT_CARD, rca, SDIO_Response_Short) ||
+        !sd_command(SD_CMD_SET_BLOCKLEN, SDCARD_SECTOR_SIZE, SDIO_Response_Short) ||
+        !sd_command(SD_CMD_APP_CMD, rca, SDIO_Response_Short) ||
+        !sd_command(SD_CMD_APP_SET_BUS_WIDTH, 2, SDIO_Response_Short))
+    {
+        TRACE("sd card select failed");
+        return false;
+    }
+
+    sd_bus_config(SDIO_BusWide_4b, sd_clk_div(SD_TRANSFER_CLK_HZ));
+    ready = true;
+    TRACE("sd card ready, %s", high_capacity ? "sdhc" : "sdsc");
+    return true;
+}
+
+void sdcard_clock_update(void)
+{
+    if (ready)
+    {
+        sd_bus_config(SDIO_BusWide_4b, sd_clk_div(SD_TRANSFER_CLK_HZ));
+    }
+}
+
+bool sdcard_read_start(uint32_t sector, uint8_t *pbuf, uint32_t count)
+{
+    SDIO_DataInitTypeDef SDIO_DataInitStructure;
+    DMA_InitTypeDef DMA_InitStructure;
+
+    SDIO->DCTRL = 0;
+    SDIO_ClearFlag(SD_STATIC_FLAGS);
+
+    DMA_DeInit(DMA2_Channel4);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&SDIO->FIFO;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)pbuf;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = count * SDCARD_SECTOR_SIZE / 4;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA2_Channel4, &DMA_InitStructure);
+    DMA_Cmd(DMA2_Channel4, ENABLE);
+    SDIO_DMACmd(ENABLE);
+
+    SDIO_DataInitStructure.SDIO_DataTimeOut = SD_DATA_TIMEOUT;
+    SDIO_DataInitStructure.SDIO_DataLength = count * SDCARD_SECTOR_SIZE;
+    SDIO_DataInitStructure.SDIO_DataBlockSize = SDIO_DataBlockSize_512b;
+    SDIO_DataInitStructure.SDIO_TransferDir = SDIO_TransferDir_ToSDIO;
+    SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+    SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+    SDIO_DataConfig(&SDIO_DataInitStructure);
+
+    read_count = count;
+    if (!sd_command(SD_CMD_READ_MULT_BLOCK,
+                    high_capacity ? sector : sector * SDCARD_SECTOR_SIZE,
+                    SDIO_Response_Short))
+    {
+        TRACE("read sector %d failed", sector);
+        read_count = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool sdcard_read_wait(void)
+{
+    uint32_t status;
+    bool ret;
+
+    if (0 == read_count)
+    {
+        return false;
+    }
+
+    do
+    {
+        status = SDIO->STA;
+    } while (0 == (status & (SDIO_FLAG_DATAEND | SD_DATA_ERROR_FLAGS)));
+    ret = (0 == (status & SD_DATA_ERROR_FLAGS));
+
+    if (ret)
+    {
+        /* last words may still be in flight from the fifo */
+        while (RESET == DMA_GetFlagStatus(DMA2_FLAG_TC4));
+    }
+    DMA_Cmd(DMA2_Channel4, DISABLE);
+    SDIO_DMACmd(DISABLE);
+    SDIO_ClearFlag(SD_STATIC_FLAGS);
+
+    sd_command(SD_CMD_STOP_TRANSMISSION, 0, SDIO_Response_Short);
+    read_count = 0;
+    if (!ret)
+    {
+        TRACE("read failed: 0x%08x", status);
+    }
+
+    return ret;
+}
+
+bool sdcard_read(uint32_t sector, uint8_t *pbuf, uint32_t count)
+{
+    return sdcard_read_start(sector, pbuf, count) && sdcard_read_wait();
+}
@@ -0,0 +1,45 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _SDCARD_H_
+#define _SDCARD_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+#define SDCARD_SECTOR_SIZE          512
+
+/**
+ * @brief init sd card on SDIO (PC8-PC11 data, PC12 CK, PD2 CMD), 4 bit bus
+ * @return true if a card is ready for reading
+ */
+bool sdcard_init(void);
+
+/**
+ * @brief card clock follows HCLK, call after a clock switch with no read in
+ *        flight
+ */
+void sdcard_clock_update(void);
+
+/**
+ * @brief start a multi-block dma read, finish with sdcard_read_wait
+ * @param[in] sector: first sector
+ * @param[out] pbuf: word aligned buffer
+ * @param[in] count: sector count
+ */
+bool sdcard_read_start(uint32_t sector, uint8_t *pbuf, uint32_t count);
+bool sdcard_read_wait(void);
+
+/**
+ * @brief read sectors, blocks until done
+ */
+bool sdcard_read(uint32_t sector, uint8_t *pbuf, uint32_t count);
+
+END_DECLS
+
+#endif /* _SDCARD_H_ */
@@ -0,0 +1,156 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "service.h"
+#include "storage.h"
+#include "upgrade_flash.h"
+#include "crc32.h"
+#include "dbg.h"
+
+/* the 8KB minimal build has no room for it */
+#ifndef __ENABLE_MINIMAL_BUILD
+
+#define SERVICE_PAGE_SIZE           2048
+
+/* nothing references the table, armlink keeps it through --keep */
+#ifdef __CC_ARM
+#define SERVICE_PLACE               __attribute__((at(SBOOT_SERVICE_ADDR), used))
+#else
+#define SERVICE_PLACE               __attribute__((section(".sboot_service"), used))
+#endif
+
+/**
+ * @brief address range lies in flash the app may change
+ */
+static bool service_range_valid(uint32_t address, uint32_t len)
+{
+    return (address >= APP_IMAGE_ADDR) && (len <= APP_IMAGE_SIZE) &&
+           (address - APP_IMAGE_ADDR <= APP_IMAGE_SIZE - len);
+}
+
+static FLASH_Status service_page_erase(uint32_t address)
+{
+    if (!service_range_valid(address, SERVICE_PAGE_SIZE))
+    {
+        return FLASH_ERROR_WRP;
+    }
+
+    return flash_standalone_erase(address);
+}
+
+static FLASH_Status service_program(uint32_t address, const uint8_t *pbuf, uint32_t len)
+{
+    if (!service_range_valid(address, len) || (0 != ((address | len) & 0x03)))
+    {
+        return FLASH_ERROR_WRP;
+    }
+
+    return flash_standalone_program(address, pbuf, len);
+}
+
+#if UPGRADE_IMAGE_MAPPED
+static bool service_page_blank(uint32_t address)
+{
+    const uint32_t *pdata = (const uint32_t *)address;
+    for (uint32_t i = 0; i < SERVICE_PAGE_SIZE / 4; ++i)
+    {
+        if (0xffffffff != pdata[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief drop the staged image, its state record goes with the header page
+ */
+static FLASH_Status service_stage_begin(void)
+{
+    return flash_standalone_erase(UPGRADE_IMAGE_HEADER_ADDR);
+}
+
+static FLASH_Status service_stage_write(uint32_t offset, const uint8_t *pbuf, uint32_t len)
+{
+    if ((len > UPGRADE_IMAGE_SIZE) || (offset > UPGRADE_IMAGE_SIZE - len) ||
+        (0 != ((offset | len) & 0x03)))
+    {
+        return FLASH_ERROR_WRP;
+    }
+
+    uint32_t address = UPGRADE_IMAGE_ADDR + offset;
+    FLASH_Status status = FLASH_COMPLETE;
+    for (uint32_t page = (address + SERVICE_PAGE_SIZE - 1) & ~(SERVICE_PAGE_SIZE - 1);
+         (page < address + len) && (FLASH_COMPLETE == status); page += SERVICE_PAGE_SIZE)
+    {
+        if (!service_page_blank(page))
+        {
+            status = flash_standalone_erase(page);
+        }
+    }
+
+    if (FLASH_COMPLETE == status)
+    {
+        status = flash_standalone_program(address, pbuf, len);
+    }
+
+    return status;
+}
+
+static FLASH_Status service_stage_commit(uint32_t image_size, uint32_t checksum, const uint8_t *psignature)
+{
+    if ((0 == image_size) || (image_size > UPGRADE_IMAGE_SIZE) ||
+        (checksum != crc32(0, (const uint8_t *)UPGRADE_IMAGE_ADDR, image_size)))
+    {
+        return FLASH_ERROR_PG;
+    }
+
+    flash_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FLASH_MAGIC;
+    header.checksum = checksum;
+    header.image_size = image_size;
+    header.not_obsolete = 1;
+    if (NULL != psignature)
+    {
+        memcpy(header.signature, psignature, sizeof(header.signature));
+    }
+
+    FLASH_Status status = flash_standalone_erase(UPGRADE_IMAGE_HEADER_ADDR);
+    if (FLASH_COMPLETE == status)
+    {
+        status = flash_standalone_program(UPGRADE_IMAGE_HEADER_ADDR, (const uint8_t *)&header, sizeof(header));
+    }
+
+    return status;
+}
+#else
+/* spi staging needs the driver state in sboot ram */
+#define service_stage_begin         NULL
+#define service_stage_write         NULL
+#define service_stage_commit        NULL
+#endif
+
+const sboot_service_t sboot_service_table SERVICE_PLACE =
+{
+    SBOOT_SERVICE_MAGIC,
+    SBOOT_SERVICE_VERSION,
+    sizeof(sboot_service_t),
+    service_page_erase,
+    service_program,
+    crc32,
+    dbg_write,
+    service_stage_begin,
+    service_stage_write,
+    service_stage_commit,
+    kv_mount,
+    kv_read,
+    kv_write,
+};
+#endif
@@ -0,0 +1,70 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _SERVICE_H_
+#define _SERVICE_H_
+
+#include "types.h"
+#include "stm32f10x_flash.h"
+#include "flash_map.h"
+#include "kv.h"
+
+BEGIN_DECLS
+
+/**
+ * sboot functions for the running app, at a fixed address in the sboot
+ * image. Calls run on the app stack and never touch sboot ram, which the
+ * app owns by then. Members are only ever appended: check size before
+ * using a member added after version 1, a NULL member is not available in
+ * this build.
+ *
+ * page_erase and program only accept app flash, program takes a multiple
+ * of 4 bytes and skips halfwords that already hold the value. Interrupt
+ * handlers running from flash stall while a page of the same bank erases.
+ *
+ * stage_begin, stage_write and stage_commit let the app download an image
+ * into staging without knowing its format, sboot applies it on the next
+ * reset. stage_write erases every staging page it starts, so write the
+ * image in order. stage_commit checks the crc32 of the staged image.
+ *
+ * version 2 adds the key-value store, the app keeps the kv_store_t.
+ */
+#define SBOOT_SERVICE_MAGIC         0x53525643
+#define SBOOT_SERVICE_VERSION       2
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    FLASH_Status (*page_erase)(uint32_t address);
+    FLASH_Status (*program)(uint32_t address, const uint8_t *pbuf, uint32_t len);
+    uint32_t (*crc32)(uint32_t prev_crc, const uint8_t *pbuf, uint32_t len);
+    /* debug uart output, dropped until the uart is enabled */
+    void (*log)(const char *pstr, uint32_t len);
+    FLASH_Status (*stage_begin)(void);
+    FLASH_Status (*stage_write)(uint32_t offset, const uint8_t *pbuf, uint32_t len);
+    /* psignature: 64 bytes for __ENABLE_SIGNED_IMAGE builds, otherwise NULL */
+    FLASH_Status (*stage_commit)(uint32_t image_size, uint32_t checksum, const uint8_t *psignature);
+    FLASH_Status (*kv_mount)(kv_store_t *pkv);
+    uint16_t (*kv_read)(const kv_store_t *pkv, uint16_t key, void *pbuf, uint16_t size);
+    FLASH_Status (*kv_write)(kv_store_t *pkv, uint16_t key, const void *pdata, uint16_t len);
+} sboot_service_t;
+
+/**
+ * @brief service table of the sboot in front of the app
+ * @return NULL if that sboot has none
+ */
+static __INLINE const sboot_service_t *sboot_service(void)
+{
+    const sboot_service_t *pservice = (const sboot_service_t *)SBOOT_SERVICE_ADDR;
+    return (SBOOT_SERVICE_MAGIC == pservice->magic) ? pservice : NULL;
+}
+
+END_DECLS
+
+#endif /* _SERVICE_H_ */
@@ -0,0 +1,173 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "sha256.h"
+#include "stm32f10x.h"
+
+#define ROR(x, n)       (((x) >> (n)) | ((x) << (32 - (n))))
+#define EP0(x)          (ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define EP1(x)          (ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define SIG0(x)         (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define SIG1(x)         (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z)     ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)    (((x) & (y)) | ((z) & ((x) | (y))))
+
+/* message schedule kept in a 16 word ring */
+#define SCHEDULE(i)     (w[(i) & 15] += SIG1(w[((i) - 2) & 15]) + w[((i) - 7) & 15] + SIG0(w[((i) - 15) & 15]))
+
+/* rotating the variable names instead of the values saves 7 moves per round */
+#define ROUND(a, b, c, d, e, f, g, h, k, x)                 \
+    do                                                      \
+    {                                                       \
+        uint32_t t = h + EP1(e) + CH(e, f, g) + (k) + (x);  \
+        d += t;                                             \
+        h = t + EP0(a) + MAJ(a, b, c);                      \
+    } while (0)
+
+#define ROUNDS8(i, X)                                       \
+    ROUND(a, b, c, d, e, f, g, h, k[(i) + 0], X((i) + 0));  \
+    ROUND(h, a, b, c, d, e, f, g, k[(i) + 1], X((i) + 1));  \
+    ROUND(g, h, a, b, c, d, e, f, k[(i) + 2], X((i) + 2));  \
+    ROUND(f, g, h, a, b, c, d, e, k[(i) + 3], X((i) + 3));  \
+    ROUND(e, f, g, h, a, b, c, d, k[(i) + 4], X((i) + 4));  \
+    ROUND(d, e, f, g, h, a, b, c, k[(i) + 5], X((i) + 5));  \
+    ROUND(c, d, e, f, g, h, a, b, k[(i) + 6], X((i) + 6));  \
+    ROUND(b, c, d, e, f, g, h, a, k[(i) + 7], X((i) + 7))
+
+#define LOADED(i)       w[i]
+
+static const uint32_t k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t load_be32(const uint8_t *pdata)
+{
+    uint32_t val;
+    /* cortex-m3 handles the unaligned load, rev swaps in one cycle */
+    memcpy(&val, pdata, sizeof(val));
+    return __REV(val);
+}
+
+static void sha256_transform(uint32_t *pstate, const uint8_t *pdata, uint32_t blocks)
+{
+    uint32_t w[16];
+    while (blocks--)
+    {
+        uint32_t a = pstate[0];
+        uint32_t b = pstate[1];
+        uint32_t c = pstate[2];
+        uint32_t d = pstate[3];
+        uint32_t e = pstate[4];
+        uint32_t f = pstate[5];
+        uint32_t g = pstate[6];
+        uint32_t h = pstate[7];
+
+        for (uint32_t i = 0; i < 16; ++i)
+        {
+            w[i] = load_be32(pdata + i * 4);
+        }
+
+        ROUNDS8(0, LOADED);
+        ROUNDS8(8, LOADED);
+        for (uint32_t i = 16; i < 64; i += 8)
+        {
+            ROUNDS8(i, SCHEDULE);
+        }
+
+        pstate[0] += a;
+        pstate[1] += b;
+        pstate[2] += c;
+        pstate[3] += d;
+        pstate[4] += e;
+        pstate[5] += f;
+        pstate[6] += g;
+        pstate[7] += h;
+        pdata += SHA256_BLOCK_SIZE;
+    }
+}
+
+void sha256_init(sha256_ctx_t *pctx)
+{
+    pctx->state[0] = 0x6a09e667;
+    pctx->state[1] = 0xbb67ae85;
+    pctx->state[2] = 0x3c6ef372;
+    pctx->state[3] = 0xa54ff53a;
+    pctx->state[4] = 0x510e527f;
+    pctx->state[5] = 0x9b05688c;
+    pctx->state[6] = 0x1f83d9ab;
+    pctx->state[7] = 0x5be0cd19;
+    pctx->length = 0;
+}
+
+void sha256_update(sha256_ctx_t *pctx, const uint8_t *pdata, uint32_t len)
+{
+    uint32_t used = pctx->length % SHA256_BLOCK_SIZE;
+    pctx->length += len;
+
+    if (used > 0)
+    {
+        uint32_t fill = MIN(SHA256_BLOCK_SIZE - used, len);
+        memcpy(pctx->buffer + used, pdata, fill);
+        pdata += fill;
+        len -= fill;
+        if (used + fill < SHA256_BLOCK_SIZE)
+        {
+            return;
+        }
+        sha256_transform(pctx->state, pctx->buffer, 1);
+    }
+
+    sha256_transform(pctx->state, pdata, len / SHA256_BLOCK_SIZE);
+    pdata += len & ~(SHA256_BLOCK_SIZE - 1);
+    memcpy(pctx->buffer, pdata, len % SHA256_BLOCK_SIZE);
+}
+
+void sha256_final(sha256_ctx_t *pctx, uint8_t *pdigest)
+{
+    uint32_t used = pctx->length % SHA256_BLOCK_SIZE;
+    uint32_t bits = pctx->length << 3;
+
+    pctx->buffer[used++] = 0x80;
+    if (used > SHA256_BLOCK_SIZE - 8)
+    {
+        memset(pctx->buffer + used, 0, SHA256_BLOCK_SIZE - used);
+        sha256_transform(pctx->state, pctx->buffer, 1);
+        used = 0;
+    }
+    memset(pctx->buffer + used, 0, SHA256_BLOCK_SIZE - used);
+    pctx->buffer[59] = pctx->length >> 29;
+    pctx->buffer[60] = bits >> 24;
+    pctx->buffer[61] = bits >> 16;
+    pctx->buffer[62] = bits >> 8;
+    pctx->buffer[63] = bits;
+    sha256_transform(pctx->state, pctx->buffer, 1);
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        pdigest[i * 4] = pctx->state[i] >> 24;
+        pdigest[i * 4 + 1] = pctx->state[i] >> 16;
+        pdigest[i * 4 + 2] = pctx->state[i] >> 8;
+        pdigest[i * 4 + 3] = pctx->state[i];
+    }
+}
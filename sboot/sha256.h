@@ -0,0 +1,35 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+#define SHA256_DIGEST_SIZE          32
+#define SHA256_BLOCK_SIZE           64
+
+typedef struct
+{
+    uint32_t state[8];
+    uint32_t length;
+    uint8_t buffer[SHA256_BLOCK_SIZE];
+} sha256_ctx_t;
+
+/**
+ * @brief incremental sha-256, whole blocks are hashed in place without
+ *        copying, so feeding memory mapped flash costs no extra pass
+ */
+void sha256_init(sha256_ctx_t *pctx);
+void sha256_update(sha256_ctx_t *pctx, const uint8_t *pdata, uint32_t len);
+void sha256_final(sha256_ctx_t *pctx, uint8_t *pdigest);
+
+END_DECLS
+
+#endif /* _SHA256_H_ */
@@ -0,0 +1,272 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "spi_flash.h"
+#include "stm32f10x.h"
+#include "delay.h"
+#include "sched.h"
+#define __TRACE_MODULE  "[spi_flash]"
+#include "trace.h"
+
+#define CMD_WRITE_ENABLE            0x06
+#define CMD_READ_STATUS             0x05
+#define CMD_PAGE_PROGRAM            0x02
+#define CMD_SECTOR_ERASE            0x20
+#define CMD_FAST_READ               0x0b
+#define CMD_JEDEC_ID                0x9f
+#define CMD_READ_SECURITY           0x2b
+#define CMD_READ_FLAG_STATUS        0x70
+#define CMD_CLEAR_FLAG_STATUS       0x50
+#define STATUS_BUSY                 0x01
+/* parts that flag a failed program or erase, macronix in the security register */
+#define JEDEC_MACRONIX              0xc2
+#define SECURITY_PROGRAM_FAIL       0x20
+#define SECURITY_ERASE_FAIL         0x40
+/* micron in the flag status register, it stays set until cleared */
+#define JEDEC_MICRON                0x20
+#define FLAG_PROGRAM_FAIL           0x10
+#define FLAG_ERASE_FAIL             0x20
+/* longest operation used is a 4KB sector erase, 400ms worst case */
+#define SPI_FLASH_BUSY_TIMEOUT_US   500000
+
+#define SPI_FLASH_CS_LOW()          GPIO_ResetBits(GPIOA, GPIO_Pin_4)
+#define SPI_FLASH_CS_HIGH()         GPIO_SetBits(GPIOA, GPIO_Pin_4)
+
+static const uint8_t dummy_byte = 0xff;
+/* fail flags of the part found by spi_flash_init, none on most parts */
+static uint8_t fail_cmd;
+static uint8_t program_fail;
+static uint8_t erase_fail;
+
+static uint8_t spi_transfer(uint8_t data)
+{
+    while (RESET == SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_TXE));
+    SPI_I2S_SendData(SPI1, data);
+    while (RESET == SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_RXNE));
+    return SPI_I2S_ReceiveData(SPI1);
+}
+
+static void spi_command(uint8_t cmd, uint32_t address)
+{
+    spi_transfer(cmd);
+    spi_transfer(address >> 16);
+    spi_transfer(address >> 8);
+    spi_transfer(address);
+}
+
+static uint8_t spi_flash_register(uint8_t cmd)
+{
+    SPI_FLASH_CS_LOW();
+    spi_transfer(cmd);
+    uint8_t value = spi_transfer(dummy_byte);
+    SPI_FLASH_CS_HIGH();
+    return value;
+}
+
+static FLASH_Status spi_flash_wait_ready(void)
+{
+    uint32_t deadline = delay_deadline(SPI_FLASH_BUSY_TIMEOUT_US);
+    while (0 != (spi_flash_register(CMD_READ_STATUS) & STATUS_BUSY))
+    {
+        /**
+         * cpu is free while the chip works, the bus is released between polls.
+         * the chip ignores commands until it is ready, so tasks run here must
+         * keep off the flash until the caller returns
+         */
+        sched_idle();
+        if (delay_expired(deadline))
+        {
+            TRACE("flash busy timeout");
+            return FLASH_TIMEOUT;
+        }
+    }
+
+    return FLASH_COMPLETE;
+}
+
+/**
+ * @brief wait for a program or erase to finish, then check the fail flag of
+ *        the part for it
+ */
+static FLASH_Status spi_flash_wait_done(uint8_t fail)
+{
+    FLASH_Status status = spi_flash_wait_ready();
+    if ((FLASH_COMPLETE != status) || (0 == fail_cmd) ||
+        (0 == (spi_flash_register(fail_cmd) & fail)))
+    {
+        return status;
+    }
+
+    TRACE("flash %s failed", (fail == erase_fail) ? "erase" : "program");
+    if (CMD_READ_FLAG_STATUS == fail_cmd)
+    {
+        SPI_FLASH_CS_LOW();
+        spi_transfer(CMD_CLEAR_FLAG_STATUS);
+        SPI_FLASH_CS_HIGH();
+    }
+    return FLASH_ERROR_PG;
+}
+
+static void spi_flash_write_enable(void)
+{
+    SPI_FLASH_CS_LOW();
+    spi_transfer(CMD_WRITE_ENABLE);
+    SPI_FLASH_CS_HIGH();
+}
+
+bool spi_flash_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStructure;
+    SPI_InitTypeDef SPI_InitStructure;
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_SPI1, ENABLE);
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+    /* config pin: CS PA4, SCK PA5, MISO PA6, MOSI PA7 */
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_4;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_PP;
+    GPIO_Init(GPIOA, &GPIO_InitStructure);
+    SPI_FLASH_CS_HIGH();
+
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_5 | GPIO_Pin_7;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+    GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_6;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+    GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+    SPI_InitStructure.SPI_Direction = SPI_Direction_2Lines_FullDuplex;
+    SPI_InitStructure.SPI_Mode = SPI_Mode_Master;
+    SPI_InitStructure.SPI_DataSize = SPI_DataSize_8b;
+    SPI_InitStructure.SPI_CPOL = SPI_CPOL_High;
+    SPI_InitStructure.SPI_CPHA = SPI_CPHA_2Edge;
+    SPI_InitStructure.SPI_NSS = SPI_NSS_Soft;
+    SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_2;
+    SPI_InitStructure.SPI_FirstBit = SPI_FirstBit_MSB;
+    SPI_InitStructure.SPI_CRCPolynomial = 7;
+    SPI_Init(SPI1, &SPI_InitStructure);
+    SPI_Cmd(SPI1, ENABLE);
+
+    SPI_FLASH_CS_LOW();
+    spi_transfer(CMD_JEDEC_ID);
+    uint32_t id = spi_transfer(dummy_byte) << 16;
+    id |= spi_transfer(dummy_byte) << 8;
+    id |= spi_transfer(dummy_byte);
+    SPI_FLASH_CS_HIGH();
+
+    if ((0 == id) || (0xffffff == id))
+    {
+        TRACE("no spi flash found");
+        return false;
+    }
+
+    fail_cmd = 0;
+    if (JEDEC_MACRONIX == (id >> 16))
+    {
+        fail_cmd = CMD_READ_SECURITY;
+        program_fail = SECURITY_PROGRAM_FAIL;
+        erase_fail = SECURITY_ERASE_FAIL;
+    }
+    else if (JEDEC_MICRON == (id >> 16))
+    {
+        fail_cmd = CMD_READ_FLAG_STATUS;
+        program_fail = FLAG_PROGRAM_FAIL;
+        erase_fail = FLAG_ERASE_FAIL;
+    }
+
+    TRACE("spi flash id 0x%06x", id);
+    return true;
+}
+
+void spi_flash_read_start(uint32_t address, uint8_t *pbuf, uint32_t len)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+
+    SPI_FLASH_CS_LOW();
+    spi_command(CMD_FAST_READ, address);
+    spi_transfer(dummy_byte);
+
+    /* rx channel stores the data, tx channel clocks out dummy bytes */
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&SPI1->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)pbuf;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = len;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DMA1_Channel2, &DMA_InitStructure);
+
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)&dummy_byte;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Disable;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_Init(DMA1_Channel3, &DMA_InitStructure);
+
+    DMA_ClearFlag(DMA1_FLAG_GL2 | DMA1_FLAG_GL3);
+    SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE);
+    DMA_Cmd(DMA1_Channel2, ENABLE);
+    DMA_Cmd(DMA1_Channel3, ENABLE);
+}
+
+void spi_flash_read_wait(void)
+{
+    while (RESET == DMA_GetFlagStatus(DMA1_FLAG_TC2));
+    DMA_Cmd(DMA1_Channel2, DISABLE);
+    DMA_Cmd(DMA1_Channel3, DISABLE);
+    SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE);
+    while (SET == SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_BSY));
+    SPI_FLASH_CS_HIGH();
+}
+
+void spi_flash_read(uint32_t address, uint8_t *pbuf, uint32_t len)
+{
+    spi_flash_read_start(address, pbuf, len);
+    spi_flash_read_wait();
+}
+
+FLASH_Status spi_flash_sector_erase(uint32_t address)
+{
+    spi_flash_write_enable();
+    SPI_FLASH_CS_LOW();
+    spi_command(CMD_SECTOR_ERASE, address & ~(SPI_FLASH_SECTOR_SIZE - 1));
+    SPI_FLASH_CS_HIGH();
+    return spi_flash_wait_done(erase_fail);
+}
+
+FLASH_Status spi_flash_write(uint32_t address, const uint8_t *pbuf, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t count = SPI_FLASH_PAGE_SIZE - (address % SPI_FLASH_PAGE_SIZE);
+        count = MIN(count, len);
+        spi_flash_write_enable();
+        SPI_FLASH_CS_LOW();
+        spi_command(CMD_PAGE_PROGRAM, address);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            spi_transfer(pbuf[i]);
+        }
+        SPI_FLASH_CS_HIGH();
+        FLASH_Status status = spi_flash_wait_done(program_fail);
+        if (FLASH_COMPLETE != status)
+        {
+            return status;
+        }
+
+        address += count;
+        pbuf += count;
+        len -= count;
+    }
+
+    return FLASH_COMPLETE;
+}
@@ -0,0 +1,54 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _SPI_FLASH_H_
+#define _SPI_FLASH_H_
+
+#include "types.h"
+#include "stm32f10x_flash.h"
+
+BEGIN_DECLS
+
+#define SPI_FLASH_PAGE_SIZE         256
+#define SPI_FLASH_SECTOR_SIZE       4096
+
+/**
+ * @brief init spi nor flash on SPI1 (PA4 CS, PA5 SCK, PA6 MISO, PA7 MOSI)
+ * @return true if a flash answered the jedec id command
+ */
+bool spi_flash_init(void);
+
+/**
+ * @brief read data, blocks until the dma transfer is done
+ * @param[in] address: flash address
+ * @param[out] pbuf: read buffer
+ * @param[in] len: data length, at most 65535
+ */
+void spi_flash_read(uint32_t address, uint8_t *pbuf, uint32_t len);
+
+/**
+ * @brief start reading data in background, finish with spi_flash_read_wait
+ */
+void spi_flash_read_start(uint32_t address, uint8_t *pbuf, uint32_t len);
+void spi_flash_read_wait(void);
+
+/**
+ * @brief erase the 4 KB sector containing address
+ * @return FLASH_TIMEOUT if the chip stays busy, FLASH_ERROR_PG if a part
+ *         with fail flags (macronix, micron) reports the erase failed
+ */
+FLASH_Status spi_flash_sector_erase(uint32_t address);
+
+/**
+ * @brief program erased area, may cross page boundaries, stops at the first
+ *        page that times out or fails like spi_flash_sector_erase
+ */
+FLASH_Status spi_flash_write(uint32_t address, const uint8_t *pbuf, uint32_t len);
+
+END_DECLS
+
+#endif /* _SPI_FLASH_H_ */
@@ -37,6 +37,8 @@ Stack_Size      EQU     0x00000400
                 AREA    STACK, NOINIT, READWRITE, ALIGN=3
 Stack_Mem       SPACE   Stack_Size
 __initial_sp
+                EXPORT  Stack_Mem
+                EXPORT  Stack_Size
                                                   
 ; <h> Heap Configuration
 ;   <o>  Heap Size (in Bytes) <0x0-0xFFFFFFFF:8>
@@ -48,6 +50,8 @@ Heap_Size       EQU     0x00000200
 __heap_base
 Heap_Mem        SPACE   Heap_Size
 __heap_limit
+                EXPORT  Heap_Mem
+                EXPORT  Heap_Size
 
                 PRESERVE8
                 THUMB
@@ -146,12 +150,55 @@ __Vectors_Size  EQU  __Vectors_End - __Vectors
 ; Reset handler
 Reset_Handler   PROC
                 EXPORT  Reset_Handler             [WEAK]
-                IMPORT  __main
                 IMPORT  SystemInit
+                ; cycle counter runs from here, main reports reset to main cycles
+                LDR     R0, =0xe000edfc         ; CoreDebug->DEMCR
+                LDR     R1, [R0]
+                ORR     R1, R1, #0x01000000     ; TRCENA
+                STR     R1, [R0]
+                LDR     R0, =0xe0001000         ; DWT_CTRL
+                LDR     R1, [R0]
+                ORR     R1, R1, #0x00000001     ; CYCCNTENA
+                STR     R1, [R0]
+                IF      :DEF:__ENABLE_LEAN_STARTUP
+                ; no __main: copy .data, zero .bss, then main without library
+                ; init, heap or stdio. rw data must not be compressed, link with
+                ; --datacompressor=off
+                IMPORT  main
+                IMPORT  |Load$$RW_IRAM1$$Base|
+                IMPORT  |Image$$RW_IRAM1$$RW$$Base|
+                IMPORT  |Image$$RW_IRAM1$$RW$$Limit|
+                IMPORT  |Image$$RW_IRAM1$$ZI$$Base|
+                IMPORT  |Image$$RW_IRAM1$$ZI$$Limit|
+                LDR     R0, =|Load$$RW_IRAM1$$Base|
+                LDR     R1, =|Image$$RW_IRAM1$$RW$$Base|
+                LDR     R2, =|Image$$RW_IRAM1$$RW$$Limit|
+Copy_Data       CMP     R1, R2
+                BHS     Copy_Data_End
+                LDR     R3, [R0], #4
+                STR     R3, [R1], #4
+                B       Copy_Data
+Copy_Data_End
+                LDR     R1, =|Image$$RW_IRAM1$$ZI$$Base|
+                LDR     R2, =|Image$$RW_IRAM1$$ZI$$Limit|
+                MOVS    R3, #0
+Zero_Bss        CMP     R1, R2
+                BHS     Zero_Bss_End
+                STR     R3, [R1], #4
+                B       Zero_Bss
+Zero_Bss_End
+                LDR     R0, =SystemInit
+                BLX     R0
+                LDR     R0, =main
+                BLX     R0
+                B       .
+                ELSE
+                IMPORT  __main
                 LDR     R0, =SystemInit
                 BLX     R0               
                 LDR     R0, =__main
                 BX      R0
+                ENDIF
                 ENDP
                 
 ; Dummy Exception Handlers (infinite loops which can be modified)
@@ -0,0 +1,145 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "storage.h"
+#include "flash_map.h"
+#include "crc32.h"
+
+#ifdef __ENABLE_SPI_FLASH
+#define STAGING_DEVICE              (&storage_spi)
+#else
+#define STAGING_DEVICE              (&storage_internal)
+#endif
+
+/* xl parts run sboot from bank 1 and keep the app in bank 2 */
+#ifdef STM32F10X_XL
+#define APP_DEVICE                  (&storage_bank2)
+#else
+#define APP_DEVICE                  (&storage_internal)
+#endif
+
+/* chunk size for checksums on devices that are not mapped */
+#define STORAGE_CHECKSUM_CHUNK      64
+
+const storage_slot_t slot_app = {APP_DEVICE, APP_IMAGE_ADDR, APP_IMAGE_SIZE};
+const storage_slot_t slot_header = {STAGING_DEVICE, UPGRADE_IMAGE_HEADER_ADDR, UPGRADE_IMAGE_HEADER_SIZE};
+const storage_slot_t slot_staging = {STAGING_DEVICE, UPGRADE_IMAGE_ADDR, UPGRADE_IMAGE_SIZE};
+
+bool storage_init(const storage_slot_t *pslot)
+{
+    return (NULL == pslot->pdev->init) || pslot->pdev->init();
+}
+
+const uint8_t *storage_map(const storage_slot_t *pslot, uint32_t offset)
+{
+    if (0 == (pslot->pdev->caps & STORAGE_CAP_MAPPED))
+    {
+        return NULL;
+    }
+
+    return (const uint8_t *)(pslot->address + offset);
+}
+
+void storage_read(const storage_slot_t *pslot, uint32_t offset, void *pbuf, uint32_t len)
+{
+    pslot->pdev->read(pslot->address + offset, (uint8_t *)pbuf, len);
+}
+
+void storage_read_start(const storage_slot_t *pslot, uint32_t offset, void *pbuf, uint32_t len)
+{
+    pslot->pdev->read_start(pslot->address + offset, (uint8_t *)pbuf, len);
+}
+
+void storage_read_wait(const storage_slot_t *pslot)
+{
+    pslot->pdev->read_wait();
+}
+
+FLASH_Status storage_erase(const storage_slot_t *pslot, uint32_t offset)
+{
+    return pslot->pdev->erase(pslot->address + offset);
+}
+
+FLASH_Status storage_program(const storage_slot_t *pslot, uint32_t offset, const void *pbuf, uint32_t len)
+{
+    return pslot->pdev->program(pslot->address + offset, (const uint8_t *)pbuf, len);
+}
+
+FLASH_Status storage_erase_start(const storage_slot_t *pslot, uint32_t offset)
+{
+    if (NULL == pslot->pdev->erase_start)
+    {
+        return storage_erase(pslot, offset);
+    }
+
+    return pslot->pdev->erase_start(pslot->address + offset);
+}
+
+FLASH_Status storage_erase_wait(const storage_slot_t *pslot, uint32_t offset)
+{
+    if (NULL == pslot->pdev->erase_wait)
+    {
+        return FLASH_COMPLETE;
+    }
+
+    return pslot->pdev->erase_wait(pslot->address + offset);
+}
+
+bool storage_blank(const storage_slot_t *pslot, uint32_t offset, uint32_t len)
+{
+    const uint32_t *pdata = (const uint32_t *)storage_map(pslot, offset);
+    uint32_t chunk[STORAGE_CHECKSUM_CHUNK / 4];
+    while (len > 0)
+    {
+        uint32_t count = MIN(len, sizeof(chunk));
+        const uint32_t *pword = pdata;
+        if (NULL == pword)
+        {
+            storage_read(pslot, offset, chunk, count);
+            pword = chunk;
+        }
+
+        for (uint32_t i = 0; i < count / 4; ++i)
+        {
+            if (0xffffffff != pword[i])
+            {
+                return false;
+            }
+        }
+
+        if (NULL != pdata)
+        {
+            pdata += count / 4;
+        }
+        offset += count;
+        len -= count;
+    }
+
+    return true;
+}
+
+uint32_t storage_checksum(const storage_slot_t *pslot, uint32_t offset, uint32_t len)
+{
+    const uint8_t *pdata = storage_map(pslot, offset);
+    if (NULL != pdata)
+    {
+        return crc32(0, pdata, len);
+    }
+
+    uint32_t chunk[STORAGE_CHECKSUM_CHUNK / 4];
+    uint32_t crc_val = 0;
+    while (len > 0)
+    {
+        uint32_t count = MIN(len, sizeof(chunk));
+        storage_read(pslot, offset, chunk, count);
+        crc_val = crc32(crc_val, (const uint8_t *)chunk, count);
+        offset += count;
+        len -= count;
+    }
+
+    return crc_val;
+}
@@ -0,0 +1,112 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include "types.h"
+#include "stm32f10x_flash.h"
+
+BEGIN_DECLS
+
+/* device can be read in place through the bus */
+#define STORAGE_CAP_MAPPED          0x01
+/* read_start/read_wait run in background */
+#define STORAGE_CAP_DMA             0x02
+/* erasing does not stall execution from internal flash */
+#define STORAGE_CAP_RWW             0x04
+
+/**
+ * storage device, addresses are device addresses. program only turns
+ * erased bits into data, erase works on the erase_size unit holding address
+ */
+typedef struct
+{
+    uint32_t erase_size;
+    uint8_t caps;
+    /* optional, called before first use */
+    bool (*init)(void);
+    void (*read)(uint32_t address, uint8_t *pbuf, uint32_t len);
+    /* STORAGE_CAP_DMA only */
+    void (*read_start)(uint32_t address, uint8_t *pbuf, uint32_t len);
+    void (*read_wait)(void);
+    FLASH_Status (*erase)(uint32_t address);
+    FLASH_Status (*program)(uint32_t address, const uint8_t *pbuf, uint32_t len);
+    /* optional, the next erase or program waits for it, erase_wait collects it */
+    FLASH_Status (*erase_start)(uint32_t address);
+    FLASH_Status (*erase_wait)(uint32_t address);
+} storage_device_t;
+
+/**
+ * slot, a region of a device, everything above works on slot offsets
+ */
+typedef struct
+{
+    const storage_device_t *pdev;
+    uint32_t address;
+    uint32_t size;
+} storage_slot_t;
+
+extern const storage_device_t storage_internal;
+extern const storage_device_t storage_spi;
+#ifdef STM32F10X_XL
+extern const storage_device_t storage_bank2;
+#endif
+
+extern const storage_slot_t slot_app;
+extern const storage_slot_t slot_header;
+extern const storage_slot_t slot_staging;
+
+/**
+ * @brief init the device of a slot, once, later calls return the result
+ */
+bool storage_init(const storage_slot_t *pslot);
+
+/**
+ * @return pointer to slot data on a mapped device, NULL otherwise
+ */
+const uint8_t *storage_map(const storage_slot_t *pslot, uint32_t offset);
+
+void storage_read(const storage_slot_t *pslot, uint32_t offset, void *pbuf, uint32_t len);
+void storage_read_start(const storage_slot_t *pslot, uint32_t offset, void *pbuf, uint32_t len);
+void storage_read_wait(const storage_slot_t *pslot);
+FLASH_Status storage_erase(const storage_slot_t *pslot, uint32_t offset);
+FLASH_Status storage_program(const storage_slot_t *pslot, uint32_t offset, const void *pbuf, uint32_t len);
+
+/**
+ * @brief background erase, a plain erase on devices without erase_start
+ */
+FLASH_Status storage_erase_start(const storage_slot_t *pslot, uint32_t offset);
+FLASH_Status storage_erase_wait(const storage_slot_t *pslot, uint32_t offset);
+
+/**
+ * @brief crc32 of slot data, in place on mapped devices
+ */
+uint32_t storage_checksum(const storage_slot_t *pslot, uint32_t offset, uint32_t len);
+
+/**
+ * @brief every byte is erased, len is a multiple of 4
+ */
+bool storage_blank(const storage_slot_t *pslot, uint32_t offset, uint32_t len);
+
+/**
+ * @brief internal flash erase and program for service calls from the app,
+ *        they run on the caller stack only: no scheduler, deadline, trace
+ *        or any other sboot ram, and a background erase is not collected
+ */
+FLASH_Status flash_standalone_erase(uint32_t address);
+FLASH_Status flash_standalone_program(uint32_t address, const uint8_t *pbuf, uint32_t len);
+
+/**
+ * @brief halfwords the internal flash skipped since the last call, they
+ *        already held the value to program
+ */
+uint32_t flash_skipped_halfwords(void);
+
+END_DECLS
+
+#endif /* _STORAGE_H_ */
@@ -0,0 +1,445 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "storage.h"
+#include "stm32f10x.h"
+#include "delay.h"
+#include "sched.h"
+#ifdef __ENABLE_FLASH_TELEMETRY
+#include "telemetry.h"
+#endif
+#define __TRACE_MODULE  "[storage_flash]"
+#include "trace.h"
+
+#define FLASH_PAGE_SIZE             2048
+#define FLASH_FAILED_TRY_COUNT      3
+/* datasheet worst case is 40ms per page erase and 70us per halfword */
+#define FLASH_ERASE_TIMEOUT_US      50000
+#define FLASH_PROGRAM_TIMEOUT_US    200
+/* busy polls per us for standalone waits, enough up to 72MHz */
+#define FLASH_STANDALONE_LOOPS_US   18
+#define FLASH_UNLOCK_KEY1           0x45670123
+#define FLASH_UNLOCK_KEY2           0xcdef89ab
+
+/* second bank of xl parts, registers at CR2, SR2, AR2 and KEYR2 */
+#define FLASH_BANK2_ADDR            0x08080000
+
+typedef struct
+{
+    __IO uint32_t *psr;
+    __IO uint32_t *pcr;
+    __IO uint32_t *par;
+    __IO uint32_t *pkeyr;
+    /* background erase started by flash_erase_start */
+    bool erase_pending;
+    bool erase_relock;
+    uint32_t erase_address;
+    /* on the caller stack for the app, see flash_standalone_erase */
+    bool standalone;
+} flash_bank_t;
+
+static flash_bank_t bank1 = {&FLASH->SR, &FLASH->CR, &FLASH->AR, &FLASH->KEYR, false, false, 0, false};
+#ifdef STM32F10X_XL
+static flash_bank_t bank2 = {&FLASH->SR2, &FLASH->CR2, &FLASH->AR2, &FLASH->KEYR2, false, false, 0, false};
+#endif
+
+static uint32_t skipped_count;
+
+static flash_bank_t *flash_bank(uint32_t address)
+{
+#ifdef STM32F10X_XL
+    if (address >= FLASH_BANK2_ADDR)
+    {
+        return &bank2;
+    }
+#else
+    UNUSED(address);
+#endif
+
+    return &bank1;
+}
+
+/**
+ * @brief bank without sboot ram, the app owns it when it calls a service
+ */
+static void flash_bank_standalone(flash_bank_t *pbank, uint32_t address)
+{
+    pbank->psr = &FLASH->SR;
+    pbank->pcr = &FLASH->CR;
+    pbank->par = &FLASH->AR;
+    pbank->pkeyr = &FLASH->KEYR;
+#ifdef STM32F10X_XL
+    if (address >= FLASH_BANK2_ADDR)
+    {
+        pbank->psr = &FLASH->SR2;
+        pbank->pcr = &FLASH->CR2;
+        pbank->par = &FLASH->AR2;
+        pbank->pkeyr = &FLASH->KEYR2;
+    }
+#else
+    UNUSED(address);
+#endif
+    pbank->erase_pending = false;
+    pbank->erase_relock = false;
+    pbank->erase_address = 0;
+    pbank->standalone = true;
+}
+
+/**
+ * @brief busy wait by loop count, the app owns the cycle counter
+ *        and SystemCoreClock
+ */
+static bool flash_wait_standalone(flash_bank_t *pbank, uint32_t timeout)
+{
+    for (uint32_t loops = timeout * FLASH_STANDALONE_LOOPS_US; loops > 0; --loops)
+    {
+        if (0 == (*pbank->psr & FLASH_SR_BSY))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief wait for the flash controller, the library waits are loop counts
+ *        that drift with the clock, this one is a real deadline
+ */
+static FLASH_Status flash_wait(flash_bank_t *pbank, uint32_t timeout)
+{
+    if (pbank->standalone)
+    {
+        if (!flash_wait_standalone(pbank, timeout))
+        {
+            return FLASH_TIMEOUT;
+        }
+    }
+    else
+    {
+        uint32_t deadline = delay_deadline(timeout);
+        while (0 != (*pbank->psr & FLASH_SR_BSY))
+        {
+            sched_idle();
+            if (delay_expired(deadline))
+            {
+                return FLASH_TIMEOUT;
+            }
+        }
+    }
+
+    uint32_t status = *pbank->psr;
+    *pbank->psr = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+    if (0 != (status & FLASH_SR_WRPRTERR))
+    {
+        return FLASH_ERROR_WRP;
+    }
+
+    if (0 != (status & FLASH_SR_PGERR))
+    {
+        return FLASH_ERROR_PG;
+    }
+
+    return FLASH_COMPLETE;
+}
+
+/**
+ * @brief unlock the controller unless the caller already did
+ * @return true if it has to be locked again afterwards
+ */
+static bool flash_unlock(flash_bank_t *pbank)
+{
+    if (0 == (*pbank->pcr & FLASH_CR_LOCK))
+    {
+        return false;
+    }
+
+    *pbank->pkeyr = FLASH_UNLOCK_KEY1;
+    *pbank->pkeyr = FLASH_UNLOCK_KEY2;
+    return true;
+}
+
+static void flash_relock(flash_bank_t *pbank, bool relock)
+{
+    if (relock)
+    {
+        *pbank->pcr |= FLASH_CR_LOCK;
+    }
+}
+
+/**
+ * @brief collect a background erase, every other operation on the bank
+ *        does this first
+ */
+static FLASH_Status flash_finish(flash_bank_t *pbank)
+{
+    if (!pbank->erase_pending)
+    {
+        return FLASH_COMPLETE;
+    }
+
+    FLASH_Status status = flash_wait(pbank, FLASH_ERASE_TIMEOUT_US);
+    *pbank->pcr &= ~FLASH_CR_PER;
+    pbank->erase_pending = false;
+    flash_relock(pbank, pbank->erase_relock);
+#ifdef __ENABLE_FLASH_TELEMETRY
+    telemetry_erase(pbank->erase_address, 0, 0, FLASH_COMPLETE != status);
+#endif
+    return status;
+}
+
+static FLASH_Status flash_erase_once(flash_bank_t *pbank, uint32_t address)
+{
+    FLASH_Status status = flash_wait(pbank, FLASH_ERASE_TIMEOUT_US);
+    if (FLASH_COMPLETE == status)
+    {
+        *pbank->pcr |= FLASH_CR_PER;
+        *pbank->par = address;
+        *pbank->pcr |= FLASH_CR_STRT;
+        status = flash_wait(pbank, FLASH_ERASE_TIMEOUT_US);
+        *pbank->pcr &= ~FLASH_CR_PER;
+    }
+
+    return status;
+}
+
+/**
+ * @brief program a word as two halfwords, halfwords already holding the
+ *        value are skipped, on an erased page that is every 0xffff. the
+ *        others must be erased or be cleared to 0
+ */
+static FLASH_Status flash_program_word(flash_bank_t *pbank, uint32_t address, uint32_t data)
+{
+    FLASH_Status status = FLASH_COMPLETE;
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        uint16_t halfword = (uint16_t)(data >> (i * 16));
+        if (*(__IO uint16_t *)(address + i * 2) == halfword)
+        {
+            if (!pbank->standalone)
+            {
+                skipped_count ++;
+            }
+            continue;
+        }
+
+        status = flash_wait(pbank, FLASH_PROGRAM_TIMEOUT_US);
+        if (FLASH_COMPLETE != status)
+        {
+            break;
+        }
+
+        *pbank->pcr |= FLASH_CR_PG;
+        *(__IO uint16_t *)(address + i * 2) = halfword;
+        status = flash_wait(pbank, FLASH_PROGRAM_TIMEOUT_US);
+        *pbank->pcr &= ~FLASH_CR_PG;
+        if (FLASH_COMPLETE != status)
+        {
+            break;
+        }
+    }
+
+    return status;
+}
+
+uint32_t flash_skipped_halfwords(void)
+{
+    uint32_t count = skipped_count;
+    skipped_count = 0;
+    return count;
+}
+
+static void flash_read(uint32_t address, uint8_t *pbuf, uint32_t len)
+{
+    memcpy(pbuf, (const void *)address, len);
+}
+
+static FLASH_Status flash_erase(uint32_t address)
+{
+    flash_bank_t *pbank = flash_bank(address);
+    flash_finish(pbank);
+    FLASH_Status status = FLASH_COMPLETE;
+    bool relock = flash_unlock(pbank);
+    uint8_t try_count;
+    uint32_t cycles = 0;
+    for (try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+    {
+        cycles = delay_cycles();
+        status = flash_erase_once(pbank, address & ~(FLASH_PAGE_SIZE - 1));
+        cycles = delay_cycles() - cycles;
+        if (FLASH_COMPLETE != status)
+        {
+            /* try again */
+            TRACE("erase page 0x%08x failed: %d, retry %d...", address, status, try_count);
+            continue;
+        }
+
+        break;
+    }
+    flash_relock(pbank, relock);
+#ifdef __ENABLE_FLASH_TELEMETRY
+    telemetry_erase(address, cycles, MIN(try_count, FLASH_FAILED_TRY_COUNT - 1), FLASH_COMPLETE != status);
+#else
+    UNUSED(cycles);
+#endif
+
+    return status;
+}
+
+/**
+ * @brief start a page erase and return, with the page in the other bank
+ *        the cpu keeps running from flash meanwhile
+ */
+static FLASH_Status flash_erase_start(uint32_t address)
+{
+    flash_bank_t *pbank = flash_bank(address);
+    FLASH_Status status = flash_finish(pbank);
+    if (FLASH_COMPLETE == status)
+    {
+        pbank->erase_relock = flash_unlock(pbank);
+        status = flash_wait(pbank, FLASH_ERASE_TIMEOUT_US);
+        if (FLASH_COMPLETE != status)
+        {
+            flash_relock(pbank, pbank->erase_relock);
+            return status;
+        }
+
+        *pbank->pcr |= FLASH_CR_PER;
+        *pbank->par = address & ~(FLASH_PAGE_SIZE - 1);
+        *pbank->pcr |= FLASH_CR_STRT;
+        pbank->erase_pending = true;
+        pbank->erase_address = address;
+    }
+
+    return status;
+}
+
+static FLASH_Status flash_erase_wait(uint32_t address)
+{
+    return flash_finish(flash_bank(address));
+}
+
+/**
+ * @brief len is a multiple of 4, a background erase of the page is
+ *        waited for by the first halfword
+ */
+static FLASH_Status flash_program(uint32_t address, const uint8_t *pbuf, uint32_t len)
+{
+    FLASH_Status status = FLASH_COMPLETE;
+    const uint32_t *pdata = (const uint32_t *)pbuf;
+    uint8_t try_count;
+    uint8_t retries = 0;
+    flash_bank_t *pbank = flash_bank(address);
+    FLASH_Status erase_status = flash_finish(pbank);
+    uint32_t cycles = delay_cycles();
+    bool relock = flash_unlock(pbank);
+    for (uint32_t i = 0; i < len / 4; ++i)
+    {
+        for (try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+        {
+            status = flash_program_word(pbank, address + i * 4, pdata[i]);
+            if (FLASH_COMPLETE != status)
+            {
+                /* try again */
+                TRACE("write address 0x%08x failed: %d, retry %d...", address + i * 4, status, try_count);
+                retries ++;
+                continue;
+            }
+
+            break;
+        }
+
+        if (try_count >= FLASH_FAILED_TRY_COUNT)
+        {
+            break;
+        }
+    }
+    flash_relock(pbank, relock);
+#ifdef __ENABLE_FLASH_TELEMETRY
+    telemetry_program(len, delay_cycles() - cycles, retries, FLASH_COMPLETE != status);
+#else
+    UNUSED(cycles);
+    UNUSED(retries);
+#endif
+
+    /* a failed erase shows up as program errors, report it if it did not */
+    return (FLASH_COMPLETE == status) ? erase_status : status;
+}
+
+FLASH_Status flash_standalone_erase(uint32_t address)
+{
+    flash_bank_t bank;
+    flash_bank_standalone(&bank, address);
+    FLASH_Status status = FLASH_COMPLETE;
+    bool relock = flash_unlock(&bank);
+    for (uint8_t try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+    {
+        status = flash_erase_once(&bank, address & ~(FLASH_PAGE_SIZE - 1));
+        if (FLASH_COMPLETE == status)
+        {
+            break;
+        }
+    }
+    flash_relock(&bank, relock);
+
+    return status;
+}
+
+FLASH_Status flash_standalone_program(uint32_t address, const uint8_t *pbuf, uint32_t len)
+{
+    FLASH_Status status = FLASH_COMPLETE;
+    const uint32_t *pdata = (const uint32_t *)pbuf;
+    flash_bank_t bank;
+    flash_bank_standalone(&bank, address);
+    bool relock = flash_unlock(&bank);
+    for (uint32_t i = 0; (i < len / 4) && (FLASH_COMPLETE == status); ++i)
+    {
+        for (uint8_t try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+        {
+            status = flash_program_word(&bank, address + i * 4, pdata[i]);
+            if (FLASH_COMPLETE == status)
+            {
+                break;
+            }
+        }
+    }
+    flash_relock(&bank, relock);
+
+    return status;
+}
+
+const storage_device_t storage_internal =
+{
+    FLASH_PAGE_SIZE,
+    STORAGE_CAP_MAPPED,
+    NULL,
+    flash_read,
+    NULL,
+    NULL,
+    flash_erase,
+    flash_program,
+    flash_erase_start,
+    flash_erase_wait,
+};
+
+#ifdef STM32F10X_XL
+/* same controller, bank 2 erases and programs without stalling bank 1 */
+const storage_device_t storage_bank2 =
+{
+    FLASH_PAGE_SIZE,
+    STORAGE_CAP_MAPPED | STORAGE_CAP_RWW,
+    NULL,
+    flash_read,
+    NULL,
+    NULL,
+    flash_erase,
+    flash_program,
+    flash_erase_start,
+    flash_erase_wait,
+};
+#endif
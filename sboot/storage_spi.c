@@ -0,0 +1,36 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "storage.h"
+#include "spi_flash.h"
+
+static bool spi_init(void)
+{
+    static bool initialized = false;
+    static bool ready = false;
+    if (!initialized)
+    {
+        ready = spi_flash_init();
+        initialized = true;
+    }
+
+    return ready;
+}
+
+const storage_device_t storage_spi =
+{
+    SPI_FLASH_SECTOR_SIZE,
+    STORAGE_CAP_DMA | STORAGE_CAP_RWW,
+    spi_init,
+    spi_flash_read,
+    spi_flash_read_start,
+    spi_flash_read_wait,
+    spi_flash_sector_erase,
+    spi_flash_write,
+    NULL,
+    NULL,
+};
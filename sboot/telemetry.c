@@ -0,0 +1,151 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "telemetry.h"
+#include "stm32f10x.h"
+#define __TRACE_MODULE  "[telemetry]"
+#include "trace.h"
+
+/* needs the key-value store, not in the minimal build */
+#ifndef __ENABLE_MINIMAL_BUILD
+
+#define TELEMETRY_WEAR_KEYS         (TELEMETRY_PAGE_COUNT / TELEMETRY_PAGES_PER_KEY)
+
+/* wear records stay below the app keys */
+typedef char telemetry_keys_fit[(TELEMETRY_KEY_WEAR + TELEMETRY_WEAR_KEYS <= KV_KEY_APP_FIRST) ? 1 : -1];
+
+static kv_store_t store;
+static flash_telemetry_t summary;
+static uint16_t wear[TELEMETRY_PAGE_COUNT];
+/* bit per wear key changed since the last save */
+static uint32_t wear_dirty;
+static bool loaded;
+static bool dirty;
+static uint32_t program_cycles;
+static uint32_t program_bytes;
+
+/**
+ * @brief lazily, a boot that never erases never mounts the store
+ */
+static bool telemetry_load(void)
+{
+    if (loaded)
+    {
+        return true;
+    }
+
+    if (FLASH_COMPLETE != kv_mount(&store))
+    {
+        return false;
+    }
+
+    kv_read(&store, TELEMETRY_KEY_SUMMARY, &summary, sizeof(summary));
+    for (uint32_t i = 0; i < TELEMETRY_WEAR_KEYS; ++i)
+    {
+        kv_read(&store, TELEMETRY_KEY_WEAR + i, wear + i * TELEMETRY_PAGES_PER_KEY,
+                TELEMETRY_PAGES_PER_KEY * sizeof(uint16_t));
+    }
+    loaded = true;
+    return true;
+}
+
+static uint32_t telemetry_us(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+static uint32_t telemetry_average(uint32_t avg, uint32_t sample)
+{
+    return (0 == avg) ? sample : ((avg * 7 + sample) / 8);
+}
+
+void telemetry_erase(uint32_t address, uint32_t cycles, uint8_t retries, bool failed)
+{
+    uint32_t page = (address - FLASH_BASE) / TELEMETRY_PAGE_SIZE;
+    if ((page >= TELEMETRY_PAGE_COUNT) || !telemetry_load())
+    {
+        return;
+    }
+
+    summary.erase_count ++;
+    summary.retries += retries;
+    summary.failures += failed ? 1 : 0;
+    if (TELEMETRY_WEAR_COUNT != (wear[page] & TELEMETRY_WEAR_COUNT))
+    {
+        wear[page] ++;
+    }
+
+    /* background erases finish unobserved, they are counted only */
+    if (0 != cycles)
+    {
+        uint32_t us = telemetry_us(cycles);
+        summary.erase_us_avg = telemetry_average(summary.erase_us_avg, us);
+        if (us > summary.erase_us_max)
+        {
+            summary.erase_us_max = us;
+            summary.erase_us_max_page = page;
+        }
+
+        if ((us > TELEMETRY_SLOW_ERASE_US) && (0 == (wear[page] & TELEMETRY_WEAR_SLOW)))
+        {
+            TRACE("page %d erase took %dus", page, us);
+            wear[page] |= TELEMETRY_WEAR_SLOW;
+            summary.slow_count ++;
+        }
+    }
+
+    wear_dirty |= 1u << (page / TELEMETRY_PAGES_PER_KEY);
+    dirty = true;
+}
+
+void telemetry_program(uint32_t len, uint32_t cycles, uint8_t retries, bool failed)
+{
+    if (!telemetry_load())
+    {
+        return;
+    }
+
+    summary.retries += retries;
+    summary.failures += failed ? 1 : 0;
+    program_cycles += cycles;
+    program_bytes += len;
+    dirty = true;
+}
+
+void telemetry_save(void)
+{
+    if (!dirty)
+    {
+        return;
+    }
+
+    if (0 != program_bytes)
+    {
+        uint32_t us_per_kb = (uint32_t)((uint64_t)telemetry_us(program_cycles) * 1024 / program_bytes);
+        summary.program_us_per_kb = telemetry_average(summary.program_us_per_kb, us_per_kb);
+    }
+
+    for (uint32_t i = 0; i < TELEMETRY_WEAR_KEYS; ++i)
+    {
+        if (0 != (wear_dirty & (1u << i)))
+        {
+            kv_write(&store, TELEMETRY_KEY_WEAR + i, wear + i * TELEMETRY_PAGES_PER_KEY,
+                     TELEMETRY_PAGES_PER_KEY * sizeof(uint16_t));
+        }
+    }
+    kv_write(&store, TELEMETRY_KEY_SUMMARY, &summary, sizeof(summary));
+    TRACE("%d erases, %dus avg, %dus max at page %d, %d slow pages, %dus per KB",
+          summary.erase_count, summary.erase_us_avg, summary.erase_us_max,
+          summary.erase_us_max_page, summary.slow_count, summary.program_us_per_kb);
+
+    wear_dirty = 0;
+    program_cycles = 0;
+    program_bytes = 0;
+    dirty = false;
+}
+#endif
@@ -0,0 +1,76 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "types.h"
+#include "kv.h"
+
+BEGIN_DECLS
+
+/**
+ * internal flash wear as seen by sboot, kept in the key-value store:
+ *
+ *   TELEMETRY_KEY_SUMMARY          flash_telemetry_t
+ *   TELEMETRY_KEY_WEAR + n         uint16_t per page, pages n * 32 to
+ *                                  n * 32 + 31 of the internal flash
+ *
+ * A page entry holds the saturating erase count and TELEMETRY_WEAR_SLOW
+ * once the page erased slower than TELEMETRY_SLOW_ERASE_US.
+ *
+ * sboot counts its own erases only, the app reads the records with
+ * kv_read through the service table. Nothing is written on a boot that
+ * erased nothing.
+ */
+#define TELEMETRY_PAGE_SIZE         2048
+#ifdef STM32F10X_XL
+#define TELEMETRY_PAGE_COUNT        512
+#else
+#define TELEMETRY_PAGE_COUNT        256
+#endif
+#define TELEMETRY_PAGES_PER_KEY     (KV_VALUE_MAX / sizeof(uint16_t))
+#define TELEMETRY_WEAR_SLOW         0x8000
+#define TELEMETRY_WEAR_COUNT        0x7fff
+
+#define TELEMETRY_KEY_SUMMARY       0
+#define TELEMETRY_KEY_WEAR          1
+
+/* erases slower than this mark the page in flash_telemetry_t.slow */
+#ifndef TELEMETRY_SLOW_ERASE_US
+#define TELEMETRY_SLOW_ERASE_US     30000
+#endif
+
+typedef struct
+{
+    uint32_t erase_count;
+    /* retries after a failed erase or program, failures after the last retry */
+    uint16_t retries;
+    uint16_t failures;
+    /* per erase and per programmed KB, averaged with 1/8 weight for the new sample */
+    uint32_t erase_us_avg;
+    uint32_t program_us_per_kb;
+    uint32_t erase_us_max;
+    uint16_t erase_us_max_page;
+    /* pages marked TELEMETRY_WEAR_SLOW */
+    uint16_t slow_count;
+} flash_telemetry_t;
+
+/**
+ * @brief record one sboot erase or program, cycles is the busy time
+ */
+void telemetry_erase(uint32_t address, uint32_t cycles, uint8_t retries, bool failed);
+void telemetry_program(uint32_t len, uint32_t cycles, uint8_t retries, bool failed);
+
+/**
+ * @brief write what changed to the key-value store, before leaving sboot
+ */
+void telemetry_save(void);
+
+END_DECLS
+
+#endif /* _TELEMETRY_H_ */
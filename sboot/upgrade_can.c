@@ -0,0 +1,597 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "upgrade_can.h"
+#include "upgrade_flash.h"
+#include "flash_map.h"
+#include "stm32f10x.h"
+#include "delay.h"
+#include "crc32.h"
+#include "sched.h"
+#include "storage.h"
+#include "clock.h"
+#define __TRACE_MODULE  "[can]"
+#include "trace.h"
+
+/* needs the scheduler, not in the minimal build */
+#ifndef __ENABLE_MINIMAL_BUILD
+
+#define CAN_MAX_BLOCKS              (UPGRADE_IMAGE_SIZE / FLASH_BLOCK_SIZE)
+#define CAN_CHUNKS_PER_BLOCK        (FLASH_BLOCK_SIZE / CAN_CHUNK_SIZE)
+#define CAN_BLOCK_NONE              0xffffffff
+#define CAN_BUFFER_NONE             0xff
+#define CAN_UID_ADDR                0x1ffff7e8
+
+typedef struct
+{
+    bool started;
+    uint16_t node_id;
+    uint32_t image_size;
+    uint32_t checksum;
+    uint32_t block_count;
+    uint32_t block;
+    uint32_t chunk_count;
+    uint32_t received[(CAN_MAX_BLOCKS + 31) / 32];
+    uint32_t chunks[CAN_CHUNKS_PER_BLOCK / 32];
+    uint8_t signature[64];
+    /* buffer being filled, complete ones wait in the queue for staging */
+    uint8_t fill;
+    /* a task owns the staging area, nested tasks keep off the flash */
+    bool staging;
+    /* next staging erase unit to pre-erase while the queue is empty */
+    uint32_t prepare;
+    bool done;
+    bool staged;
+    uint32_t buffer_block[CAN_BLOCK_BUFFERS];
+    uint8_t queue_items[CAN_BLOCK_BUFFERS];
+    sched_queue_t queue;
+    uint8_t buffers[CAN_BLOCK_BUFFERS][FLASH_BLOCK_SIZE];
+} can_session_t;
+
+static can_session_t session;
+
+/**
+ * @brief bit timing that divides pclk1 exactly: 18 quanta on the 36MHz hse
+ *        pll, 16 on the 32MHz hsi pll and on the 8MHz hsi. sjw is as wide as
+ *        the phase segment allows, it still covers only about 1% of clock
+ *        error, hsi drifts further
+ */
+static bool can_bit_timing(uint32_t pclk1, CAN_InitTypeDef *pinit)
+{
+    if (0 == pclk1 % (CAN_BITRATE * 18))
+    {
+        /* sample point at 77% */
+        pinit->CAN_BS1 = CAN_BS1_13tq;
+        pinit->CAN_BS2 = CAN_BS2_4tq;
+        pinit->CAN_Prescaler = pclk1 / (CAN_BITRATE * 18);
+        pinit->CAN_SJW = CAN_SJW_4tq;
+    }
+    else if (0 == pclk1 % (CAN_BITRATE * 16))
+    {
+        /* sample point at 81% */
+        pinit->CAN_BS1 = CAN_BS1_12tq;
+        pinit->CAN_BS2 = CAN_BS2_3tq;
+        pinit->CAN_Prescaler = pclk1 / (CAN_BITRATE * 16);
+        pinit->CAN_SJW = CAN_SJW_3tq;
+    }
+    else
+    {
+        TRACE("no bit timing for %d bit/s at pclk1 %d", CAN_BITRATE, pclk1);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @param[in] mode: CAN_Mode_Silent never acks or sends error frames, a node
+ *            off the crystal must not disturb the fleet bus
+ */
+static bool can_hw_init(uint8_t mode)
+{
+    GPIO_InitTypeDef GPIO_InitStructure;
+    CAN_InitTypeDef CAN_InitStructure;
+    CAN_FilterInitTypeDef CAN_FilterInitStructure;
+    RCC_ClocksTypeDef clocks;
+
+    /* config pin: RX PA11, TX PA12 */
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA | RCC_APB2Periph_AFIO, ENABLE);
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_11;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IPU;
+    GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_12;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+    GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_CAN1, ENABLE);
+    CAN_DeInit(CAN1);
+    CAN_StructInit(&CAN_InitStructure);
+    CAN_InitStructure.CAN_ABOM = ENABLE;
+    CAN_InitStructure.CAN_TXFP = ENABLE;
+    CAN_InitStructure.CAN_Mode = mode;
+    RCC_GetClocksFreq(&clocks);
+    if (!can_bit_timing(clocks.PCLK1_Frequency, &CAN_InitStructure))
+    {
+        return false;
+    }
+    CAN_Init(CAN1, &CAN_InitStructure);
+
+    /* accept every frame into fifo 0 */
+    CAN_FilterInitStructure.CAN_FilterNumber = 0;
+    CAN_FilterInitStructure.CAN_FilterMode = CAN_FilterMode_IdMask;
+    CAN_FilterInitStructure.CAN_FilterScale = CAN_FilterScale_32bit;
+    CAN_FilterInitStructure.CAN_FilterIdHigh = 0;
+    CAN_FilterInitStructure.CAN_FilterIdLow = 0;
+    CAN_FilterInitStructure.CAN_FilterMaskIdHigh = 0;
+    CAN_FilterInitStructure.CAN_FilterMaskIdLow = 0;
+    CAN_FilterInitStructure.CAN_FilterFIFOAssignment = CAN_Filter_FIFO0;
+    CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
+    CAN_FilterInit(&CAN_FilterInitStructure);
+    return true;
+}
+
+static bool can_receive(CanRxMsg *pmsg, uint32_t timeout_ms)
+{
+    uint32_t deadline = delay_deadline(timeout_ms * 1000);
+    while (0 == CAN_MessagePending(CAN1, CAN_FIFO0))
+    {
+        if (delay_expired(deadline))
+        {
+            return false;
+        }
+    }
+
+    CAN_Receive(CAN1, CAN_FIFO0, pmsg);
+    return true;
+}
+
+static void can_send(uint8_t cmd, uint32_t arg, const uint8_t *pdata, uint8_t len)
+{
+    CanTxMsg msg;
+    msg.ExtId = ((uint32_t)cmd << CAN_CMD_SHIFT) | (arg & CAN_ARG_MASK);
+    msg.IDE = CAN_Id_Extended;
+    msg.RTR = CAN_RTR_Data;
+    msg.DLC = len;
+    memcpy(msg.Data, pdata, len);
+    while (CAN_TxStatus_NoMailBox == CAN_Transmit(CAN1, &msg));
+}
+
+static bool bit_test(const uint32_t *pmap, uint32_t bit)
+{
+    return 0 != (pmap[bit / 32] & (1ul << (bit % 32)));
+}
+
+static void bit_set(uint32_t *pmap, uint32_t bit)
+{
+    pmap[bit / 32] |= (1ul << (bit % 32));
+}
+
+static uint32_t block_chunks(uint32_t block)
+{
+    uint32_t remain = session.image_size - block * FLASH_BLOCK_SIZE;
+    if (remain >= FLASH_BLOCK_SIZE)
+    {
+        return CAN_CHUNKS_PER_BLOCK;
+    }
+
+    return (remain + CAN_CHUNK_SIZE - 1) / CAN_CHUNK_SIZE;
+}
+
+static uint32_t block_missing_count(void)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < session.block_count; ++i)
+    {
+        if (!bit_test(session.received, i))
+        {
+            count ++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief buffer for a new block, the one being filled is reused
+ */
+static uint8_t buffer_take(void)
+{
+    if (CAN_BUFFER_NONE != session.fill)
+    {
+        return session.fill;
+    }
+
+    for (uint8_t i = 0; i < CAN_BLOCK_BUFFERS; ++i)
+    {
+        if (CAN_BLOCK_NONE == session.buffer_block[i])
+        {
+            return i;
+        }
+    }
+
+    return CAN_BUFFER_NONE;
+}
+
+static bool block_queued(uint32_t block)
+{
+    for (uint8_t i = 0; i < CAN_BLOCK_BUFFERS; ++i)
+    {
+        if (block == session.buffer_block[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief nothing waits for or is in staging
+ */
+static bool stage_idle(void)
+{
+    return (0 == session.queue.count) && !session.staging;
+}
+
+static uint32_t unit_blocks(void)
+{
+    return MAX(slot_staging.pdev->erase_size / FLASH_BLOCK_SIZE, 1);
+}
+
+/**
+ * @brief staging erases without stalling reception and units are left to erase
+ */
+static bool prepare_pending(void)
+{
+    return session.started && (0 != (slot_staging.pdev->caps & STORAGE_CAP_RWW)) &&
+           (session.prepare * unit_blocks() < session.block_count);
+}
+
+/**
+ * @brief erase the next unit that holds no received, queued or filling block,
+ *        staging a block into it later skips the erase
+ */
+static void block_prepare_next(void)
+{
+    uint32_t first = session.prepare * unit_blocks();
+    uint32_t last = MIN(first + unit_blocks(), session.block_count);
+    session.prepare ++;
+    for (uint32_t block = first; block < last; ++block)
+    {
+        if (bit_test(session.received, block) || block_queued(block) || (block == session.block))
+        {
+            return;
+        }
+    }
+
+    flash_image_block_prepare(first);
+}
+
+static void session_start(const CanRxMsg *pmsg)
+{
+    uint32_t image_size = pmsg->Data[0] | (pmsg->Data[1] << 8) |
+                          (pmsg->Data[2] << 16) | ((uint32_t)pmsg->Data[3] << 24);
+    uint32_t checksum = pmsg->Data[4] | (pmsg->Data[5] << 8) |
+                        (pmsg->Data[6] << 16) | ((uint32_t)pmsg->Data[7] << 24);
+    if ((0 == image_size) || (image_size > UPGRADE_IMAGE_SIZE))
+    {
+        TRACE("image size %d not supported", image_size);
+        return;
+    }
+
+    /* START is repeated while nodes come up, keep what we already have */
+    if (session.started && (session.image_size == image_size) &&
+        (session.checksum == checksum))
+    {
+        return;
+    }
+
+    memset(session.received, 0, sizeof(session.received));
+    memset(session.signature, 0, sizeof(session.signature));
+    session.started = true;
+    session.image_size = image_size;
+    session.checksum = checksum;
+    session.block_count = (image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    session.block = CAN_BLOCK_NONE;
+    session.fill = CAN_BUFFER_NONE;
+    session.prepare = 0;
+    TRACE("session start, size %d, blocks %d", image_size, session.block_count);
+
+    /* staged area is going to change, drop the old header first */
+    flash_image_header_erase();
+}
+
+static void block_store(uint8_t index)
+{
+    uint32_t block = session.buffer_block[index];
+    FLASH_Status status = flash_image_block_stage(block, session.buffers[index]);
+    if (FLASH_COMPLETE == status)
+    {
+        bit_set(session.received, block);
+    }
+    else
+    {
+        TRACE("store block %d failed: %d", block, status);
+    }
+    session.buffer_block[index] = CAN_BLOCK_NONE;
+}
+
+static void session_data(const CanRxMsg *pmsg)
+{
+    uint32_t block = (pmsg->ExtId >> 8) & 0xffff;
+    uint32_t chunk = pmsg->ExtId & 0xff;
+    if (!session.started || (block >= session.block_count) ||
+        bit_test(session.received, block) || block_queued(block) ||
+        (chunk >= block_chunks(block)))
+    {
+        return;
+    }
+
+    if (block != session.block)
+    {
+        /* every buffer waits for staging, the block becomes a gap */
+        session.fill = buffer_take();
+        if (CAN_BUFFER_NONE == session.fill)
+        {
+            session.block = CAN_BLOCK_NONE;
+            return;
+        }
+
+        /* an unfinished block becomes a gap, the host resends it later */
+        session.block = block;
+        session.chunk_count = 0;
+        memset(session.chunks, 0, sizeof(session.chunks));
+        memset(session.buffers[session.fill], 0xff, FLASH_BLOCK_SIZE);
+    }
+
+    if (!bit_test(session.chunks, chunk))
+    {
+        memcpy(session.buffers[session.fill] + chunk * CAN_CHUNK_SIZE, pmsg->Data,
+               MIN(pmsg->DLC, CAN_CHUNK_SIZE));
+        bit_set(session.chunks, chunk);
+        session.chunk_count ++;
+        if (session.chunk_count == block_chunks(block))
+        {
+            /* a free buffer always has room in the queue */
+            session.buffer_block[session.fill] = block;
+            sched_queue_push(&session.queue, session.fill);
+            session.fill = CAN_BUFFER_NONE;
+            session.block = CAN_BLOCK_NONE;
+        }
+    }
+}
+
+static void session_query(const CanRxMsg *pmsg)
+{
+    uint16_t node_id = pmsg->ExtId & 0xffff;
+    if ((node_id != session.node_id) && (CAN_NODE_ALL != node_id))
+    {
+        return;
+    }
+
+    uint32_t frames = (session.block_count + 63) / 64;
+    uint8_t data[8];
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        memset(data, 0, sizeof(data));
+        for (uint32_t j = 0; j < 64; ++j)
+        {
+            uint32_t block = i * 64 + j;
+            if ((block < session.block_count) && !bit_test(session.received, block))
+            {
+                data[j / 8] |= (1 << (j % 8));
+            }
+        }
+        can_send(CAN_CMD_MISSING, ((uint32_t)session.node_id << 8) | i, data, 8);
+    }
+}
+
+static bool session_commit(void)
+{
+    if (!session.started || (0 != block_missing_count()))
+    {
+        return false;
+    }
+
+    uint32_t checksum = flash_image_staged_checksum(session.image_size);
+    if (checksum != session.checksum)
+    {
+        TRACE("checksum not matched: 0x%08x-0x%08x", checksum, session.checksum);
+        /* receive everything again */
+        memset(session.received, 0, sizeof(session.received));
+        return false;
+    }
+
+    flash_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.checksum = session.checksum;
+    header.image_size = session.image_size;
+    header.flags = 0;
+    header.not_obsolete = 1;
+    memcpy(header.signature, session.signature, sizeof(header.signature));
+    if (FLASH_COMPLETE != flash_image_header_write(&header))
+    {
+        TRACE("header write failed!");
+        return false;
+    }
+    flash_image_manifest_write(session.image_size);
+    TRACE("image staged");
+    return true;
+}
+
+static void session_sign(const CanRxMsg *pmsg)
+{
+    uint32_t index = pmsg->ExtId & 0xff;
+    if (session.started && (index < sizeof(session.signature) / CAN_CHUNK_SIZE))
+    {
+        memcpy(session.signature + index * CAN_CHUNK_SIZE, pmsg->Data,
+               MIN(pmsg->DLC, CAN_CHUNK_SIZE));
+    }
+}
+
+static uint8_t session_command(const CanRxMsg *pmsg)
+{
+    return (pmsg->ExtId >> CAN_CMD_SHIFT) & CAN_CMD_MASK;
+}
+
+static bool session_process(const CanRxMsg *pmsg)
+{
+    if (CAN_Id_Extended != pmsg->IDE)
+    {
+        return false;
+    }
+
+    switch (session_command(pmsg))
+    {
+    case CAN_CMD_START:
+        session_start(pmsg);
+        break;
+    case CAN_CMD_DATA:
+        session_data(pmsg);
+        break;
+    case CAN_CMD_QUERY:
+        session_query(pmsg);
+        break;
+    case CAN_CMD_COMMIT:
+        return session_commit();
+    case CAN_CMD_SIGN:
+        session_sign(pmsg);
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+bool can_upgrade_detect(uint32_t listen_ms)
+{
+    CanRxMsg msg;
+    if (!can_hw_init((CLOCK_STATE_PLL_HSE == clock_state()) ? CAN_Mode_Normal : CAN_Mode_Silent))
+    {
+        return false;
+    }
+
+    memset(&session, 0, sizeof(session));
+    memset(session.buffer_block, 0xff, sizeof(session.buffer_block));
+    sched_queue_init(&session.queue, session.queue_items, CAN_BLOCK_BUFFERS);
+    session.fill = CAN_BUFFER_NONE;
+    session.node_id = crc32(0, (const uint8_t *)CAN_UID_ADDR, 12) & 0xffff;
+    if (CAN_NODE_ALL == session.node_id)
+    {
+        session.node_id = 0;
+    }
+
+    for (uint32_t i = 0; i < listen_ms; ++i)
+    {
+        if (can_receive(&msg, 1) && (CAN_Id_Extended == msg.IDE) &&
+            (CAN_CMD_START == session_command(&msg)))
+        {
+            TRACE("fleet upgrade detected, node 0x%04x", session.node_id);
+            session_start(&msg);
+            /* off the bus while the caller raises the clock, START is repeated */
+            CAN_OperatingModeRequest(CAN1, CAN_OperatingMode_Initialization);
+            return session.started;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief drain the can fifo, it also runs while staging waits on the flash
+ */
+static PT_THREAD(rx_task(pt_t *pt))
+{
+    static CanRxMsg msg;
+    static uint32_t deadline;
+    PT_BEGIN(pt);
+    deadline = delay_deadline(CAN_IDLE_TIMEOUT_MS * 1000);
+    while (!session.done)
+    {
+        PT_WAIT_UNTIL(pt, (0 != CAN_MessagePending(CAN1, CAN_FIFO0)) || delay_expired(deadline));
+        if (0 == CAN_MessagePending(CAN1, CAN_FIFO0))
+        {
+            TRACE("bus idle, %d blocks still missing", block_missing_count());
+            session.done = true;
+            break;
+        }
+
+        CAN_Receive(CAN1, CAN_FIFO0, &msg);
+        deadline = delay_deadline(CAN_IDLE_TIMEOUT_MS * 1000);
+        /* these touch the staging area, let queued blocks land first */
+        if ((CAN_CMD_START == session_command(&msg)) || (CAN_CMD_COMMIT == session_command(&msg)))
+        {
+            PT_WAIT_UNTIL(pt, stage_idle());
+            /* stage_task runs inside our flash waits, keep it off the staging area */
+            session.staging = true;
+            session.staged = session_process(&msg);
+            session.staging = false;
+        }
+        else
+        {
+            session.staged = session_process(&msg);
+        }
+        session.done = session.done || session.staged;
+    }
+    PT_END(pt);
+}
+
+static PT_THREAD(stage_task(pt_t *pt))
+{
+    static uint8_t index;
+    PT_BEGIN(pt);
+    while (!session.done)
+    {
+        /* rx_task may hold the staging area, it waits on the flash with us nested */
+        PT_WAIT_UNTIL(pt, (!session.staging && ((0 != session.queue.count) || prepare_pending())) ||
+                      session.done);
+        if (sched_queue_pop(&session.queue, &index))
+        {
+            session.staging = true;
+            block_store(index);
+            session.staging = false;
+        }
+        else if (prepare_pending())
+        {
+            session.staging = true;
+            block_prepare_next();
+            session.staging = false;
+            PT_YIELD(pt);
+        }
+    }
+    PT_END(pt);
+}
+
+static sched_task_t can_tasks[] =
+{
+    {"rx", rx_task, {0}, false, false, 0},
+    {"stage", stage_task, {0}, false, false, 0},
+};
+
+bool can_upgrade_run(void)
+{
+    /* the session acks and answers on the bus, only with the crystal */
+    if (CLOCK_STATE_PLL_HSE != clock_state())
+    {
+        TRACE("no hse, can session refused");
+        return false;
+    }
+
+    /* bit timing follows the clock the session runs at */
+    if (!can_hw_init(CAN_Mode_Normal))
+    {
+        return false;
+    }
+
+    sched_run(can_tasks, N_ELEMENTS(can_tasks));
+    return session.staged;
+}
+#endif
@@ -0,0 +1,97 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _UPGRADE_CAN_H_
+#define _UPGRADE_CAN_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * CAN fleet upgrade protocol, 29-bit extended identifiers:
+ *
+ *   [28:24] command
+ *   [23:0]  argument
+ *
+ * START   host -> all    arg: 0, data: image size(4), checksum(4)
+ * DATA    host -> all    arg: block << 8 | chunk, data: 8 image bytes
+ * QUERY   host -> node   arg: node id, CAN_NODE_ALL queries every node
+ * MISSING node -> host   arg: node id << 8 | index, data: 64 bit missing
+ *                        block bitmap, bit n is block (index * 64 + n)
+ * COMMIT  host -> all    arg: 0, complete nodes stage the image and reboot
+ * SIGN    host -> all    arg: index 0-7, data: signature bytes index * 8,
+ *                        only needed with __ENABLE_SIGNED_IMAGE
+ *
+ * The host broadcasts every block once, then queries the nodes and only
+ * retransmits the blocks reported missing. Nodes that already hold a block
+ * ignore its retransmission. A node keeps receiving into CAN_BLOCK_BUFFERS
+ * block buffers while earlier blocks are staged, but internal flash stalls
+ * the cpu during a page erase, so the host should leave CAN_BLOCK_GAP_MS
+ * after the last chunk of every block unless staging is on spi flash. Spi
+ * staging erases the units ahead while no block is queued, those blocks
+ * then land without an erase. Nodes erase the staged header on START and
+ * only report a block received once it is staged, so the host also leaves
+ * CAN_BLOCK_GAP_MS after START and before a QUERY. test/can_sim times a
+ * fleet update over this protocol.
+ */
+#define CAN_CMD_SHIFT               24
+#define CAN_CMD_MASK                0x1f
+#define CAN_ARG_MASK                0x00ffffff
+
+#define CAN_CMD_START               0x01
+#define CAN_CMD_DATA                0x02
+#define CAN_CMD_QUERY               0x03
+#define CAN_CMD_MISSING             0x04
+#define CAN_CMD_COMMIT              0x05
+#define CAN_CMD_SIGN                0x06
+
+#define CAN_NODE_ALL                0xffff
+#define CAN_CHUNK_SIZE              8
+#define CAN_BLOCK_GAP_MS            80
+
+/* blocks received ahead of staging, one of them is being filled */
+#ifndef CAN_BLOCK_BUFFERS
+#define CAN_BLOCK_BUFFERS           3
+#endif
+
+/* 16 or 18 quanta per bit must divide pclk1 at 8MHz, 32MHz and 36MHz */
+#ifndef CAN_BITRATE
+#define CAN_BITRATE                 500000
+#endif
+
+/* time to wait for a START broadcast after reset */
+#ifndef CAN_LISTEN_MS
+#define CAN_LISTEN_MS               20
+#endif
+
+/* give up and boot the app when the bus stays silent this long */
+#ifndef CAN_IDLE_TIMEOUT_MS
+#define CAN_IDLE_TIMEOUT_MS         10000
+#endif
+
+/**
+ * @brief init can bus and listen for a fleet upgrade START broadcast, at
+ *        whatever clock runs, silent unless that is the hse pll. the
+ *        controller is left off the bus once START arrived, so the clock can
+ *        change before can_upgrade_run
+ * @param[in] listen_ms: CAN_LISTEN_MS on a normal boot
+ * @return true if an upgrade session is running on the bus
+ */
+bool can_upgrade_detect(uint32_t listen_ms);
+
+/**
+ * @brief join the bus again at the current clock and receive image into
+ *        upgrade area until the host commits it, refused unless the clock
+ *        runs from hse
+ * @return true if a verified image was staged
+ */
+bool can_upgrade_run(void);
+
+END_DECLS
+
+#endif /* _UPGRADE_CAN_H_ */
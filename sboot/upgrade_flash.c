@@ -9,182 +9,640 @@
 #include "upgrade_flash.h"
 #include "trace.h"
 #include "flash_map.h"
-#include "stm32f10x.h"
 #include "crc32.h"
+#include "bkp.h"
+#include "delay.h"
+#include "pipeline.h"
+#ifdef __ENABLE_SIGNED_IMAGE
+#include "sha256.h"
+#include "ed25519.h"
+#include "keys.h"
+#endif
 
-#define FLASH_MAGIC                 0xdeadbeef
 #define FLASH_FAILED_TRY_COUNT      3
 
+/* records in the header slot */
+#define HEADER_MANIFEST_OFFSET      (UPGRADE_IMAGE_MANIFEST_ADDR - UPGRADE_IMAGE_HEADER_ADDR)
+#define HEADER_STATE_OFFSET         (UPGRADE_IMAGE_STATE_ADDR - UPGRADE_IMAGE_HEADER_ADDR)
+#define HEADER_PREERASE_OFFSET      (HEADER_STATE_OFFSET + 4)
+
+#if !UPGRADE_IMAGE_MAPPED
+/**
+ * staging is not memory mapped, blocks go through ram. mapped staging is
+ * programmed straight from the device and needs no buffer
+ */
 static uint8_t image_buffer[FLASH_BLOCK_SIZE];
+/* second buffer, a dma device fills one while the other one is programmed */
+static uint8_t image_buffer_next[FLASH_BLOCK_SIZE];
+#endif
 
 FLASH_Status flash_page_erase(uint32_t address)
 {
-    FLASH_Status status = FLASH_COMPLETE;
-    uint8_t try_count;
-    for (try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+    return storage_internal.erase(address);
+}
+
+FLASH_Status flash_page_write(uint32_t address, const uint8_t *pbuf)
+{
+    return storage_internal.program(address, pbuf, FLASH_BLOCK_SIZE);
+}
+
+uint32_t flash_image_checksum_calc(uint32_t address, uint32_t image_size)
+{
+    /* flash is memory mapped, no need to stage it in ram */
+    return crc32(0, (const uint8_t *)address, image_size);
+}
+
+uint32_t flash_image_app_checksum(const flash_image_header_t *pheader)
+{
+    return pheader->encrypted ? pheader->app_checksum : pheader->checksum;
+}
+
+static void flash_image_header_read(flash_image_header_t *pheader)
+{
+    storage_read(&slot_header, 0, pheader, sizeof(flash_image_header_t));
+}
+
+/**
+ * @brief words in the header slot after the header, state and manifest
+ */
+static uint32_t header_word_read(uint32_t offset)
+{
+    uint32_t value;
+    storage_read(&slot_header, offset, &value, sizeof(value));
+    return value;
+}
+
+static FLASH_Status header_word_write(uint32_t offset, uint32_t value)
+{
+    FLASH_Status status = storage_program(&slot_header, offset, &value, sizeof(value));
+    if (FLASH_COMPLETE != status)
     {
-        status = FLASH_ErasePage(address);
-        if (FLASH_COMPLETE != status)
-        {
-            /* try again */
-            TRACE("erase page 0x%08x failed: %d, retry %d...", address, status, try_count);
-            continue;
-        }
+        TRACE("write header word 0x%08x at 0x%x failed: %d", value, offset, status);
+    }
+
+    return status;
+}
+
+static uint32_t flash_image_state_read(void)
+{
+    return header_word_read(HEADER_STATE_OFFSET);
+}
+
+static FLASH_Status flash_image_state_write(uint32_t state)
+{
+    return header_word_write(HEADER_STATE_OFFSET, state);
+}
+
+/**
+ * @brief staged image still usable as an upgrade or repair source
+ */
+static bool flash_image_current(void)
+{
+    return (FLASH_PREERASE_NONE == header_word_read(HEADER_PREERASE_OFFSET));
+}
+
+static uint32_t flash_manifest_entry(uint32_t block)
+{
+    return header_word_read(HEADER_MANIFEST_OFFSET + sizeof(flash_manifest_header_t) +
+                            block * sizeof(uint32_t));
+}
 
-        break;
+/**
+ * @brief manifest is optional, only trust it when it is complete and intact
+ */
+static bool flash_manifest_valid(uint32_t block_count)
+{
+    flash_manifest_header_t manifest;
+    storage_read(&slot_header, HEADER_MANIFEST_OFFSET, &manifest, sizeof(manifest));
+    if ((FLASH_MANIFEST_MAGIC != manifest.magic) || (block_count != manifest.block_count) ||
+        (block_count > FLASH_MANIFEST_MAX_BLOCKS))
+    {
+        return false;
     }
 
+    uint32_t crc_val = storage_checksum(&slot_header, HEADER_MANIFEST_OFFSET + sizeof(flash_manifest_header_t),
+                                        block_count * sizeof(uint32_t));
+    if (crc_val != manifest.checksum)
+    {
+        TRACE("manifest corrupted, ignored");
+        return false;
+    }
+
+    return true;
+}
+
+bool flash_image_check(void)
+{
+    if (!storage_init(&slot_header))
+    {
+        return false;
+    }
+
+    /* read image header */
+    flash_image_header_t header;
+    flash_image_header_read(&header);
+    if (FLASH_MAGIC != header.magic)
+    {
+        TRACE("no valid upgrade image");
+        return false;
+    }
+
+    if (!header.not_obsolete)
+    {
+        TRACE("upgrade image obsoleted!");
+        return false;
+    }
+
+    uint32_t state = flash_image_state_read();
+    if (FLASH_STATE_CORRUPT == state)
+    {
+        TRACE("upgrade image corrupted!");
+        return false;
+    }
+
+    /* applied, or staging already erased */
+    if (((FLASH_STATE_UNKNOWN != state) && (FLASH_STATE_VERIFIED != state)) || !flash_image_current())
+    {
+        return false;
+    }
+
+    TRACE("valid upgrade image find, size %d", header.image_size);
+    return true;
+}
+
+FLASH_Status flash_image_header_write(flash_image_header_t *pheader)
+{
+    pheader->magic = FLASH_MAGIC;
+    FLASH_Status status = storage_erase(&slot_header, 0);
+    if (FLASH_COMPLETE == status)
+    {
+        status = storage_program(&slot_header, 0, pheader, sizeof(flash_image_header_t));
+    }
     return status;
 }
 
-static void flash_page_read(uint32_t address, uint8_t *pbuf)
+void flash_image_header_erase(void)
 {
-    uint32_t *pdata = (uint32_t *)pbuf;
-    for (uint32_t i = 0; i < FLASH_BLOCK_SIZE / 4; ++i)
+    if (storage_init(&slot_header))
     {
-        pdata[i] = *(volatile uint32_t *)(address + i * 4);
+        storage_erase(&slot_header, 0);
     }
 }
 
-FLASH_Status flash_page_write(uint32_t address, uint8_t *pbuf)
+FLASH_Status flash_image_block_stage(uint32_t block, uint8_t *pbuf)
 {
+    uint32_t offset = block * FLASH_BLOCK_SIZE;
+    if (!storage_init(&slot_staging))
+    {
+        return FLASH_ERROR_PG;
+    }
+
     FLASH_Status status = FLASH_COMPLETE;
-    uint32_t *pdata = (uint32_t *)pbuf;
-    uint8_t try_count;
-    for (uint32_t i = 0; i < FLASH_BLOCK_SIZE / 4; ++i)
+    if (storage_blank(&slot_staging, offset, FLASH_BLOCK_SIZE))
     {
-        for (try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+        /* pre-erased or never programmed, nothing to erase */
+    }
+    else if (FLASH_BLOCK_SIZE == slot_staging.pdev->erase_size)
+    {
+        status = storage_erase(&slot_staging, offset);
+    }
+#if !UPGRADE_IMAGE_MAPPED
+    else
+    {
+        /* erase unit holds two blocks, keep the other half when erasing */
+        uint32_t sibling = offset ^ FLASH_BLOCK_SIZE;
+        storage_read(&slot_staging, sibling, image_buffer, FLASH_BLOCK_SIZE);
+        status = storage_erase(&slot_staging, offset);
+        if (FLASH_COMPLETE == status)
         {
-            status = FLASH_ProgramWord(address + i * 4, pdata[i]);
-            if (FLASH_COMPLETE != status)
-            {
-                /* try again */
-                TRACE("write address 0x%08x failed: %d, retry %d...", address + i * 4, status, try_count);
-                continue;
-            }
-
-            break;
+            status = storage_program(&slot_staging, sibling, image_buffer, FLASH_BLOCK_SIZE);
         }
+    }
+#endif
 
-        if (try_count >= FLASH_FAILED_TRY_COUNT)
-        {
-            break;
-        }
+    if (FLASH_COMPLETE == status)
+    {
+        status = storage_program(&slot_staging, offset, pbuf, FLASH_BLOCK_SIZE);
     }
 
     return status;
 }
 
-uint32_t flash_image_checksum_calc(uint32_t address, uint32_t image_size)
+FLASH_Status flash_image_block_prepare(uint32_t block)
+{
+    uint32_t unit = slot_staging.pdev->erase_size;
+    uint32_t offset = (block * FLASH_BLOCK_SIZE) & ~(unit - 1);
+    if (!storage_init(&slot_staging))
+    {
+        return FLASH_ERROR_PG;
+    }
+
+    if (storage_blank(&slot_staging, offset, unit))
+    {
+        return FLASH_COMPLETE;
+    }
+
+    return storage_erase(&slot_staging, offset);
+}
+
+/**
+ * @brief get staged image data, mapped staging is used in place
+ */
+static const uint8_t *flash_image_staged_read(uint32_t offset, uint32_t len)
+{
+    const uint8_t *pdata = storage_map(&slot_staging, offset);
+#if !UPGRADE_IMAGE_MAPPED
+    if (NULL == pdata)
+    {
+        storage_read(&slot_staging, offset, image_buffer, len);
+        pdata = image_buffer;
+    }
+#else
+    UNUSED(len);
+#endif
+
+    return pdata;
+}
+
+uint32_t flash_image_staged_checksum(uint32_t image_size)
 {
-    uint32_t block_count = image_size / FLASH_BLOCK_SIZE;
+    uint32_t crc_val = 0;
+    for (uint32_t offset = 0; offset < image_size; offset += FLASH_BLOCK_SIZE)
+    {
+        uint32_t len = MIN(image_size - offset, FLASH_BLOCK_SIZE);
+        crc_val = crc32(crc_val, flash_image_staged_read(offset, len), len);
+    }
+
+    return crc_val;
+}
+
+void flash_image_manifest_write(uint32_t image_size)
+{
+    uint32_t block_count = (image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    if (block_count > FLASH_MANIFEST_MAX_BLOCKS)
+    {
+        return;
+    }
+
     uint32_t crc_val = 0;
     for (uint32_t i = 0; i < block_count; ++i)
     {
-        for (uint32_t j = 0; j < FLASH_BLOCK_SIZE; ++j)
+        uint32_t offset = i * FLASH_BLOCK_SIZE;
+        uint32_t len = MIN(image_size - offset, FLASH_BLOCK_SIZE);
+        uint32_t entry = crc32(0, flash_image_staged_read(offset, len), len);
+        header_word_write(HEADER_MANIFEST_OFFSET + sizeof(flash_manifest_header_t) +
+                          i * sizeof(uint32_t), entry);
+        crc_val = crc32(crc_val, (const uint8_t *)&entry, sizeof(entry));
+    }
+
+    /* magic goes last, a manifest cut short by a reset is never trusted */
+    header_word_write(HEADER_MANIFEST_OFFSET + 4, block_count);
+    header_word_write(HEADER_MANIFEST_OFFSET + 8, crc_val);
+    header_word_write(HEADER_MANIFEST_OFFSET, FLASH_MANIFEST_MAGIC);
+}
+
+/**
+ * @brief erase and program one app block, with a manifest the block is read
+ *        back and only this block is redone when it does not match
+ * @param[in] erased: an erase of the block was started already, retries
+ *                    erase again
+ */
+static bool flash_block_program(uint32_t offset, const uint8_t *psrc, uint32_t len,
+                                bool verify, uint32_t block_crc, bool erased)
+{
+    for (uint8_t try_count = 0; try_count < FLASH_FAILED_TRY_COUNT; try_count ++)
+    {
+        if (((erased && (0 == try_count)) || (FLASH_COMPLETE == storage_erase(&slot_app, offset))) &&
+            (FLASH_COMPLETE == storage_program(&slot_app, offset, psrc, FLASH_BLOCK_SIZE)) &&
+            (!verify || (block_crc == storage_checksum(&slot_app, offset, len))))
         {
-            image_buffer[j] = *(volatile uint8_t *)(address + i * FLASH_BLOCK_SIZE + j);
+            return true;
         }
-        crc_val = crc32(crc_val, image_buffer, FLASH_BLOCK_SIZE);
-        image_size -= FLASH_BLOCK_SIZE;
+
+        TRACE("program block 0x%08x failed, retry %d...", slot_app.address + offset, try_count);
+    }
+
+    return false;
+}
+
+/**
+ * @brief check staged image before anything is erased, crc and signature
+ *        share one read pass and the verdict is cached in the state record
+ */
+static bool flash_image_preflight(const flash_image_header_t *pheader, bool manifest)
+{
+    /* a retired image is partly erased already */
+    if (!flash_image_current())
+    {
+        TRACE("staged image retired");
+        return false;
+    }
+
+    uint32_t state = flash_image_state_read();
+    if (FLASH_STATE_UNKNOWN != state)
+    {
+        /* an applied image is programmed again to recover the app */
+        return (FLASH_STATE_VERIFIED == state) || (FLASH_STATE_APPLIED == state);
     }
 
-    if (image_size > 0)
+    if ((0 == pheader->image_size) || (pheader->image_size > UPGRADE_IMAGE_SIZE))
     {
-        for (uint32_t i = 0; i < image_size; ++i)
+        TRACE("invalid image size %d", pheader->image_size);
+        flash_image_state_write(FLASH_STATE_CORRUPT);
+        return false;
+    }
+
+    uint32_t crc_val = 0;
+    bool blocks_ok = true;
+#ifdef __ENABLE_SIGNED_IMAGE
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_init(&ctx);
+#endif
+    for (uint32_t offset = 0; offset < pheader->image_size; offset += FLASH_BLOCK_SIZE)
+    {
+        uint32_t len = MIN(pheader->image_size - offset, FLASH_BLOCK_SIZE);
+        const uint8_t *pdata = flash_image_staged_read(offset, len);
+        crc_val = crc32(crc_val, pdata, len);
+#ifdef __ENABLE_SIGNED_IMAGE
+        sha256_update(&ctx, pdata, len);
+#endif
+        /* tells which staged block went bad */
+        if (manifest && (flash_manifest_entry(offset / FLASH_BLOCK_SIZE) != crc32(0, pdata, len)))
         {
-            image_buffer[i] = *(uint8_t *)(address + block_count * FLASH_BLOCK_SIZE + i);
+            TRACE("staged block %d corrupted", offset / FLASH_BLOCK_SIZE);
+            blocks_ok = false;
         }
-        crc_val = crc32(crc_val, image_buffer, image_size);
     }
 
-    return crc_val;
+    bool ret = blocks_ok && (crc_val == pheader->checksum);
+    if (!ret)
+    {
+        TRACE("staged checksum not matched: 0x%08x-0x%08x", crc_val, pheader->checksum);
+    }
+#ifdef __ENABLE_SIGNED_IMAGE
+    sha256_final(&ctx, digest);
+    if (ret && !ed25519_verify(pheader->signature, digest, SHA256_DIGEST_SIZE, image_public_key))
+    {
+        TRACE("image signature invalid!");
+        ret = false;
+    }
+#endif
+
+    /* without the verdict the next boot checks again, a failed CORRUPT write falls back to crc */
+    flash_image_state_write(ret ? FLASH_STATE_VERIFIED : FLASH_STATE_CORRUPT);
+    return ret;
 }
 
-bool flash_image_check(void)
+/**
+ * sink of the upgrade pipeline, programs the app block by block. whole
+ * blocks are programmed straight from the data handed in, the rest is
+ * gathered in sink_buffer
+ */
+#define SINK_OFFSET_NONE            0xffffffff
+
+static uint8_t sink_buffer[PIPE_SINK_BUFFER_SIZE];
+static uint32_t sink_offset;
+static uint32_t sink_size;
+/* block erased in background while the next one is prepared, see STORAGE_CAP_RWW */
+static uint32_t sink_erased;
+static uint32_t sink_fill;
+static uint32_t sink_uptodate;
+/* manifest describes staged blocks, it only applies with no filter in the chain */
+static bool sink_manifest;
+static uint32_t sink_block_crc;
+
+static bool sink_block(const uint8_t *pdata, uint32_t len)
 {
-    /* read image header */
-    flash_image_header_t header = *(flash_image_header_t *)UPGRADE_IMAGE_HEADER_ADDR;
-    if (FLASH_MAGIC != header.magic)
+    uint32_t offset = sink_offset;
+    if (offset + FLASH_BLOCK_SIZE > slot_app.size)
     {
-        TRACE("no valid upgrade image");
+        TRACE("image exceeds app area");
         return false;
     }
+    sink_offset += FLASH_BLOCK_SIZE;
 
-    if (!header.not_obsolete)
+    if (sink_manifest && (sink_block_crc == storage_checksum(&slot_app, offset, len)))
     {
-        TRACE("upgrade image obsoleted!");
+        /* resumed or incremental upgrade, block already holds this data */
+        sink_uptodate ++;
+        return true;
+    }
+
+    TRACE("upgrading block %d, address 0x%08x...", offset / FLASH_BLOCK_SIZE, slot_app.address + offset);
+    if (!flash_block_program(offset, pdata, len, sink_manifest, sink_block_crc, sink_erased == offset))
+    {
+        TRACE("program block %d failed!", offset / FLASH_BLOCK_SIZE);
         return false;
     }
 
-    TRACE("valid upgrade image find, size %d", header.image_size);
+    /* without a manifest every block is programmed, erase the next one while its data is prepared */
+    if (!sink_manifest && (0 != (slot_app.pdev->caps & STORAGE_CAP_RWW)) && (sink_offset < sink_size) &&
+        (FLASH_COMPLETE == storage_erase_start(&slot_app, sink_offset)))
+    {
+        sink_erased = sink_offset;
+    }
+
     return true;
 }
 
-void flash_image_header_write(flash_image_header_t *pheader)
+static bool sink_open(pipe_stage_t *pstage, const flash_image_header_t *pheader)
 {
-    FLASH_Unlock();
-    flash_page_erase(UPGRADE_IMAGE_HEADER_ADDR);
-    pheader->magic = FLASH_MAGIC;
-    uint32_t *pdata = (uint32_t *)pheader;
-    for (uint8_t i = 0; i < sizeof(flash_image_header_t) / sizeof(uint32_t); ++i)
+    UNUSED(pstage);
+    sink_offset = 0;
+    sink_size = pheader->image_size;
+    sink_erased = SINK_OFFSET_NONE;
+    sink_fill = 0;
+    sink_uptodate = 0;
+    /* only flash_image_upgrade has a manifest for the data */
+    sink_manifest = false;
+    return true;
+}
+
+static bool sink_write(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len)
+{
+    UNUSED(pstage);
+    while (len > 0)
     {
-        FLASH_ProgramWord(UPGRADE_IMAGE_HEADER_ADDR + i * sizeof(uint32_t), *pdata);
-        pdata ++;
+        if ((0 == sink_fill) && (len >= FLASH_BLOCK_SIZE))
+        {
+            if (!sink_block(pdata, FLASH_BLOCK_SIZE))
+            {
+                return false;
+            }
+            pdata += FLASH_BLOCK_SIZE;
+            len -= FLASH_BLOCK_SIZE;
+            continue;
+        }
+
+        uint32_t count = MIN(len, FLASH_BLOCK_SIZE - sink_fill);
+        memcpy(sink_buffer + sink_fill, pdata, count);
+        sink_fill += count;
+        pdata += count;
+        len -= count;
+        if (FLASH_BLOCK_SIZE == sink_fill)
+        {
+            sink_fill = 0;
+            if (!sink_block(sink_buffer, FLASH_BLOCK_SIZE))
+            {
+                return false;
+            }
+        }
     }
-    FLASH_Lock();
+
+    return true;
 }
 
+static bool sink_close(pipe_stage_t *pstage)
+{
+    UNUSED(pstage);
+    if (0 == sink_fill)
+    {
+        return true;
+    }
+
+    /* pad the last block with the erased value, it costs nothing to program */
+    uint32_t len = sink_fill;
+    memset(sink_buffer + len, 0xff, FLASH_BLOCK_SIZE - len);
+    sink_fill = 0;
+    return sink_block(sink_buffer, len);
+}
+
+pipe_stage_t sink_stage =
+{
+    "sink",
+    0,
+    sink_open,
+    sink_write,
+    sink_close,
+    NULL,
+    0,
+};
+
 bool flash_image_upgrade(void)
 {
     TRACE("upgrading...");
-    flash_image_header_t *pheader = (flash_image_header_t *)UPGRADE_IMAGE_HEADER_ADDR;
+    flash_image_header_t header;
+    flash_image_header_t *pheader = &header;
+    flash_image_header_read(pheader);
+    if (FLASH_MAGIC != pheader->magic)
+    {
+        TRACE("no valid upgrade image");
+        return false;
+    }
     uint32_t block_count = pheader->image_size / FLASH_BLOCK_SIZE;
     if ((pheader->image_size % FLASH_BLOCK_SIZE) != 0)
     {
         block_count += 1;
     }
+    bool manifest = flash_manifest_valid(block_count);
+    /* keep the current app if the staged one is broken or not ours */
+    if (!flash_image_preflight(pheader, manifest))
+    {
+        return false;
+    }
+
+    pipe_stage_t *phead = pipe_build(pheader->flags, &sink_stage);
+    if ((NULL == phead) || !pipe_open(phead, pheader))
+    {
+        return false;
+    }
+    sink_manifest = manifest && (phead == &sink_stage);
+
     bool ret = true;
-    uint32_t addr = 0;
-    FLASH_Unlock();
+    const uint8_t *psrc;
+    uint32_t start = delay_cycles();
+    flash_skipped_halfwords();
+    flash_app_verdict_invalidate();
+#if !UPGRADE_IMAGE_MAPPED
+    uint8_t *pbuf = image_buffer;
+    uint8_t *pnext = image_buffer_next;
+    bool prefetch = (NULL == storage_map(&slot_staging, 0)) &&
+                    (0 != (slot_staging.pdev->caps & STORAGE_CAP_DMA));
+    if (prefetch)
+    {
+        storage_read_start(&slot_staging, 0, pbuf, MIN(pheader->image_size, FLASH_BLOCK_SIZE));
+    }
+#endif
     for (uint32_t i = 0; i < block_count; ++i)
     {
-        addr = APP_IMAGE_ADDR + i * FLASH_BLOCK_SIZE;
-        TRACE("upgrading block %d, address 0x%08x...", i, addr);
-        /* erase current app page */
-        if (FLASH_COMPLETE != flash_page_erase(addr))
+        uint32_t offset = i * FLASH_BLOCK_SIZE;
+        uint32_t len = MIN(pheader->image_size - offset, FLASH_BLOCK_SIZE);
+#if !UPGRADE_IMAGE_MAPPED
+        if (prefetch)
         {
-            TRACE("erase block %d failed!", i);
-            ret = false;
-            break;
+            storage_read_wait(&slot_staging);
+        }
+#endif
+        /* manifest may share the bus with the prefetch, read it in between */
+        if (sink_manifest)
+        {
+            sink_block_crc = flash_manifest_entry(i);
+        }
+        /* mapped staging is fed straight from the device */
+        psrc = storage_map(&slot_staging, offset);
+#if !UPGRADE_IMAGE_MAPPED
+        if (prefetch)
+        {
+            /* fetch the next block by dma while this one is programmed */
+            if (i + 1 < block_count)
+            {
+                uint32_t next = offset + FLASH_BLOCK_SIZE;
+                storage_read_start(&slot_staging, next, pnext,
+                                   MIN(pheader->image_size - next, FLASH_BLOCK_SIZE));
+            }
+            psrc = pbuf;
         }
-        /* read current page */
-        memset(image_buffer, 0, FLASH_BLOCK_SIZE);
-        flash_page_read(UPGRADE_IMAGE_ADDR + i * FLASH_BLOCK_SIZE, image_buffer);
-        /* write current page */
-        if (FLASH_COMPLETE != flash_page_write(APP_IMAGE_ADDR + i * FLASH_BLOCK_SIZE, image_buffer))
+        else if (NULL == psrc)
+        {
+            storage_read(&slot_staging, offset, pbuf, len);
+            psrc = pbuf;
+        }
+#endif
+        if (!pipe_write(phead, psrc, len))
         {
-            TRACE("write block %d failed!", i);
             ret = false;
             break;
         }
+#if !UPGRADE_IMAGE_MAPPED
+        if (prefetch)
+        {
+            uint8_t *ptemp = pbuf;
+            pbuf = pnext;
+            pnext = ptemp;
+        }
+#endif
+    }
+#if !UPGRADE_IMAGE_MAPPED
+    if (prefetch && !ret)
+    {
+        /* a prefetch may still be running */
+        storage_read_wait(&slot_staging);
     }
-    FLASH_Lock();
+#endif
+    ret = ret && pipe_close(phead);
+    /* the pipeline may have stopped with a background erase running */
+    storage_erase_wait(&slot_app, 0);
+    pipe_report(phead, delay_cycles() - start);
 
     /* check checksum */
-    uint32_t checksum = flash_image_checksum_calc(APP_IMAGE_ADDR, pheader->image_size);
-    if (checksum != pheader->checksum)
+    uint32_t checksum = storage_checksum(&slot_app, 0, pheader->image_size);
+    if (checksum != flash_image_app_checksum(pheader))
     {
-        TRACE("checksum not matched: 0x%08x-0x%08x", checksum, pheader->checksum);
+        TRACE("checksum not matched: 0x%08x-0x%08x", checksum, flash_image_app_checksum(pheader));
         ret = false;
     }
 
     if (ret)
     {
-        TRACE("upgrade image success!");
-        flash_image_header_t header = *pheader;
-        header.not_obsolete = 0;
-        flash_image_header_write(&header);
+        TRACE("upgrade image success, %d erased halfwords skipped, %d blocks up to date",
+              flash_skipped_halfwords(), sink_uptodate);
+        /* keep header and manifest, the scrub checks the app against them */
+        flash_image_state_write(FLASH_STATE_APPLIED);
+#ifdef __ENABLE_APP_SCRUB
+        /* staging stays until a new scrub pass found this app intact */
+        bkp_write(BKP_SCRUB_CLEAN, 0);
+#endif
     }
     else
     {
@@ -194,3 +652,228 @@ bool flash_image_upgrade(void)
 
     return ret;
 }
+
+#ifdef __ENABLE_APP_SCRUB
+void flash_app_scrub(void)
+{
+    if (!storage_init(&slot_staging))
+    {
+        return;
+    }
+
+    /* the manifest describes the app only while the applied image is staged */
+    flash_image_header_t header;
+    flash_image_header_read(&header);
+    uint32_t block_count = (header.image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    if ((FLASH_MAGIC != header.magic) || (FLASH_STATE_APPLIED != flash_image_state_read()) ||
+        !flash_image_current() || !flash_manifest_valid(block_count))
+    {
+        return;
+    }
+
+    /* manifest covers the ciphertext, it says nothing about an encrypted app */
+    if (header.encrypted)
+    {
+        return;
+    }
+
+    uint16_t cursor = bkp_read(BKP_SCRUB_CURSOR);
+    uint16_t clean = bkp_read(BKP_SCRUB_CLEAN);
+    for (uint32_t i = 0; i < SCRUB_PAGES_PER_BOOT; ++i)
+    {
+        uint32_t block = cursor++ % block_count;
+        uint32_t offset = block * FLASH_BLOCK_SIZE;
+        uint32_t len = MIN(header.image_size - offset, FLASH_BLOCK_SIZE);
+        uint32_t block_crc = flash_manifest_entry(block);
+        if (block_crc == storage_checksum(&slot_app, offset, len))
+        {
+            clean = MIN(clean + 1, block_count);
+            continue;
+        }
+
+        clean = 0;
+        TRACE("app block %d corrupted, repairing...", block);
+        const uint8_t *psrc = flash_image_staged_read(offset, FLASH_BLOCK_SIZE);
+        if (block_crc != crc32(0, psrc, len))
+        {
+            TRACE("staged block %d corrupted too!", block);
+            continue;
+        }
+
+        if (!flash_block_program(offset, psrc, len, true, block_crc, false))
+        {
+            TRACE("repair block %d failed!", block);
+        }
+    }
+    bkp_write(BKP_SCRUB_CURSOR, cursor % block_count);
+    bkp_write(BKP_SCRUB_CLEAN, clean);
+}
+#endif
+
+void flash_app_verdict_invalidate(void)
+{
+#ifdef __ENABLE_APP_VERIFY
+    bkp_write(BKP_APP_GENERATION, 0);
+#endif
+}
+
+#ifdef __ENABLE_APP_VERIFY
+/**
+ * @brief any header change, a new image or a new signature, is a new
+ *        generation, never 0
+ */
+static uint16_t flash_app_generation(const flash_image_header_t *pheader)
+{
+    return (uint16_t)crc32(0, (const uint8_t *)pheader, sizeof(flash_image_header_t)) | 0x0001;
+}
+#endif
+
+bool flash_app_verdict_matches(const flash_image_header_t *pheader)
+{
+#ifdef __ENABLE_APP_VERIFY
+    uint32_t app_checksum = flash_image_app_checksum(pheader);
+    return (flash_app_generation(pheader) == bkp_read(BKP_APP_GENERATION)) &&
+           ((app_checksum & 0xffff) == bkp_read(BKP_APP_CRC_LOW)) &&
+           ((app_checksum >> 16) == bkp_read(BKP_APP_CRC_HIGH));
+#else
+    UNUSED(pheader);
+    return false;
+#endif
+}
+
+void flash_app_verdict_write(const flash_image_header_t *pheader)
+{
+#ifdef __ENABLE_APP_VERIFY
+    uint32_t app_checksum = flash_image_app_checksum(pheader);
+    bkp_write(BKP_APP_CRC_LOW, (uint16_t)app_checksum);
+    bkp_write(BKP_APP_CRC_HIGH, (uint16_t)(app_checksum >> 16));
+    bkp_write(BKP_APP_GENERATION, flash_app_generation(pheader));
+#else
+    UNUSED(pheader);
+#endif
+}
+
+#ifdef __ENABLE_APP_VERIFY
+bool flash_app_verify(void)
+{
+    if (!storage_init(&slot_header))
+    {
+        return true;
+    }
+
+    /* nothing to check against unless the app came from the staged image */
+    flash_image_header_t header;
+    flash_image_header_read(&header);
+    if ((FLASH_MAGIC != header.magic) || (header.image_size > APP_IMAGE_SIZE) ||
+        (FLASH_STATE_APPLIED != flash_image_state_read()))
+    {
+        return true;
+    }
+
+    if (flash_app_verdict_matches(&header))
+    {
+        return true;
+    }
+
+    uint32_t checksum = storage_checksum(&slot_app, 0, header.image_size);
+    uint32_t app_checksum = flash_image_app_checksum(&header);
+    if (checksum != app_checksum)
+    {
+        TRACE("app checksum not matched: 0x%08x-0x%08x", checksum, app_checksum);
+        flash_app_verdict_invalidate();
+        return false;
+    }
+
+    flash_app_verdict_write(&header);
+    TRACE("app verified");
+    return true;
+}
+#endif
+
+#ifdef __ENABLE_STAGING_PREERASE
+/**
+ * @brief scrub and verify repair the app from the staged image, it stays
+ *        until the scrub went once over the whole app without a repair and
+ *        the verdict for this image is cached
+ */
+static bool flash_image_needed(const flash_image_header_t *pheader)
+{
+#ifdef __ENABLE_APP_SCRUB
+    /* the scrub skips images without a manifest of the plain app */
+    uint32_t block_count = (pheader->image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    if (!pheader->encrypted && flash_manifest_valid(block_count) &&
+        (bkp_read(BKP_SCRUB_CLEAN) < block_count))
+    {
+        return true;
+    }
+#endif
+#ifdef __ENABLE_APP_VERIFY
+    if (flash_app_generation(pheader) != bkp_read(BKP_APP_GENERATION))
+    {
+        return true;
+    }
+#endif
+    UNUSED(pheader);
+    return false;
+}
+
+void flash_staging_preerase(void)
+{
+    if (!storage_init(&slot_header))
+    {
+        return;
+    }
+
+    flash_image_header_t header;
+    flash_image_header_read(&header);
+    if ((FLASH_MAGIC != header.magic) || (header.image_size > slot_staging.size) ||
+        (FLASH_STATE_APPLIED != flash_image_state_read()))
+    {
+        return;
+    }
+
+    uint32_t preerase = header_word_read(HEADER_PREERASE_OFFSET);
+    if (FLASH_PREERASE_NONE == preerase)
+    {
+        if (flash_image_needed(&header))
+        {
+            return;
+        }
+
+        /* nothing is erased unless the image is retired for sure */
+        if (FLASH_COMPLETE != header_word_write(HEADER_PREERASE_OFFSET, FLASH_PREERASE_RETIRED))
+        {
+            return;
+        }
+        bkp_write(BKP_PREERASE_CURSOR, 0);
+    }
+    else if (FLASH_PREERASE_RETIRED != preerase)
+    {
+        return;
+    }
+
+    /* only the units the image used, a lost cursor costs one blank scan */
+    uint32_t unit = slot_staging.pdev->erase_size;
+    uint32_t unit_count = (header.image_size + unit - 1) / unit;
+    uint32_t cursor = bkp_read(BKP_PREERASE_CURSOR);
+    for (uint32_t budget = PREERASE_PAGES_PER_BOOT; (cursor < unit_count) && (budget > 0); cursor ++)
+    {
+        if (!storage_blank(&slot_staging, cursor * unit, unit))
+        {
+            /* a failed unit is tried again next boot */
+            if (FLASH_COMPLETE != storage_erase(&slot_staging, cursor * unit))
+            {
+                break;
+            }
+            budget --;
+        }
+    }
+
+    if ((cursor >= unit_count) &&
+        (FLASH_COMPLETE == header_word_write(HEADER_PREERASE_OFFSET, FLASH_PREERASE_BLANK)))
+    {
+        TRACE("staging area blank");
+    }
+    bkp_write(BKP_PREERASE_CURSOR, (uint16_t)cursor);
+}
+#endif
@@ -10,10 +10,61 @@
 
 #include "types.h"
 #include "stm32f10x_flash.h"
+#include "flash_map.h"
+#include "storage.h"
 
 BEGIN_DECLS
 
 #define FLASH_BLOCK_SIZE            2048
+#define FLASH_MAGIC                 0xdeadbeef
+
+/* header flags that add a stage to the upgrade pipeline */
+#define FLASH_FLAG_ENCRYPTED        0x00000002
+#define FLASH_FLAG_TRANSFORMS       (FLASH_FLAG_ENCRYPTED)
+
+/* staged image verdict, programmed once without erase */
+#define FLASH_STATE_UNKNOWN         0xffffffff
+#define FLASH_STATE_VERIFIED        0x5aa55aa5
+#define FLASH_STATE_CORRUPT         0x00000000
+/* programmed over VERIFIED once the app holds the staged image */
+#define FLASH_STATE_APPLIED         0x5aa50000
+
+/**
+ * staging erase progress in the word after the state, see flash_staging_preerase.
+ * internal flash programs a halfword only from 0xffff or to 0, so every step
+ * clears a whole halfword
+ */
+#define FLASH_PREERASE_NONE         0xffffffff
+/* the staged image no longer serves an upgrade or the scrub */
+#define FLASH_PREERASE_RETIRED      0xffff0000
+/* staging is erased, the header stays for flash_app_verify */
+#define FLASH_PREERASE_BLANK        0x00000000
+
+/* app pages checked against the manifest on every boot, see flash_app_scrub */
+#ifndef SCRUB_PAGES_PER_BOOT
+#define SCRUB_PAGES_PER_BOOT        1
+#endif
+
+/* staging erase units erased per boot, see flash_staging_preerase */
+#ifndef PREERASE_PAGES_PER_BOOT
+#define PREERASE_PAGES_PER_BOOT     4
+#endif
+
+/**
+ * optional manifest at UPGRADE_IMAGE_MANIFEST_ADDR in the header page: this
+ * header followed by one crc32 per FLASH_BLOCK_SIZE block of the image, the
+ * last block only up to image_size. checksum is the crc32 of the crc list.
+ */
+#define FLASH_MANIFEST_MAGIC        0x4d4e4654
+#define FLASH_MANIFEST_MAX_BLOCKS   ((UPGRADE_IMAGE_STATE_ADDR - UPGRADE_IMAGE_MANIFEST_ADDR - \
+                                      sizeof(flash_manifest_header_t)) / sizeof(uint32_t))
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t block_count;
+    uint32_t checksum;
+} flash_manifest_header_t;
 
 typedef struct
 {
@@ -25,20 +76,87 @@ typedef struct
         struct
         {
             uint32_t not_obsolete : 1;
-            uint32_t rfu : 31;
+            uint32_t encrypted : 1;
+            uint32_t rfu : 30;
         };
         uint32_t flags;
     };
+    /* ed25519 signature over the sha-256 of the image, see __ENABLE_SIGNED_IMAGE */
+    uint8_t signature[64];
+    /* encrypted images only: aes-128-ctr initial counter block and crc32 of the plain image */
+    uint8_t nonce[16];
+    uint32_t app_checksum;
 } __PACKED flash_image_header_t;
 
 
 bool flash_image_check(void);
 bool flash_image_upgrade(void);
 FLASH_Status flash_page_erase(uint32_t address);
-FLASH_Status flash_page_write(uint32_t address, uint8_t *pbuf);
-void flash_image_header_write(flash_image_header_t *pheader);
+FLASH_Status flash_page_write(uint32_t address, const uint8_t *pbuf);
+FLASH_Status flash_image_header_write(flash_image_header_t *pheader);
 uint32_t flash_image_checksum_calc(uint32_t address, uint32_t image_size);
 
+/**
+ * @brief crc32 the app has once the image is programmed, checksum covers
+ *        the image as staged, which is the ciphertext of an encrypted one
+ */
+uint32_t flash_image_app_checksum(const flash_image_header_t *pheader);
+
+/**
+ * @brief staged image access, works on any device slot_staging is bound to
+ */
+void flash_image_header_erase(void);
+FLASH_Status flash_image_block_stage(uint32_t block, uint8_t *pbuf);
+
+/**
+ * @brief erase the staging erase unit holding block unless it is blank,
+ *        staging a block into a blank unit skips the erase
+ */
+FLASH_Status flash_image_block_prepare(uint32_t block);
+uint32_t flash_image_staged_checksum(uint32_t image_size);
+
+/**
+ * @brief build the block manifest from the staged image, after the header
+ *        is written since writing the header erases the page
+ */
+void flash_image_manifest_write(uint32_t image_size);
+
+/**
+ * @brief check the next SCRUB_PAGES_PER_BOOT app pages against the manifest
+ *        of the applied image and repair bad ones from staging, the cursor
+ *        is kept in a backup register so every page gets its turn
+ */
+void flash_app_scrub(void);
+
+/**
+ * @brief check the app against the applied image header, a passed check is
+ *        cached in backup registers so warm resets skip the crc, it runs
+ *        again after power loss or when an upgrade invalidates the cache
+ * @return false if the app does not match the image it was upgraded from
+ */
+bool flash_app_verify(void);
+void flash_app_verdict_invalidate(void);
+
+/**
+ * @brief the cached verdict says the app is the image of this header, the
+ *        sd card compares its header here instead of a crc over the app.
+ *        always false without __ENABLE_APP_VERIFY
+ */
+bool flash_app_verdict_matches(const flash_image_header_t *pheader);
+/**
+ * @brief cache that the app was checked against the image of this header
+ */
+void flash_app_verdict_write(const flash_image_header_t *pheader);
+
+/**
+ * @brief erase up to PREERASE_PAGES_PER_BOOT units of the applied image in
+ *        staging, so the next download programs without erasing. It waits
+ *        until a full scrub pass found the app intact and the app verdict
+ *        is cached, then retires the image: from there on flash_app_scrub
+ *        and a failed flash_app_verify can no longer repair the app
+ */
+void flash_staging_preerase(void);
+
 
 END_DECLS
 
@@ -0,0 +1,244 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <string.h>
+#include "upgrade_sdcard.h"
+#include "upgrade_flash.h"
+#include "flash_map.h"
+#include "sdcard.h"
+#include "fat.h"
+#include "storage.h"
+#include "pipeline.h"
+#include "delay.h"
+#include "crc32.h"
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+#include "decrypt.h"
+#endif
+#ifdef __ENABLE_SIGNED_IMAGE
+#include "sha256.h"
+#include "ed25519.h"
+#include "keys.h"
+#endif
+#define __TRACE_MODULE  "[sdcard]"
+#include "trace.h"
+
+#define SD_BLOCK_SECTORS            (FLASH_BLOCK_SIZE / SDCARD_SECTOR_SIZE)
+
+static fat_volume_t volume;
+static fat_file_t file;
+static flash_image_header_t header;
+static pipe_stage_t *image_pipe;
+static uint32_t block_buffer[2][FLASH_BLOCK_SIZE / 4];
+
+/**
+ * @brief read a block of the image, the last contiguous run is left in
+ *        flight and must be finished with sdcard_read_wait
+ */
+static bool sd_block_read_start(uint32_t offset, uint8_t *pbuf, uint32_t len)
+{
+    uint32_t wanted = (len + SDCARD_SECTOR_SIZE - 1) / SDCARD_SECTOR_SIZE;
+    while (wanted > 0)
+    {
+        uint32_t count = wanted;
+        uint32_t sector = fat_map(&file, offset, &count);
+        if (0 == sector)
+        {
+            return false;
+        }
+
+        if (count == wanted)
+        {
+            return sdcard_read_start(sector, pbuf, count);
+        }
+
+        /* fragmented block, read the leading runs synchronously */
+        if (!sdcard_read(sector, pbuf, count))
+        {
+            return false;
+        }
+        offset += count * SDCARD_SECTOR_SIZE;
+        pbuf += count * SDCARD_SECTOR_SIZE;
+        wanted -= count;
+    }
+
+    return false;
+}
+
+static bool sd_image_header_read(flash_image_header_t *pheader)
+{
+    uint8_t *pbuf = (uint8_t *)block_buffer[0];
+    if (!sd_block_read_start(0, pbuf, SDCARD_SECTOR_SIZE) || !sdcard_read_wait())
+    {
+        return false;
+    }
+
+    memcpy(pheader, pbuf, sizeof(flash_image_header_t));
+    return true;
+}
+
+static bool sd_image_verify(const flash_image_header_t *pheader)
+{
+    uint8_t *pbuf = (uint8_t *)block_buffer[0];
+    uint32_t crc_val = 0;
+#ifdef __ENABLE_SIGNED_IMAGE
+    static sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_init(&ctx);
+#endif
+    for (uint32_t offset = 0; offset < pheader->image_size; offset += FLASH_BLOCK_SIZE)
+    {
+        uint32_t len = MIN(pheader->image_size - offset, FLASH_BLOCK_SIZE);
+        if (!sd_block_read_start(SDCARD_IMAGE_OFFSET + offset, pbuf, len) ||
+            !sdcard_read_wait())
+        {
+            return false;
+        }
+        crc_val = crc32(crc_val, pbuf, len);
+#ifdef __ENABLE_SIGNED_IMAGE
+        sha256_update(&ctx, pbuf, len);
+#endif
+    }
+
+    if (crc_val != pheader->checksum)
+    {
+        TRACE("checksum not matched: 0x%08x-0x%08x", crc_val, pheader->checksum);
+        return false;
+    }
+
+#ifdef __ENABLE_SIGNED_IMAGE
+    sha256_final(&ctx, digest);
+    if (!ed25519_verify(pheader->signature, digest, SHA256_DIGEST_SIZE, image_public_key))
+    {
+        TRACE("image signature invalid!");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+/**
+ * @brief the card is the source of the upgrade pipeline, it keeps streaming
+ *        the next block while the stages handle this one
+ */
+static bool sd_image_program(const flash_image_header_t *pheader, pipe_stage_t *phead)
+{
+    uint32_t block_count = (pheader->image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    uint8_t *pbuf = (uint8_t *)block_buffer[0];
+    uint8_t *pnext = (uint8_t *)block_buffer[1];
+    if (!pipe_open(phead, pheader))
+    {
+        return false;
+    }
+    bool ret = sd_block_read_start(SDCARD_IMAGE_OFFSET, pbuf,
+                                   MIN(pheader->image_size, FLASH_BLOCK_SIZE));
+
+    /* staged image no longer matches the app, do not let the scrub use it */
+    flash_image_header_erase();
+    flash_app_verdict_invalidate();
+    flash_skipped_halfwords();
+    uint32_t start = delay_cycles();
+    for (uint32_t i = 0; ret && (i < block_count); ++i)
+    {
+        uint32_t offset = i * FLASH_BLOCK_SIZE;
+        uint32_t len = MIN(pheader->image_size - offset, FLASH_BLOCK_SIZE);
+        if (!sdcard_read_wait())
+        {
+            ret = false;
+            break;
+        }
+
+        if (i + 1 < block_count)
+        {
+            offset += FLASH_BLOCK_SIZE;
+            ret = sd_block_read_start(SDCARD_IMAGE_OFFSET + offset, pnext,
+                                      MIN(pheader->image_size - offset, FLASH_BLOCK_SIZE));
+        }
+
+        if (!pipe_write(phead, pbuf, len))
+        {
+            if (ret && (i + 1 < block_count))
+            {
+                sdcard_read_wait();
+            }
+            ret = false;
+            break;
+        }
+
+        uint8_t *ptemp = pbuf;
+        pbuf = pnext;
+        pnext = ptemp;
+    }
+    ret = ret && pipe_close(phead);
+    /* the pipeline may have stopped with a background erase running */
+    storage_erase_wait(&slot_app, 0);
+    pipe_report(phead, delay_cycles() - start);
+
+    return ret && (flash_image_checksum_calc(APP_IMAGE_ADDR, pheader->image_size) ==
+                   flash_image_app_checksum(pheader));
+}
+
+bool sdcard_probe(void)
+{
+    if (!sdcard_init() || !fat_mount(&volume) ||
+        !fat_open(&volume, SDCARD_IMAGE_NAME, &file) ||
+        !sd_image_header_read(&header))
+    {
+        return false;
+    }
+
+    if ((FLASH_MAGIC != header.magic) || (header.image_size > APP_IMAGE_SIZE) ||
+        (file.size < SDCARD_IMAGE_OFFSET + header.image_size))
+    {
+        TRACE("invalid image file");
+        return false;
+    }
+
+    /* refuse an image this build cannot transform before reading it through */
+    image_pipe = pipe_build(header.flags, &sink_stage);
+    if (NULL == image_pipe)
+    {
+        return false;
+    }
+
+    /* the card stays inserted, only flash an image once, the crc over the app runs after power-on only */
+    return !flash_app_verdict_matches(&header);
+}
+
+bool sdcard_upgrade(void)
+{
+    /* the card was probed at the reset clock, speed its bus up */
+    sdcard_clock_update();
+    if (flash_image_checksum_calc(APP_IMAGE_ADDR, header.image_size) == flash_image_app_checksum(&header))
+    {
+        flash_app_verdict_write(&header);
+        TRACE("app is up to date");
+        return false;
+    }
+
+    /* a card read pass is cheap, never erase the app for a broken or foreign file */
+    if (!sd_image_verify(&header))
+    {
+        return false;
+    }
+
+    TRACE("programming %d bytes from sd card...", header.image_size);
+    bool programmed = sd_image_program(&header, image_pipe);
+#ifdef __ENABLE_ENCRYPTED_IMAGE
+    /* a failed pipeline never closed the decrypt stage */
+    decrypt_wipe();
+#endif
+    if (!programmed)
+    {
+        TRACE("sd card upgrade failed!");
+        return false;
+    }
+
+    flash_app_verdict_write(&header);
+    TRACE("sd card upgrade success, %d erased halfwords skipped", flash_skipped_halfwords());
+    return true;
+}
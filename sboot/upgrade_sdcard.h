@@ -0,0 +1,41 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _UPGRADE_SDCARD_H_
+#define _UPGRADE_SDCARD_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * image file in the root directory of the card, the first sector holds a
+ * flash_image_header_t, the image follows sector aligned
+ */
+#ifndef SDCARD_IMAGE_NAME
+#define SDCARD_IMAGE_NAME           "FIRMWAREBIN"
+#endif
+#define SDCARD_IMAGE_OFFSET         512
+
+/**
+ * @brief look for an image file at whatever clock runs, only the card init
+ *        and the header are read
+ * @return true if the card holds an image the app verdict does not vouch
+ *         for, sdcard_upgrade is to follow
+ */
+bool sdcard_probe(void);
+
+/**
+ * @brief stream the probed image file from sd card into app area, at the
+ *        upgrade clock
+ * @return true if the app was replaced
+ */
+bool sdcard_upgrade(void);
+
+END_DECLS
+
+#endif /* _UPGRADE_SDCARD_H_ */
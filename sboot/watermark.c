@@ -0,0 +1,93 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include "watermark.h"
+#include "stm32f10x.h"
+#define __TRACE_MODULE  "[watermark]"
+#include "trace.h"
+
+#ifdef __ENABLE_WATERMARK
+/* startup_stm32f10x.s, sizes are absolute symbols */
+extern uint32_t Stack_Mem[];
+extern uint32_t Heap_Mem[];
+extern uint8_t Stack_Size[];
+extern uint8_t Heap_Size[];
+/* rw execution region of the uvision generated scatter file */
+extern uint8_t Image$$RW_IRAM1$$Base[];
+extern uint8_t Image$$RW_IRAM1$$ZI$$Limit[];
+
+#define STACK_SIZE                  ((uint32_t)Stack_Size)
+#define HEAP_SIZE                   ((uint32_t)Heap_Size)
+/* room left for the frame of this function while painting */
+#define WATERMARK_MARGIN            64
+
+static uint32_t stack_used(void)
+{
+    uint32_t count = STACK_SIZE / 4;
+    uint32_t i = 0;
+    while ((i < count) && (WATERMARK_PAINT == Stack_Mem[i]))
+    {
+        i ++;
+    }
+
+    return (count - i) * 4;
+}
+
+#ifdef __ENABLE_LEAN_STARTUP
+static uint32_t heap_used(void)
+{
+    uint32_t i = HEAP_SIZE / 4;
+    while ((i > 0) && (WATERMARK_PAINT == Heap_Mem[i - 1]))
+    {
+        i --;
+    }
+
+    return i * 4;
+}
+#endif
+
+/**
+ * @brief paint the free stack again, no interrupt may push below sp meanwhile
+ */
+static void stack_repaint(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t *pend = (uint32_t *)((__get_MSP() - WATERMARK_MARGIN) & ~0x03);
+    for (uint32_t *pword = Stack_Mem; pword < pend; ++pword)
+    {
+        *pword = WATERMARK_PAINT;
+    }
+    __set_PRIMASK(primask);
+}
+
+void watermark_init(void)
+{
+#ifdef __ENABLE_LEAN_STARTUP
+    /* nothing set up the heap, __main would have left allocator state there */
+    for (uint32_t i = 0; i < HEAP_SIZE / 4; ++i)
+    {
+        Heap_Mem[i] = WATERMARK_PAINT;
+    }
+#endif
+    stack_repaint();
+}
+
+void watermark_report(const char *phase)
+{
+    uint32_t statics = (uint32_t)(Image$$RW_IRAM1$$ZI$$Limit - Image$$RW_IRAM1$$Base) - STACK_SIZE - HEAP_SIZE;
+#ifdef __ENABLE_LEAN_STARTUP
+    TRACE("%s: stack %d/%d, heap %d/%d, static %d", phase, stack_used(), STACK_SIZE,
+          heap_used(), HEAP_SIZE, statics);
+#else
+    TRACE("%s: stack %d/%d, heap %d, static %d", phase, stack_used(), STACK_SIZE,
+          HEAP_SIZE, statics);
+#endif
+    UNUSED(statics);
+    stack_repaint();
+}
+#endif
@@ -0,0 +1,38 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _WATERMARK_H_
+#define _WATERMARK_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * ram high-water marks with __ENABLE_WATERMARK: WATERMARK_INIT() paints
+ * the free stack with WATERMARK_PAINT as main starts, __main zeroes it
+ * before that. WATERMARK(phase) traces the peak stack use since the last
+ * report and paints the stack below the current frame again. The heap is
+ * painted and measured with __ENABLE_LEAN_STARTUP only: otherwise the
+ * library init in __main already put allocator state there, so only its
+ * size is traced.
+ */
+#define WATERMARK_PAINT             0xcdcdcdcd
+
+#ifdef __ENABLE_WATERMARK
+void watermark_init(void);
+void watermark_report(const char *phase);
+#define WATERMARK_INIT() watermark_init()
+#define WATERMARK(phase) watermark_report(phase)
+#else
+#define WATERMARK_INIT()
+#define WATERMARK(phase)
+#endif
+
+END_DECLS
+
+#endif /* _WATERMARK_H_ */
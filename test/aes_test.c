@@ -0,0 +1,203 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "aes.h"
+#include "upgrade_flash.h"
+
+/**
+ * aes.c against the FIPS-197 appendix B and C.1 examples and the SP 800-38A
+ * F.5.1 CTR-AES128 vector, ctr mode at odd offsets and over the counter
+ * carry, then host cycles per byte decrypting FLASH_BLOCK_SIZE blocks next
+ * to the time the target takes to program one
+ */
+#define BENCH_SIZE                  (64 * 1024)
+#define BENCH_ROUNDS                7
+/* pm0075 typical, 72MHz core */
+#define TARGET_HALFWORD_PROGRAM_US  52.5
+#define TARGET_MHZ                  72
+
+typedef struct
+{
+    const char *key;
+    const char *plain;
+    const char *cipher;
+} aes_vector_t;
+
+static const aes_vector_t aes_vectors[] =
+{
+    /* fips-197 appendix b */
+    {
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "3243f6a8885a308d313198a2e0370734",
+        "3925841d02dc09fbdc118597196a0b32"
+    },
+    /* fips-197 appendix c.1 */
+    {
+        "000102030405060708090a0b0c0d0e0f",
+        "00112233445566778899aabbccddeeff",
+        "69c4e0d86a7b0430d8cdb78070b4c55a"
+    },
+};
+
+/* sp 800-38a f.5.1 */
+static const char ctr_key[] = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char ctr_counter[] = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+static const char ctr_plain[] =
+    "6bc1bee22e409f96e93d7e117393172a"
+    "ae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52ef"
+    "f69f2445df4f9b17ad2b417be66c3710";
+static const char ctr_cipher[] =
+    "874d6191b620e3261bef6864990db6ce"
+    "9806f66b7970fdff8617187bb9fffdff"
+    "5ae4df3edbd5d35e5b4f09020db03eab"
+    "1e031dda2fbe03d1792170a0f3009cee";
+
+static uint8_t bench_buf[BENCH_SIZE];
+
+static uint32_t unhex(const char *phex, uint8_t *pout)
+{
+    uint32_t len = strlen(phex) / 2;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        unsigned int byte;
+        sscanf(phex + 2 * i, "%2x", &byte);
+        pout[i] = (uint8_t)byte;
+    }
+
+    return len;
+}
+
+static void test_block(void)
+{
+    aes_ctx_t ctx;
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t plain[AES_BLOCK_SIZE];
+    uint8_t cipher[AES_BLOCK_SIZE];
+    uint8_t out[AES_BLOCK_SIZE];
+    for (uint32_t i = 0; i < N_ELEMENTS(aes_vectors); ++i)
+    {
+        unhex(aes_vectors[i].key, key);
+        unhex(aes_vectors[i].plain, plain);
+        unhex(aes_vectors[i].cipher, cipher);
+        aes_init(&ctx, key);
+        aes_encrypt(&ctx, plain, out);
+        host_check(0 == memcmp(out, cipher, sizeof(out)), "aes-128 fips-197 vector %u", i);
+    }
+}
+
+static void test_ctr(void)
+{
+    aes_ctx_t ctx;
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t counter[AES_BLOCK_SIZE];
+    uint8_t plain[64];
+    uint8_t cipher[64];
+    uint8_t buf[64];
+    unhex(ctr_key, key);
+    unhex(ctr_counter, counter);
+    unhex(ctr_plain, plain);
+    unhex(ctr_cipher, cipher);
+    aes_init(&ctx, key);
+
+    memcpy(buf, plain, sizeof(buf));
+    aes_ctr_crypt(&ctx, counter, 0, buf, sizeof(buf));
+    host_check(0 == memcmp(buf, cipher, sizeof(buf)), "ctr-aes128 sp 800-38a f.5.1 encrypt");
+    aes_ctr_crypt(&ctx, counter, 0, buf, sizeof(buf));
+    host_check(0 == memcmp(buf, plain, sizeof(buf)), "ctr-aes128 sp 800-38a f.5.1 decrypt");
+
+    /* pieces at any stream offset, the way blocks arrive */
+    bool ok = true;
+    for (uint32_t round = 0; round < 1000; ++round)
+    {
+        memcpy(buf, cipher, sizeof(buf));
+        for (uint32_t offset = 0; offset < sizeof(buf); )
+        {
+            uint32_t len = host_rand() % 24;
+            len = MIN(len, sizeof(buf) - offset);
+            aes_ctr_crypt(&ctx, counter, offset, buf + offset, len);
+            offset += len;
+        }
+        ok = ok && (0 == memcmp(buf, plain, sizeof(buf)));
+    }
+    host_check(ok, "ctr-aes128 split at random offsets");
+
+    /* counter + 1 carries through all 16 bytes */
+    uint8_t block[AES_BLOCK_SIZE];
+    memset(counter, 0xff, sizeof(counter));
+    memset(buf, 0, 2 * AES_BLOCK_SIZE);
+    aes_ctr_crypt(&ctx, counter, 0, buf, 2 * AES_BLOCK_SIZE);
+    aes_encrypt(&ctx, counter, block);
+    ok = (0 == memcmp(buf, block, AES_BLOCK_SIZE));
+    memset(counter, 0, sizeof(counter));
+    aes_encrypt(&ctx, counter, block);
+    ok = ok && (0 == memcmp(buf + AES_BLOCK_SIZE, block, AES_BLOCK_SIZE));
+    host_check(ok, "ctr-aes128 counter wraps");
+
+    /* and from a block index deep in the image */
+    memset(counter, 0, sizeof(counter));
+    counter[11] = 0xff;
+    counter[12] = 0xff;
+    counter[13] = 0xff;
+    counter[14] = 0xff;
+    counter[15] = 0xff;
+    memset(buf, 0, AES_BLOCK_SIZE);
+    aes_ctr_crypt(&ctx, counter, 0x20 * AES_BLOCK_SIZE, buf, AES_BLOCK_SIZE);
+    memset(counter, 0, sizeof(counter));
+    counter[10] = 0x01;
+    counter[15] = 0x1f;
+    aes_encrypt(&ctx, counter, block);
+    host_check(0 == memcmp(buf, block, AES_BLOCK_SIZE), "ctr-aes128 counter carries from an offset");
+}
+
+static void bench(void)
+{
+    aes_ctx_t ctx;
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t counter[AES_BLOCK_SIZE];
+    unhex(ctr_key, key);
+    unhex(ctr_counter, counter);
+    for (uint32_t i = 0; i < BENCH_SIZE; ++i)
+    {
+        bench_buf[i] = (uint8_t)host_rand();
+    }
+
+    uint64_t best = UINT64_MAX;
+    uint64_t best_ns = UINT64_MAX;
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        uint64_t start_ns = host_ns();
+        uint64_t start = host_cycles();
+        aes_init(&ctx, key);
+        for (uint32_t offset = 0; offset < BENCH_SIZE; offset += FLASH_BLOCK_SIZE)
+        {
+            aes_ctr_crypt(&ctx, counter, offset, bench_buf + offset, FLASH_BLOCK_SIZE);
+        }
+        best = MIN(best, host_cycles() - start);
+        best_ns = MIN(best_ns, host_ns() - start_ns);
+    }
+
+    double program_us = FLASH_BLOCK_SIZE / 2 * TARGET_HALFWORD_PROGRAM_US;
+    printf("aes-128-ctr in %u byte blocks: %llu host cycles/byte, %.1f us/block on the host\n",
+           FLASH_BLOCK_SIZE, (unsigned long long)(best / BENCH_SIZE),
+           (double)best_ns / 1000 / (BENCH_SIZE / FLASH_BLOCK_SIZE));
+    printf("programming a block on the target: %.0f us, %.0f cycles/byte at %uMHz\n",
+           program_us, program_us * TARGET_MHZ / FLASH_BLOCK_SIZE, TARGET_MHZ);
+}
+
+int main(void)
+{
+    host_srand(0xae5128);
+    test_block();
+    test_ctr();
+    bench();
+    return host_exit();
+}
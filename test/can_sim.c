@@ -0,0 +1,838 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "host.h"
+#include "stm32f10x.h"
+#include "upgrade_can.h"
+#include "upgrade_flash.h"
+#include "flash_map.h"
+#include "storage.h"
+#include "sched.h"
+#include "clock.h"
+#include "crc32.h"
+
+/**
+ * discrete event model of a can bus: every node is a forked process running
+ * the real upgrade_can.c and sched.c on simulated time, the host side below
+ * plays the fleet upgrade host and stamps each frame with the time its last
+ * bit leaves the bus, from the stuffed frame length at CAN_BITRATE.
+ *
+ * A node sees a frame once its clock passed the stamp, into a 3 deep fifo
+ * like the bxCAN one, frames arriving at a full fifo are lost. Waiting on
+ * the bus costs SIM_POLL_NS per poll. Internal flash stalls the cpu while
+ * it erases or programs, spi flash leaves it to sched_idle. On top of that
+ * DATA frames are dropped per node at random, START, QUERY and COMMIT are
+ * acknowledged on a real bus and always arrive.
+ *
+ * A node listens for START on the 8MHz HSI and must stay silent there, it
+ * boosts to the HSE pll for the session, without the crystal the session
+ * is refused.
+ *
+ * The host leaves CAN_BLOCK_GAP_MS after START, before every QUERY and,
+ * with internal staging, after every block. Fleet time runs until the last
+ * node staged the image, the serial figure is one node at a time with the
+ * same loss.
+ */
+#define SIM_MAX_NODES               64
+#define SIM_MAX_ROUNDS              32
+#define SIM_UID_ADDR                0x1ffff7e8
+#define SIM_FRAME_FIXED_BITS        13
+#define SIM_MAX_BLOCKS              ((UPGRADE_IMAGE_SIZE / FLASH_BLOCK_SIZE + 63) / 64 * 64)
+#define SIM_FIFO_DEPTH              3
+#define SIM_POLL_NS                 10000ull
+/* stm32f103 datasheet typical, internal flash stalls the cpu */
+#define SIM_PAGE_ERASE_NS           20000000ull
+#define SIM_HALFWORD_PROGRAM_NS     52500ull
+/* typical spi nor, the cpu runs other tasks meanwhile */
+#define SIM_SECTOR_ERASE_NS         45000000ull
+#define SIM_PAGE_PROGRAM_NS         700000ull
+#define SIM_SECTOR_SIZE             4096
+#define SIM_SPI_PAGE_SIZE           256
+/* one block over spi at 36MHz */
+#define SIM_SPI_READ_NS             500000ull
+
+typedef struct
+{
+    uint64_t stamp;
+    uint32_t id;
+    uint8_t dlc;
+    uint8_t data[8];
+} sim_frame_t;
+
+typedef struct
+{
+    uint8_t staged;
+    uint32_t stage_calls;
+    uint32_t prepare_calls;
+    uint32_t erases;
+    uint32_t overruns;
+    uint64_t finish;
+} sim_result_t;
+
+typedef struct
+{
+    uint64_t now;
+    uint32_t frames;
+    uint32_t gaps;
+} sim_bus_t;
+
+/* node side, one of them per process */
+static int node_fd = -1;
+static bool node_eof = false;
+static sim_frame_t node_next;
+static bool node_next_valid = false;
+static sim_frame_t node_fifo[SIM_FIFO_DEPTH];
+static uint8_t node_fifo_count = 0;
+static uint8_t node_staged[UPGRADE_IMAGE_SIZE + FLASH_BLOCK_SIZE];
+/* staging holds the previous image unless it was erased ahead */
+static bool node_blank[UPGRADE_IMAGE_SIZE / FLASH_BLOCK_SIZE + 2];
+static bool node_rww;
+static bool node_silent;
+static uint16_t node_clock = CLOCK_STATE_HSI;
+static uint16_t node_self;
+static sim_result_t node_result;
+static storage_device_t sim_device;
+const storage_slot_t slot_staging = {&sim_device, 0, UPGRADE_IMAGE_SIZE};
+
+/* host side */
+static int host_fd[SIM_MAX_NODES];
+static uint16_t host_node_id[SIM_MAX_NODES];
+static uint32_t host_loss_ppm;
+static sim_bus_t bus;
+
+/**
+ * @brief bits on the wire of an extended data frame, stuff bits included
+ */
+static uint32_t frame_bits(const sim_frame_t *pframe)
+{
+    uint8_t bits[128];
+    uint32_t count = 0;
+    bits[count++] = 0;
+    for (int8_t i = 28; i >= 18; --i)
+    {
+        bits[count++] = (pframe->id >> i) & 1;
+    }
+    /* srr, ide */
+    bits[count++] = 1;
+    bits[count++] = 1;
+    for (int8_t i = 17; i >= 0; --i)
+    {
+        bits[count++] = (pframe->id >> i) & 1;
+    }
+    /* rtr, r1, r0 */
+    bits[count++] = 0;
+    bits[count++] = 0;
+    bits[count++] = 0;
+    for (int8_t i = 3; i >= 0; --i)
+    {
+        bits[count++] = (pframe->dlc >> i) & 1;
+    }
+    for (uint8_t i = 0; i < pframe->dlc; ++i)
+    {
+        for (int8_t j = 7; j >= 0; --j)
+        {
+            bits[count++] = (pframe->data[i] >> j) & 1;
+        }
+    }
+
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        bool next = bits[i] ^ ((crc >> 14) & 1);
+        crc = (crc << 1) & 0x7fff;
+        if (next)
+        {
+            crc ^= 0x4599;
+        }
+    }
+    for (int8_t i = 14; i >= 0; --i)
+    {
+        bits[count++] = (crc >> i) & 1;
+    }
+
+    /* a complement bit after five equal ones, it starts the next run */
+    uint32_t stuffed = count;
+    uint8_t run = 1;
+    uint8_t prev = bits[0];
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        if (bits[i] == prev)
+        {
+            run ++;
+        }
+        else
+        {
+            prev = bits[i];
+            run = 1;
+        }
+
+        if (5 == run)
+        {
+            stuffed ++;
+            prev = !prev;
+            run = 1;
+        }
+    }
+
+    return stuffed + SIM_FRAME_FIXED_BITS;
+}
+
+/* fwlib stand-ins, node side */
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct)
+{
+    UNUSED(GPIOx);
+    UNUSED(GPIO_InitStruct);
+}
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState)
+{
+    UNUSED(RCC_APB1Periph);
+    UNUSED(NewState);
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+    UNUSED(RCC_APB2Periph);
+    UNUSED(NewState);
+}
+
+void RCC_GetClocksFreq(RCC_ClocksTypeDef *RCC_Clocks)
+{
+    memset(RCC_Clocks, 0, sizeof(*RCC_Clocks));
+    RCC_Clocks->SYSCLK_Frequency = SystemCoreClock;
+    RCC_Clocks->HCLK_Frequency = SystemCoreClock;
+    /* apb1 runs at half the pll, undivided on hsi */
+    RCC_Clocks->PCLK1_Frequency = (CLOCK_STATE_HSI == node_clock) ? SystemCoreClock : SystemCoreClock / 2;
+    RCC_Clocks->PCLK2_Frequency = SystemCoreClock;
+}
+
+void CAN_DeInit(CAN_TypeDef *CANx)
+{
+    UNUSED(CANx);
+}
+
+void CAN_StructInit(CAN_InitTypeDef *CAN_InitStruct)
+{
+    memset(CAN_InitStruct, 0, sizeof(*CAN_InitStruct));
+}
+
+uint8_t CAN_Init(CAN_TypeDef *CANx, CAN_InitTypeDef *CAN_InitStruct)
+{
+    UNUSED(CANx);
+    RCC_ClocksTypeDef clocks;
+    RCC_GetClocksFreq(&clocks);
+    uint32_t quanta = 1 + (CAN_InitStruct->CAN_BS1 + 1) + (CAN_InitStruct->CAN_BS2 + 1);
+    if (clocks.PCLK1_Frequency != CAN_InitStruct->CAN_Prescaler * quanta * CAN_BITRATE)
+    {
+        fprintf(stderr, "bit timing off: %u / (%u * %u)\n", clocks.PCLK1_Frequency,
+                CAN_InitStruct->CAN_Prescaler, quanta);
+        exit(2);
+    }
+
+    /* the widest resync the phase segments allow */
+    if (CAN_InitStruct->CAN_SJW != MIN(CAN_InitStruct->CAN_BS2, CAN_SJW_4tq))
+    {
+        fprintf(stderr, "sjw %u tq with bs2 %u tq\n", CAN_InitStruct->CAN_SJW + 1, CAN_InitStruct->CAN_BS2 + 1);
+        exit(2);
+    }
+
+    /* off the crystal a node would ack and flag frames with a drifting bit time */
+    node_silent = (CAN_Mode_Silent == CAN_InitStruct->CAN_Mode);
+    if (!node_silent && (CLOCK_STATE_PLL_HSE != node_clock))
+    {
+        fprintf(stderr, "on the bus without hse, clock state %u\n", node_clock);
+        exit(2);
+    }
+
+    return CAN_InitStatus_Success;
+}
+
+void CAN_FilterInit(CAN_FilterInitTypeDef *CAN_FilterInitStruct)
+{
+    UNUSED(CAN_FilterInitStruct);
+}
+
+uint8_t CAN_OperatingModeRequest(CAN_TypeDef *CANx, uint8_t CAN_OperatingMode)
+{
+    UNUSED(CANx);
+    UNUSED(CAN_OperatingMode);
+    return CAN_ModeStatus_Success;
+}
+
+/**
+ * @brief the host waits for our answer to a QUERY in the fifo, nothing
+ *        comes before it
+ */
+static bool node_answer_pending(void)
+{
+    for (uint8_t i = 0; i < node_fifo_count; ++i)
+    {
+        if ((CAN_CMD_QUERY == ((node_fifo[i].id >> CAN_CMD_SHIFT) & CAN_CMD_MASK)) &&
+            (node_self == (node_fifo[i].id & 0xffff)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief move frames whose last bit went by into the fifo
+ */
+static void node_deliver(void)
+{
+    while (!node_eof)
+    {
+        if (!node_next_valid)
+        {
+            if (node_answer_pending())
+            {
+                break;
+            }
+
+            if (sizeof(node_next) != read(node_fd, &node_next, sizeof(node_next)))
+            {
+                /* the host is done, nothing more comes, timeouts hit at once */
+                node_eof = true;
+                host_time_warp();
+                break;
+            }
+            node_next_valid = true;
+        }
+
+        if (node_next.stamp > host_time())
+        {
+            break;
+        }
+
+        if (node_fifo_count < SIM_FIFO_DEPTH)
+        {
+            node_fifo[node_fifo_count++] = node_next;
+        }
+        else
+        {
+            node_result.overruns ++;
+        }
+        node_next_valid = false;
+    }
+}
+
+uint8_t CAN_MessagePending(CAN_TypeDef *CANx, uint8_t FIFONumber)
+{
+    UNUSED(CANx);
+    UNUSED(FIFONumber);
+    node_deliver();
+    if (0 == node_fifo_count)
+    {
+        host_advance(SIM_POLL_NS);
+    }
+
+    return node_fifo_count;
+}
+
+void CAN_Receive(CAN_TypeDef *CANx, uint8_t FIFONumber, CanRxMsg *RxMessage)
+{
+    while (!CAN_MessagePending(CANx, FIFONumber));
+    memset(RxMessage, 0, sizeof(*RxMessage));
+    RxMessage->IDE = CAN_Id_Extended;
+    RxMessage->RTR = CAN_RTR_Data;
+    RxMessage->ExtId = node_fifo[0].id;
+    RxMessage->DLC = node_fifo[0].dlc;
+    memcpy(RxMessage->Data, node_fifo[0].data, sizeof(node_fifo[0].data));
+    node_fifo_count --;
+    memmove(node_fifo, node_fifo + 1, node_fifo_count * sizeof(node_fifo[0]));
+}
+
+uint8_t CAN_Transmit(CAN_TypeDef *CANx, CanTxMsg *TxMessage)
+{
+    UNUSED(CANx);
+    if (node_silent)
+    {
+        fprintf(stderr, "transmit in silent mode\n");
+        exit(2);
+    }
+
+    sim_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.stamp = host_time();
+    frame.id = TxMessage->ExtId;
+    frame.dlc = TxMessage->DLC;
+    memcpy(frame.data, TxMessage->Data, TxMessage->DLC);
+    if (sizeof(frame) != write(node_fd, &frame, sizeof(frame)))
+    {
+        exit(2);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief device busy for ns, spi flash lets the other tasks run meanwhile
+ */
+static void node_busy(uint64_t ns)
+{
+    if (!node_rww)
+    {
+        host_advance(ns);
+        return;
+    }
+
+    for (uint64_t t = 0; t < ns; t += SIM_POLL_NS)
+    {
+        host_advance(SIM_POLL_NS);
+        sched_idle();
+    }
+}
+
+static void node_erase(uint32_t block)
+{
+    uint32_t blocks = sim_device.erase_size / FLASH_BLOCK_SIZE;
+    uint32_t first = block / blocks * blocks;
+    node_busy(node_rww ? SIM_SECTOR_ERASE_NS : SIM_PAGE_ERASE_NS);
+    for (uint32_t i = first; i < first + blocks; ++i)
+    {
+        node_blank[i] = true;
+    }
+    node_result.erases ++;
+}
+
+static void node_program(uint32_t block)
+{
+    if (node_rww)
+    {
+        node_busy(FLASH_BLOCK_SIZE / SIM_SPI_PAGE_SIZE * SIM_PAGE_PROGRAM_NS);
+    }
+    else
+    {
+        node_busy(FLASH_BLOCK_SIZE / 2 * SIM_HALFWORD_PROGRAM_NS);
+    }
+}
+
+/* staging stand-ins, node side, same erase decisions as upgrade_flash.c */
+void flash_image_header_erase(void)
+{
+    node_busy(node_rww ? SIM_SECTOR_ERASE_NS : SIM_PAGE_ERASE_NS);
+}
+
+/**
+ * @brief storage_blank on the staging area, it reads 64 bytes at a time
+ *        and stops at the first programmed word, the dma wait spins
+ */
+static bool node_blank_check(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        if (node_rww)
+        {
+            host_advance(node_blank[i] ? SIM_SPI_READ_NS : SIM_SPI_READ_NS * 64 / FLASH_BLOCK_SIZE);
+        }
+
+        if (!node_blank[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+FLASH_Status flash_image_block_stage(uint32_t block, uint8_t *pbuf)
+{
+    if (!node_blank_check(block, 1))
+    {
+        uint32_t sibling = block ^ 1;
+        bool keep = (sim_device.erase_size > FLASH_BLOCK_SIZE);
+        bool sibling_blank = node_blank[sibling];
+        node_erase(block);
+        if (keep)
+        {
+            /* the other half of the unit is read and programmed back */
+            host_advance(SIM_SPI_READ_NS);
+            node_program(sibling);
+            node_blank[sibling] = sibling_blank;
+        }
+    }
+
+    node_program(block);
+    node_blank[block] = false;
+    memcpy(node_staged + block * FLASH_BLOCK_SIZE, pbuf, FLASH_BLOCK_SIZE);
+    node_result.stage_calls ++;
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status flash_image_block_prepare(uint32_t block)
+{
+    uint32_t blocks = sim_device.erase_size / FLASH_BLOCK_SIZE;
+    node_result.prepare_calls ++;
+    if (!node_blank_check(block / blocks * blocks, blocks))
+    {
+        node_erase(block);
+    }
+
+    return FLASH_COMPLETE;
+}
+
+uint32_t flash_image_staged_checksum(uint32_t image_size)
+{
+    return crc32(0, node_staged, image_size);
+}
+
+FLASH_Status flash_image_header_write(flash_image_header_t *pheader)
+{
+    UNUSED(pheader);
+    return FLASH_COMPLETE;
+}
+
+void flash_image_manifest_write(uint32_t image_size)
+{
+    UNUSED(image_size);
+}
+
+static void node_uid(uint32_t index, uint8_t *puid)
+{
+    memset(puid, 0, 12);
+    puid[0] = (uint8_t)index;
+    puid[4] = (uint8_t)(index * 37 + 11);
+    puid[8] = 0x5a;
+}
+
+static uint16_t node_id(uint32_t index)
+{
+    uint8_t uid[12];
+    node_uid(index, uid);
+    uint16_t id = crc32(0, uid, sizeof(uid)) & 0xffff;
+    return (CAN_NODE_ALL == id) ? 0 : id;
+}
+
+/* clock.h stand-ins, the crystal always starts on the nodes */
+uint16_t clock_state(void)
+{
+    return node_clock;
+}
+
+uint16_t clock_boost(void)
+{
+    node_clock = CLOCK_STATE_PLL_HSE;
+    SystemCoreClock = 72000000;
+    return node_clock;
+}
+
+static void node_main(uint32_t index, int fd, bool rww)
+{
+    node_fd = fd;
+    node_rww = rww;
+    node_self = node_id(index);
+    node_uid(index, host_map(SIM_UID_ADDR, 12));
+    host_sim_time();
+    /* listen at the reset clock, the session runs on the pll */
+    node_clock = CLOCK_STATE_HSI;
+    SystemCoreClock = 8000000;
+    if (can_upgrade_detect(CAN_IDLE_TIMEOUT_MS))
+    {
+        clock_boost();
+        node_result.staged = can_upgrade_run();
+    }
+
+    node_result.finish = host_time();
+    if (sizeof(node_result) != write(fd, &node_result, sizeof(node_result)))
+    {
+        exit(2);
+    }
+    exit(0);
+}
+
+/* host side */
+static uint64_t frame_ns(const sim_frame_t *pframe)
+{
+    return frame_bits(pframe) * 1000000000ull / CAN_BITRATE;
+}
+
+static void host_send(uint32_t node_count, sim_frame_t *pframe, bool lossy)
+{
+    bus.now += frame_ns(pframe);
+    bus.frames ++;
+    pframe->stamp = bus.now;
+    for (uint32_t i = 0; i < node_count; ++i)
+    {
+        if (lossy && (host_rand() % 1000000 < host_loss_ppm))
+        {
+            continue;
+        }
+
+        if (sizeof(*pframe) != write(host_fd[i], pframe, sizeof(*pframe)))
+        {
+            perror("write");
+            exit(2);
+        }
+    }
+}
+
+static void host_command(uint32_t node_count, uint8_t cmd, uint32_t arg, const uint8_t *pdata, uint8_t len)
+{
+    sim_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = ((uint32_t)cmd << CAN_CMD_SHIFT) | (arg & CAN_ARG_MASK);
+    frame.dlc = len;
+    memcpy(frame.data, pdata, len);
+    host_send(node_count, &frame, false);
+}
+
+static void host_gap(void)
+{
+    bus.now += CAN_BLOCK_GAP_MS * 1000000ull;
+    bus.gaps ++;
+}
+
+static void host_block(uint32_t node_count, const uint8_t *pimage, uint32_t image_size,
+                       uint32_t block, bool gap)
+{
+    uint32_t offset = block * FLASH_BLOCK_SIZE;
+    uint32_t len = MIN(FLASH_BLOCK_SIZE, image_size - offset);
+    for (uint32_t chunk = 0; chunk * CAN_CHUNK_SIZE < len; ++chunk)
+    {
+        sim_frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.id = ((uint32_t)CAN_CMD_DATA << CAN_CMD_SHIFT) | (block << 8) | chunk;
+        frame.dlc = MIN(CAN_CHUNK_SIZE, len - chunk * CAN_CHUNK_SIZE);
+        memcpy(frame.data, pimage + offset + chunk * CAN_CHUNK_SIZE, frame.dlc);
+        host_send(node_count, &frame, true);
+    }
+
+    if (gap)
+    {
+        host_gap();
+    }
+}
+
+/**
+ * @return rounds until every node holds every block, 0 if they never did
+ */
+static uint32_t host_session(uint32_t node_count, const uint8_t *pimage, uint32_t image_size, bool rww)
+{
+    uint32_t block_count = (image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    uint32_t map_frames = (block_count + 63) / 64;
+    static uint8_t resend[SIM_MAX_BLOCKS];
+
+    uint8_t start[8];
+    uint32_t checksum = crc32(0, pimage, image_size);
+    memcpy(start, &image_size, 4);
+    memcpy(start + 4, &checksum, 4);
+    host_command(node_count, CAN_CMD_START, 0, start, sizeof(start));
+    /* nodes erase the staged header */
+    host_gap();
+
+    for (uint32_t block = 0; block < block_count; ++block)
+    {
+        host_block(node_count, pimage, image_size, block, !rww);
+    }
+    if (rww)
+    {
+        /* queued blocks only count as received once staged */
+        host_gap();
+    }
+
+    for (uint32_t round = 1; round <= SIM_MAX_ROUNDS; ++round)
+    {
+        memset(resend, 0, sizeof(resend));
+        bool missing = false;
+        for (uint32_t i = 0; i < node_count; ++i)
+        {
+            host_command(node_count, CAN_CMD_QUERY, host_node_id[i], NULL, 0);
+            for (uint32_t j = 0; j < map_frames; ++j)
+            {
+                sim_frame_t frame;
+                if (sizeof(frame) != read(host_fd[i], &frame, sizeof(frame)))
+                {
+                    fprintf(stderr, "node %u did not answer\n", i);
+                    exit(2);
+                }
+                bus.now = MAX(bus.now, frame.stamp) + frame_ns(&frame);
+                bus.frames ++;
+
+                uint32_t index = frame.id & 0xff;
+                for (uint32_t k = 0; k < 64; ++k)
+                {
+                    if (0 != (frame.data[k / 8] & (1 << (k % 8))))
+                    {
+                        resend[index * 64 + k] = 1;
+                        missing = true;
+                    }
+                }
+            }
+        }
+
+        if (!missing)
+        {
+            host_command(node_count, CAN_CMD_COMMIT, 0, NULL, 0);
+            return round;
+        }
+
+        for (uint32_t block = 0; block < block_count; ++block)
+        {
+            if (resend[block])
+            {
+                host_block(node_count, pimage, image_size, block, !rww);
+            }
+        }
+        if (rww)
+        {
+            host_gap();
+        }
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    uint32_t rounds;
+    uint32_t frames;
+    uint32_t overruns;
+    uint32_t erases;
+    /* s until the last node staged the image, negative if one did not */
+    double seconds;
+} sim_stat_t;
+
+static void sim_run(uint32_t node_count, const uint8_t *pimage, uint32_t image_size,
+                    uint32_t loss_ppm, bool rww, sim_stat_t *pstat)
+{
+    memset(&bus, 0, sizeof(bus));
+    memset(pstat, 0, sizeof(*pstat));
+    host_loss_ppm = loss_ppm;
+    sim_device.erase_size = rww ? SIM_SECTOR_SIZE : FLASH_BLOCK_SIZE;
+    sim_device.caps = rww ? (STORAGE_CAP_DMA | STORAGE_CAP_RWW) : STORAGE_CAP_MAPPED;
+
+    pid_t pids[SIM_MAX_NODES];
+    for (uint32_t i = 0; i < node_count; ++i)
+    {
+        int fds[2];
+        if (0 != socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
+        {
+            perror("socketpair");
+            exit(2);
+        }
+
+        fflush(stdout);
+        pids[i] = fork();
+        if (0 == pids[i])
+        {
+            close(fds[0]);
+            for (uint32_t j = 0; j < i; ++j)
+            {
+                close(host_fd[j]);
+            }
+            node_main(i, fds[1], rww);
+        }
+        close(fds[1]);
+        host_fd[i] = fds[0];
+        host_node_id[i] = node_id(i);
+    }
+
+    pstat->rounds = host_session(node_count, pimage, image_size, rww);
+    pstat->frames = bus.frames;
+
+    bool ok = (0 != pstat->rounds);
+    uint32_t block_count = (image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    uint64_t finish = bus.now;
+    for (uint32_t i = 0; i < node_count; ++i)
+    {
+        /* nodes still waiting for blocks time out once the bus is gone */
+        shutdown(host_fd[i], SHUT_WR);
+        sim_result_t result;
+        /* staged means the node matched the START checksum */
+        if ((sizeof(result) != read(host_fd[i], &result, sizeof(result))) || !result.staged ||
+            (result.stage_calls < block_count) || (rww && (0 == result.prepare_calls)))
+        {
+            ok = false;
+        }
+        finish = MAX(finish, result.finish);
+        pstat->overruns += result.overruns;
+        pstat->erases += result.erases;
+        close(host_fd[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    pstat->erases /= node_count;
+    pstat->seconds = ok ? finish / 1e9 : -1.0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t image_size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100 * 1024 + 100;
+    uint32_t max_nodes = (argc > 2) ? strtoul(argv[2], NULL, 0) : 16;
+    if ((0 == image_size) || (image_size > UPGRADE_IMAGE_SIZE) || (0 == max_nodes) ||
+        (max_nodes > SIM_MAX_NODES))
+    {
+        fprintf(stderr, "usage: %s [image size <= %u] [nodes <= %u]\n", argv[0],
+                UPGRADE_IMAGE_SIZE, SIM_MAX_NODES);
+        return 2;
+    }
+
+    for (uint32_t i = 0; i < max_nodes; ++i)
+    {
+        for (uint32_t j = 0; j < i; ++j)
+        {
+            if (node_id(i) == node_id(j))
+            {
+                fprintf(stderr, "node id clash %u/%u\n", i, j);
+                return 2;
+            }
+        }
+    }
+
+    uint8_t *pimage = malloc(image_size);
+    host_srand(0x5b007);
+    for (uint32_t i = 0; i < image_size; ++i)
+    {
+        pimage[i] = (uint8_t)host_rand();
+    }
+
+    /* the crystal did not start, pll on hsi */
+    node_clock = CLOCK_STATE_PLL_HSI;
+    SystemCoreClock = 64000000;
+    host_check(!can_upgrade_run(), "no can session without hse");
+    node_clock = CLOCK_STATE_HSI;
+    SystemCoreClock = 72000000;
+
+    static const uint32_t losses[] = {0, 100, 1000};
+    printf("image %u bytes, %u blocks, %u bit/s\n", image_size,
+           (image_size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE, CAN_BITRATE);
+    printf("staging   nodes   loss  rounds  frames  overruns  erases  fleet s  serial s  speedup\n");
+    for (uint8_t rww = 0; rww < 2; ++rww)
+    {
+        for (uint32_t l = 0; l < N_ELEMENTS(losses); ++l)
+        {
+            sim_stat_t single;
+            sim_run(1, pimage, image_size, losses[l], rww, &single);
+            for (uint32_t nodes = 1; nodes <= max_nodes; nodes *= 4)
+            {
+                sim_stat_t fleet = single;
+                if (nodes > 1)
+                {
+                    sim_run(nodes, pimage, image_size, losses[l], rww, &fleet);
+                }
+                host_check((single.seconds > 0) && (fleet.seconds > 0), "%s staging, %u nodes, loss %.2f%%",
+                           rww ? "spi" : "internal", nodes, losses[l] / 10000.0);
+                printf("%-9s %5u  %4.2f%%  %6u  %6u  %8u  %6u  %7.2f  %8.2f  %6.1fx\n",
+                       rww ? "spi" : "internal", nodes, losses[l] / 10000.0, fleet.rounds,
+                       fleet.frames, fleet.overruns, fleet.erases, fleet.seconds,
+                       single.seconds * nodes, single.seconds * nodes / fleet.seconds);
+            }
+        }
+    }
+
+    free(pimage);
+    return host_exit();
+}
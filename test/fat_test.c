@@ -0,0 +1,644 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "host.h"
+#include "fat.h"
+#include "sdcard.h"
+#include "upgrade_sdcard.h"
+#include "upgrade_flash.h"
+#include "storage.h"
+#include "pipeline.h"
+#include "flash_map.h"
+#include "crc32.h"
+
+/**
+ * fat.c and upgrade_sdcard.c against disk image files. Without an image
+ * argument the test formats its own: fat16 with and without a partition
+ * table and a partitioned fat32 volume, each holding a volume label, long
+ * name, deleted and directory entries next to a fragmented FIRMWAREBIN.
+ * With an image argument it mounts that one and streams FIRMWAREBIN.
+ *
+ * The card reads sectors from the file on simulated time, 4 bit SDIO at
+ * 24MHz plus an access time per command, the app slot programs at the
+ * stm32f103 datasheet typical. The card feeds pipeline.c, a stand-in sink
+ * takes the place of the one in upgrade_flash.c. The sdcard_upgrade run
+ * reports card time against flash time, overlapped card reads keep the
+ * whole upgrade within 1% of the flash program time.
+ */
+#define SIM_CARD_ACCESS_NS          100000ull
+#define SIM_CARD_SECTOR_NS          42667ull
+#define SIM_PAGE_ERASE_NS           20000000ull
+#define SIM_HALFWORD_PROGRAM_NS     52500ull
+#define SIM_IMAGE_SIZE              (100 * 1024 + 100)
+#define SIM_FILE_SIZE               (SDCARD_IMAGE_OFFSET + SIM_IMAGE_SIZE)
+#define SIM_PARTITION_LBA           2048
+#define SIM_DIR_ENTRY_SIZE          32
+
+typedef struct
+{
+    int fd;
+    bool fat32;
+    uint32_t lba;
+    uint32_t spc;
+    uint32_t fat_start;
+    uint32_t fat_size;
+    uint32_t root_start;
+    uint32_t data_start;
+    uint32_t root_cluster;
+    uint32_t root_entries;
+    uint32_t next_cluster;
+    uint32_t dir_index;
+    uint32_t second_root;
+} disk_t;
+
+/* card side */
+static int card_fd = -1;
+static uint32_t card_reads;
+static uint32_t card_sectors;
+static uint64_t card_ns;
+static uint64_t card_done;
+static bool card_busy;
+
+/* app slot side */
+static uint64_t flash_ns;
+static uint32_t flash_erases;
+
+static uint8_t image[SIM_FILE_SIZE];
+
+static void put_u16(uint8_t *pdata, uint16_t value)
+{
+    pdata[0] = value;
+    pdata[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *pdata, uint32_t value)
+{
+    put_u16(pdata, value);
+    put_u16(pdata + 2, value >> 16);
+}
+
+static void disk_write(const disk_t *pdisk, uint64_t offset, const void *pdata, uint32_t len)
+{
+    if ((ssize_t)len != pwrite(pdisk->fd, pdata, len, offset))
+    {
+        perror("pwrite");
+        exit(2);
+    }
+}
+
+static uint64_t cluster_offset(const disk_t *pdisk, uint32_t cluster)
+{
+    return ((uint64_t)pdisk->data_start + (cluster - 2) * pdisk->spc) * SDCARD_SECTOR_SIZE;
+}
+
+static void fat_set(const disk_t *pdisk, uint32_t cluster, uint32_t value)
+{
+    uint8_t entry[4];
+    uint32_t size = pdisk->fat32 ? 4 : 2;
+    put_u32(entry, value);
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        uint64_t offset = (uint64_t)(pdisk->fat_start + i * pdisk->fat_size) * SDCARD_SECTOR_SIZE;
+        disk_write(pdisk, offset + cluster * size, entry, size);
+    }
+}
+
+/**
+ * @brief format a volume, fat16 with 4 sectors per cluster or fat32 with one
+ */
+static void disk_format(disk_t *pdisk, bool fat32, bool partitioned)
+{
+    uint8_t sector[SDCARD_SECTOR_SIZE];
+    uint32_t total = fat32 ? 70000 : 65536;
+    memset(pdisk, 0, sizeof(*pdisk));
+    pdisk->fat32 = fat32;
+    pdisk->lba = partitioned ? SIM_PARTITION_LBA : 0;
+    pdisk->spc = fat32 ? 1 : 4;
+    pdisk->root_entries = fat32 ? 0 : 512;
+    uint32_t reserved = fat32 ? 32 : 1;
+    uint32_t clusters = total / pdisk->spc;
+    pdisk->fat_size = ((clusters + 2) * (fat32 ? 4 : 2) + SDCARD_SECTOR_SIZE - 1) / SDCARD_SECTOR_SIZE;
+    pdisk->fat_start = pdisk->lba + reserved;
+    pdisk->root_start = pdisk->fat_start + 2 * pdisk->fat_size;
+    pdisk->data_start = pdisk->root_start + pdisk->root_entries * SIM_DIR_ENTRY_SIZE / SDCARD_SECTOR_SIZE;
+    pdisk->root_cluster = fat32 ? 2 : 0;
+    pdisk->next_cluster = fat32 ? 3 : 2;
+
+    char path[] = "/tmp/fat_test_XXXXXX";
+    pdisk->fd = mkstemp(path);
+    if (pdisk->fd < 0)
+    {
+        perror("mkstemp");
+        exit(2);
+    }
+    unlink(path);
+    if (0 != ftruncate(pdisk->fd, (uint64_t)(pdisk->lba + total) * SDCARD_SECTOR_SIZE))
+    {
+        perror("ftruncate");
+        exit(2);
+    }
+
+    if (partitioned)
+    {
+        memset(sector, 0, sizeof(sector));
+        sector[446 + 4] = fat32 ? 0x0c : 0x06;
+        put_u32(sector + 446 + 8, pdisk->lba);
+        put_u32(sector + 446 + 12, total);
+        put_u16(sector + 510, 0xaa55);
+        disk_write(pdisk, 0, sector, sizeof(sector));
+    }
+
+    memset(sector, 0, sizeof(sector));
+    sector[0] = 0xeb;
+    sector[1] = 0x3c;
+    sector[2] = 0x90;
+    memcpy(sector + 3, "SBOOTSIM", 8);
+    put_u16(sector + 11, SDCARD_SECTOR_SIZE);
+    sector[13] = pdisk->spc;
+    put_u16(sector + 14, reserved);
+    sector[16] = 2;
+    put_u16(sector + 17, pdisk->root_entries);
+    if (total < 0x10000)
+    {
+        put_u16(sector + 19, total);
+    }
+    else
+    {
+        put_u32(sector + 32, total);
+    }
+    sector[21] = 0xf8;
+    if (fat32)
+    {
+        put_u32(sector + 36, pdisk->fat_size);
+        put_u32(sector + 44, pdisk->root_cluster);
+    }
+    else
+    {
+        put_u16(sector + 22, pdisk->fat_size);
+    }
+    put_u16(sector + 510, 0xaa55);
+    disk_write(pdisk, (uint64_t)pdisk->lba * SDCARD_SECTOR_SIZE, sector, sizeof(sector));
+
+    fat_set(pdisk, 0, 0x0ffffff8);
+    fat_set(pdisk, 1, 0x0fffffff);
+    if (fat32)
+    {
+        fat_set(pdisk, pdisk->root_cluster, 0x0fffffff);
+    }
+}
+
+/**
+ * @brief write data into the given clusters and chain them
+ */
+static void disk_chain(const disk_t *pdisk, const uint32_t *pclusters, uint32_t count,
+                       const uint8_t *pdata, uint32_t len)
+{
+    uint32_t cluster_size = pdisk->spc * SDCARD_SECTOR_SIZE;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t offset = i * cluster_size;
+        if ((NULL != pdata) && (offset < len))
+        {
+            disk_write(pdisk, cluster_offset(pdisk, pclusters[i]), pdata + offset,
+                       MIN(cluster_size, len - offset));
+        }
+        fat_set(pdisk, pclusters[i], (i + 1 < count) ? pclusters[i + 1] : 0x0fffffff);
+    }
+}
+
+/**
+ * @brief add a root directory entry, fat32 roots grow by a cluster that is
+ *        not next to the first one
+ */
+static void disk_dir_add(disk_t *pdisk, const char *name, uint8_t attr, uint32_t cluster, uint32_t size)
+{
+    uint32_t index = pdisk->dir_index++;
+    uint8_t entry[SIM_DIR_ENTRY_SIZE];
+    memset(entry, 0, sizeof(entry));
+    memcpy(entry, name, 11);
+    entry[11] = attr;
+    put_u16(entry + 20, cluster >> 16);
+    put_u16(entry + 26, cluster);
+    put_u32(entry + 28, size);
+
+    uint64_t offset;
+    uint32_t per_cluster = pdisk->spc * SDCARD_SECTOR_SIZE / SIM_DIR_ENTRY_SIZE;
+    if (!pdisk->fat32)
+    {
+        offset = (uint64_t)pdisk->root_start * SDCARD_SECTOR_SIZE + index * SIM_DIR_ENTRY_SIZE;
+    }
+    else if (index < per_cluster)
+    {
+        offset = cluster_offset(pdisk, pdisk->root_cluster) + index * SIM_DIR_ENTRY_SIZE;
+    }
+    else
+    {
+        if (0 == pdisk->second_root)
+        {
+            pdisk->second_root = pdisk->next_cluster++;
+            uint32_t chain[2] = {pdisk->root_cluster, pdisk->second_root};
+            disk_chain(pdisk, chain, 2, NULL, 0);
+        }
+        offset = cluster_offset(pdisk, pdisk->second_root) + (index - per_cluster) * SIM_DIR_ENTRY_SIZE;
+    }
+    disk_write(pdisk, offset, entry, sizeof(entry));
+}
+
+/**
+ * @brief the image file goes in runs of 3, 1, 5 and 2 clusters, OTHER BIN
+ *        takes the clusters in between, the last run lies before the others
+ */
+static void disk_populate(disk_t *pdisk)
+{
+    static uint32_t clusters[SIM_FILE_SIZE / SDCARD_SECTOR_SIZE + 1];
+    static uint32_t other[SIM_FILE_SIZE / SDCARD_SECTOR_SIZE + 1];
+    static const uint8_t runs[] = {3, 1, 5, 2};
+    uint32_t cluster_size = pdisk->spc * SDCARD_SECTOR_SIZE;
+    uint32_t count = (SIM_FILE_SIZE + cluster_size - 1) / cluster_size;
+    uint32_t other_count = 0;
+
+    /* the tail run goes first on the disk */
+    uint32_t tail = MIN(count, 4u);
+    uint32_t next = pdisk->next_cluster;
+    for (uint32_t i = 0; i < tail; ++i)
+    {
+        clusters[count - tail + i] = next++;
+    }
+    other[other_count++] = next++;
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < count - tail; )
+    {
+        for (uint32_t j = 0; (j < runs[run % sizeof(runs)]) && (i < count - tail); ++j)
+        {
+            clusters[i++] = next++;
+        }
+        other[other_count++] = next++;
+        run ++;
+    }
+
+    disk_chain(pdisk, clusters, count, image, SIM_FILE_SIZE);
+    disk_chain(pdisk, other, other_count, image, other_count * cluster_size);
+    pdisk->next_cluster = next;
+
+    disk_dir_add(pdisk, "SBOOT SIM  ", 0x08, 0, 0);
+    /* long name entry, the attribute makes it a volume id as well */
+    disk_dir_add(pdisk, "Af\0i\0r\0m\0w\0", 0x0f, 0, 0);
+    disk_dir_add(pdisk, "\xe5IRMWAREBIN", 0x20, other[0], cluster_size);
+    disk_dir_add(pdisk, "FIRMWAREBIN", 0x10, other[0], 0);
+    disk_dir_add(pdisk, "OTHER   BIN", 0x20, other[0], other_count * cluster_size);
+    /* push FIRMWAREBIN past the first root cluster on fat32 */
+    uint32_t fill = pdisk->fat32 ? pdisk->spc * SDCARD_SECTOR_SIZE / SIM_DIR_ENTRY_SIZE : 3;
+    for (uint32_t i = 0; i < fill; ++i)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "FILL%04uTXT", i % 10000);
+        disk_dir_add(pdisk, name, 0x20, other[0], 0);
+    }
+    disk_dir_add(pdisk, SDCARD_IMAGE_NAME, 0x20, clusters[0], SIM_FILE_SIZE);
+}
+
+/* sdcard.h stand-ins on the image file */
+static bool card_read_at(uint32_t sector, uint8_t *pbuf, uint32_t count)
+{
+    uint32_t len = count * SDCARD_SECTOR_SIZE;
+    if ((ssize_t)len != pread(card_fd, pbuf, len, (uint64_t)sector * SDCARD_SECTOR_SIZE))
+    {
+        return false;
+    }
+
+    card_reads ++;
+    card_sectors += count;
+    card_ns += SIM_CARD_ACCESS_NS + count * SIM_CARD_SECTOR_NS;
+    return true;
+}
+
+bool sdcard_init(void)
+{
+    return card_fd >= 0;
+}
+
+void sdcard_clock_update(void)
+{
+}
+
+bool sdcard_read(uint32_t sector, uint8_t *pbuf, uint32_t count)
+{
+    if (card_busy || !card_read_at(sector, pbuf, count))
+    {
+        return false;
+    }
+
+    host_advance(SIM_CARD_ACCESS_NS + count * SIM_CARD_SECTOR_NS);
+    return true;
+}
+
+bool sdcard_read_start(uint32_t sector, uint8_t *pbuf, uint32_t count)
+{
+    if (card_busy || !card_read_at(sector, pbuf, count))
+    {
+        return false;
+    }
+
+    card_busy = true;
+    card_done = host_time() + SIM_CARD_ACCESS_NS + count * SIM_CARD_SECTOR_NS;
+    return true;
+}
+
+bool sdcard_read_wait(void)
+{
+    if (!card_busy)
+    {
+        return false;
+    }
+
+    if (host_time() < card_done)
+    {
+        host_advance(card_done - host_time());
+    }
+    card_busy = false;
+    return true;
+}
+
+/* upgrade_flash.h stand-ins on the mapped app slot */
+void flash_image_header_erase(void)
+{
+}
+
+/* the backup register verdict, the whole header stands in for its generation */
+static flash_image_header_t verdict;
+static bool verdict_valid;
+static uint32_t app_crcs;
+
+void flash_app_verdict_invalidate(void)
+{
+    verdict_valid = false;
+}
+
+bool flash_app_verdict_matches(const flash_image_header_t *pheader)
+{
+    return verdict_valid && (0 == memcmp(&verdict, pheader, sizeof(verdict)));
+}
+
+void flash_app_verdict_write(const flash_image_header_t *pheader)
+{
+    verdict = *pheader;
+    verdict_valid = true;
+}
+
+uint32_t flash_skipped_halfwords(void)
+{
+    return 0;
+}
+
+FLASH_Status flash_page_erase(uint32_t address)
+{
+    memset((void *)(uintptr_t)address, 0xff, FLASH_BLOCK_SIZE);
+    host_advance(SIM_PAGE_ERASE_NS);
+    flash_ns += SIM_PAGE_ERASE_NS;
+    flash_erases ++;
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status flash_page_write(uint32_t address, const uint8_t *pbuf)
+{
+    memcpy((void *)(uintptr_t)address, pbuf, FLASH_BLOCK_SIZE);
+    host_advance(FLASH_BLOCK_SIZE / 2 * SIM_HALFWORD_PROGRAM_NS);
+    flash_ns += FLASH_BLOCK_SIZE / 2 * SIM_HALFWORD_PROGRAM_NS;
+    return FLASH_COMPLETE;
+}
+
+/* pipeline.h sink and storage.h stand-ins */
+static uint8_t sink_buffer[FLASH_BLOCK_SIZE];
+static uint32_t sink_offset;
+static uint32_t sink_fill;
+
+static bool sink_open(pipe_stage_t *pstage, const flash_image_header_t *pheader)
+{
+    UNUSED(pstage);
+    UNUSED(pheader);
+    sink_offset = 0;
+    sink_fill = 0;
+    return true;
+}
+
+static bool sink_block(void)
+{
+    if (sink_offset + FLASH_BLOCK_SIZE > APP_IMAGE_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t address = APP_IMAGE_ADDR + sink_offset;
+    sink_offset += FLASH_BLOCK_SIZE;
+    sink_fill = 0;
+    return (FLASH_COMPLETE == flash_page_erase(address)) &&
+           (FLASH_COMPLETE == flash_page_write(address, sink_buffer));
+}
+
+static bool sink_write(pipe_stage_t *pstage, const uint8_t *pdata, uint32_t len)
+{
+    UNUSED(pstage);
+    while (len > 0)
+    {
+        uint32_t count = MIN(len, FLASH_BLOCK_SIZE - sink_fill);
+        memcpy(sink_buffer + sink_fill, pdata, count);
+        sink_fill += count;
+        pdata += count;
+        len -= count;
+        if ((FLASH_BLOCK_SIZE == sink_fill) && !sink_block())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool sink_close(pipe_stage_t *pstage)
+{
+    UNUSED(pstage);
+    if (0 == sink_fill)
+    {
+        return true;
+    }
+
+    memset(sink_buffer + sink_fill, 0xff, FLASH_BLOCK_SIZE - sink_fill);
+    return sink_block();
+}
+
+pipe_stage_t sink_stage =
+{
+    "sink",
+    0,
+    sink_open,
+    sink_write,
+    sink_close,
+    NULL,
+    0,
+};
+
+const storage_slot_t slot_app = {NULL, APP_IMAGE_ADDR, APP_IMAGE_SIZE};
+
+FLASH_Status storage_erase_wait(const storage_slot_t *pslot, uint32_t offset)
+{
+    UNUSED(pslot);
+    UNUSED(offset);
+    return FLASH_COMPLETE;
+}
+
+uint32_t flash_image_checksum_calc(uint32_t address, uint32_t image_size)
+{
+    app_crcs ++;
+    return crc32(0, (const uint8_t *)(uintptr_t)address, image_size);
+}
+
+uint32_t flash_image_app_checksum(const flash_image_header_t *pheader)
+{
+    return pheader->checksum;
+}
+
+/**
+ * @brief stream FIRMWAREBIN the way upgrade_sdcard.c does, a block of
+ *        sectors per fat_map run
+ * @return crc32 of the file, runs and sectors through pointers
+ */
+static uint32_t stream_file(fat_file_t *pfile, uint32_t *pruns)
+{
+    static uint8_t block[FLASH_BLOCK_SIZE];
+    uint32_t crc_val = 0;
+    *pruns = 0;
+    for (uint32_t offset = 0; offset < pfile->size; )
+    {
+        uint32_t count = FLASH_BLOCK_SIZE / SDCARD_SECTOR_SIZE;
+        uint32_t sector = fat_map(pfile, offset, &count);
+        if ((0 == sector) || !sdcard_read(sector, block, count))
+        {
+            return 0;
+        }
+
+        uint32_t len = MIN(count * SDCARD_SECTOR_SIZE, pfile->size - offset);
+        crc_val = crc32(crc_val, block, len);
+        offset += count * SDCARD_SECTOR_SIZE;
+        (*pruns) ++;
+    }
+
+    return crc_val;
+}
+
+static void test_volume(const char *name, bool fat32, bool partitioned)
+{
+    static fat_volume_t volume;
+    fat_file_t file;
+    disk_t disk;
+    disk_format(&disk, fat32, partitioned);
+    disk_populate(&disk);
+    card_fd = disk.fd;
+
+    host_check(fat_mount(&volume) && (volume.fat32 == fat32), "%s: mount", name);
+    host_check(!fat_open(&volume, "MISSING BIN", &file), "%s: missing file", name);
+    host_check(fat_open(&volume, SDCARD_IMAGE_NAME, &file) && (SIM_FILE_SIZE == file.size),
+               "%s: open past label, long name, deleted and directory entries", name);
+
+    uint32_t runs;
+    uint32_t crc_val = stream_file(&file, &runs);
+    host_check(crc_val == crc32(0, image, SIM_FILE_SIZE), "%s: fragmented file streams, %u runs", name, runs);
+
+    /* a run never crosses a fragment, inside one it merges clusters */
+    uint32_t count = 64;
+    uint32_t sector = fat_map(&file, 0, &count);
+    host_check((disk.data_start + (file.first_cluster - 2) * disk.spc == sector) &&
+               (3 * disk.spc == count), "%s: first fragment merges %u sectors", name, count);
+
+    /* going back restarts the chain, past the end fails */
+    count = 1;
+    uint32_t last = fat_map(&file, SIM_FILE_SIZE - 1 - (SIM_FILE_SIZE - 1) % SDCARD_SECTOR_SIZE, &count);
+    count = 1;
+    uint32_t first = fat_map(&file, 0, &count);
+    host_check((0 != last) && (first == sector), "%s: seek back", name);
+    uint32_t end = (SIM_FILE_SIZE + disk.spc * SDCARD_SECTOR_SIZE - 1) / (disk.spc * SDCARD_SECTOR_SIZE) *
+                   disk.spc * SDCARD_SECTOR_SIZE;
+    count = 1;
+    host_check(0 == fat_map(&file, end, &count), "%s: past the chain", name);
+
+    /* the whole upgrade from this card */
+    memset((void *)(uintptr_t)APP_IMAGE_ADDR, 0xff, APP_IMAGE_SIZE);
+    flash_app_verdict_invalidate();
+    card_ns = 0;
+    card_reads = 0;
+    card_sectors = 0;
+    flash_ns = 0;
+    flash_erases = 0;
+    host_sim_time();
+    bool upgraded = sdcard_probe() && sdcard_upgrade();
+    uint64_t total = host_time();
+    host_check(upgraded && (0 == memcmp((void *)(uintptr_t)APP_IMAGE_ADDR, image + SDCARD_IMAGE_OFFSET,
+                                        SIM_IMAGE_SIZE)), "%s: sdcard_upgrade programs the app", name);
+    printf("%s: card %.1f ms, flash %.1f ms, upgrade %.1f ms, %u reads of %u sectors\n", name,
+           card_ns / 1e6, flash_ns / 1e6, total / 1e6, card_reads, card_sectors);
+    /* the verify pass and reads across fragments are all the card adds */
+    uint32_t block_count = (SIM_IMAGE_SIZE + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+    host_check((block_count == flash_erases) && (total <= flash_ns + flash_ns / 100),
+               "%s: upgrade within 1%% of flash program time", name);
+    /* a warm boot takes the verdict, after power-on one crc caches it again */
+    app_crcs = 0;
+    host_check(!sdcard_probe() && (0 == app_crcs), "%s: same image is not flashed twice, no app crc", name);
+    flash_app_verdict_invalidate();
+    host_check(sdcard_probe() && !sdcard_upgrade() && (1 == app_crcs), "%s: after power-on one app crc", name);
+    host_check(!sdcard_probe() && (1 == app_crcs), "%s: then the verdict again", name);
+
+    close(disk.fd);
+    card_fd = -1;
+}
+
+static void test_file(const char *path)
+{
+    static fat_volume_t volume;
+    fat_file_t file;
+    card_fd = open(path, O_RDONLY);
+    host_check(card_fd >= 0, "open %s", path);
+    bool mounted = fat_mount(&volume);
+    host_check(mounted, "%s: mount fat%u", path, volume.fat32 ? 32 : 16);
+    if (mounted && fat_open(&volume, SDCARD_IMAGE_NAME, &file))
+    {
+        uint32_t runs;
+        uint32_t crc_val = stream_file(&file, &runs);
+        printf("%s: %u bytes in %u runs, crc32 0x%08x\n", SDCARD_IMAGE_NAME, file.size, runs, crc_val);
+    }
+    close(card_fd);
+}
+
+int main(int argc, char **argv)
+{
+    host_map(APP_IMAGE_ADDR, APP_IMAGE_SIZE);
+    if (argc > 1)
+    {
+        test_file(argv[1]);
+        return host_exit();
+    }
+
+    host_srand(0xfa7);
+    for (uint32_t i = 0; i < SIM_FILE_SIZE; ++i)
+    {
+        image[i] = (uint8_t)host_rand();
+    }
+    flash_image_header_t *pheader = (flash_image_header_t *)image;
+    memset(image, 0, SDCARD_IMAGE_OFFSET);
+    pheader->magic = FLASH_MAGIC;
+    pheader->image_size = SIM_IMAGE_SIZE;
+    pheader->checksum = crc32(0, image + SDCARD_IMAGE_OFFSET, SIM_IMAGE_SIZE);
+
+    test_volume("fat16", false, false);
+    test_volume("fat16 partitioned", false, true);
+    test_volume("fat32 partitioned", true, true);
+    return host_exit();
+}
@@ -0,0 +1,214 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <sys/mman.h>
+#include "host.h"
+#include "delay.h"
+#include "crc32.h"
+
+#define HOST_SRAM_ADDR              0x20000000
+#define HOST_SRAM_STACK_SIZE        0x00100000
+
+uint32_t SystemCoreClock = 72000000;
+
+static bool time_warp = false;
+static bool time_simulated = false;
+static uint64_t time_now = 0;
+static uint32_t rand_state = 1;
+static uint32_t failures = 0;
+
+void *host_map(uint32_t address, uint32_t size)
+{
+    uintptr_t base = address & ~0xffful;
+    size_t len = ((address + size + 0xfff) & ~0xffful) - base;
+    void *pmem = mmap((void *)base, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (MAP_FAILED == pmem)
+    {
+        perror("mmap");
+        exit(2);
+    }
+
+    return (void *)(uintptr_t)address;
+}
+
+void host_run_low(void (*fn)(void))
+{
+    static ucontext_t caller;
+    ucontext_t low;
+    getcontext(&low);
+    low.uc_stack.ss_sp = host_map(HOST_SRAM_ADDR, HOST_SRAM_STACK_SIZE);
+    low.uc_stack.ss_size = HOST_SRAM_STACK_SIZE;
+    low.uc_link = &caller;
+    makecontext(&low, fn, 0);
+    if (0 != swapcontext(&caller, &low))
+    {
+        perror("swapcontext");
+        exit(2);
+    }
+}
+
+uint64_t host_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return host_ns();
+#endif
+}
+
+void host_sim_time(void)
+{
+    time_simulated = true;
+    time_now = 0;
+}
+
+void host_advance(uint64_t ns)
+{
+    time_now += ns;
+}
+
+uint64_t host_time(void)
+{
+    return time_simulated ? time_now : host_ns();
+}
+
+void host_time_warp(void)
+{
+    time_warp = true;
+}
+
+void host_srand(uint32_t seed)
+{
+    rand_state = (0 == seed) ? 1 : seed;
+}
+
+uint32_t host_rand(void)
+{
+    /* xorshift32 */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+void host_check(bool ok, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    printf("%s: ", ok ? "pass" : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok)
+    {
+        failures ++;
+    }
+}
+
+int host_exit(void)
+{
+    return (0 == failures) ? 0 : 1;
+}
+
+uint32_t delay_cycles(void)
+{
+    return (uint32_t)(host_time() * (SystemCoreClock / 1000000) / 1000);
+}
+
+uint32_t delay_deadline(uint32_t time)
+{
+    return delay_cycles() + time * (SystemCoreClock / 1000000);
+}
+
+bool delay_expired(uint32_t deadline)
+{
+    return time_warp || ((int32_t)(delay_cycles() - deadline) >= 0);
+}
+
+void delay_init(void)
+{
+}
+
+void delay_us(uint32_t time)
+{
+    if (time_simulated && !time_warp)
+    {
+        host_advance(time * 1000ull);
+        return;
+    }
+
+    uint32_t deadline = delay_deadline(time);
+    while (!delay_expired(deadline));
+}
+
+void delay_ms(uint32_t time)
+{
+    delay_us(time * 1000);
+}
+
+/* cmsis intrinsic, a single rev on the target */
+uint32_t __REV(uint32_t value)
+{
+    return __builtin_bswap32(value);
+}
+
+/* the target runs bulk data through the crc unit, same result */
+uint32_t crc32(uint32_t prev_crc, const uint8_t *pbuf, uint32_t len)
+{
+    if (NULL == pbuf)
+    {
+        return 0;
+    }
+
+    prev_crc ^= 0xffffffff;
+    while (len--)
+    {
+        prev_crc ^= *pbuf++;
+        for (uint8_t i = 0; i < 8; ++i)
+        {
+            prev_crc = (prev_crc >> 1) ^ ((prev_crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+
+    return prev_crc ^ 0xffffffff;
+}
+
+void trace(const char *module, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    printf("%s ", module);
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+}
+
+void trace_dump(const char *module, const char *fmt, const uint8_t *pdata, uint8_t len)
+{
+    printf("%s %s", module, fmt);
+    for (uint8_t i = 0; i < len; ++i)
+    {
+        printf(" %02x", pdata[i]);
+    }
+    printf("\n");
+}
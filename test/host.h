@@ -0,0 +1,77 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "types.h"
+
+BEGIN_DECLS
+
+/**
+ * host stand-ins for what the sboot modules under test expect from the
+ * target: delay.h on a monotonic clock scaled to SystemCoreClock, crc32.h
+ * in software, trace.h on stdout and memory at device addresses.
+ */
+
+/**
+ * @brief map zeroed memory at a device address, e.g. internal flash or the
+ *        unique id, exits on failure
+ */
+void *host_map(uint32_t address, uint32_t size);
+
+/**
+ * @brief run fn on a stack in sram at 0x20000000, the code under test keeps
+ *        buffer addresses in uint32_t dma registers like on the target.
+ *        link with -no-pie so globals live below 4GB as well
+ */
+void host_run_low(void (*fn)(void));
+
+/**
+ * @brief host cpu time stamp in ns, for benchmarks
+ */
+uint64_t host_ns(void);
+
+/**
+ * @brief host cpu cycle counter for benchmarks, the tsc on x86 and ns
+ *        elsewhere
+ */
+uint64_t host_cycles(void);
+
+/**
+ * @brief simulated time from now on, it only moves with host_advance and
+ *        the delays
+ */
+void host_sim_time(void);
+void host_advance(uint64_t ns);
+
+/**
+ * @brief ns on the clock delay.h runs on
+ */
+uint64_t host_time(void);
+
+/**
+ * @brief every later delay_expired is true, a node whose bus went away
+ *        runs into its timeouts at once
+ */
+void host_time_warp(void);
+
+/**
+ * @brief deterministic pseudo random numbers
+ */
+void host_srand(uint32_t seed);
+uint32_t host_rand(void);
+
+/**
+ * @brief print the result of a check, count failures for host_exit
+ */
+void host_check(bool ok, const char *fmt, ...);
+int host_exit(void);
+
+END_DECLS
+
+#endif /* _HOST_H_ */
@@ -0,0 +1,302 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "kv.h"
+#include "storage.h"
+#include "flash_map.h"
+
+/**
+ * kv.c on the two KV_STORE_ADDR pages mapped at their device address, with
+ * flash_standalone_* programming halfwords the way internal flash does:
+ * bits only clear, an erase sets a page to 0xff. Time is simulated at the
+ * typical erase and halfword program times. Each workload runs
+ * BENCH_UPDATES random updates against a shadow copy, one in POWER_CUT_ONE_IN
+ * is cut off after a few halfwords and the store is mounted again, like a
+ * reset would. Reported are write latency and page erases per 10k updates,
+ * next to erasing and rewriting a settings page per update.
+ *
+ * A last run fills the page with values of KV_VALUE_MAX bytes, then keeps
+ * rewriting them, with and without power cuts during the compactions.
+ */
+#define BENCH_UPDATES               10000
+#define POWER_CUT_ONE_IN            10
+#define REMOUNT_ONE_IN              50
+/* pm0075 typical */
+#define SIM_PAGE_SIZE               2048
+#define SIM_PAGE_ERASE_NS           20000000ull
+#define SIM_HALFWORD_PROGRAM_NS     52500ull
+
+typedef struct
+{
+    const char *name;
+    uint16_t first_key;
+    uint16_t keys;
+    uint16_t max_len;
+} workload_t;
+
+static const workload_t workloads[] =
+{
+    {"all keys, 4 byte values", 0, KV_MAX_KEYS, 4},
+    {"all keys, up to 16 byte values", 0, KV_MAX_KEYS, 16},
+    {"all keys, up to 64 byte values", 0, KV_MAX_KEYS / 4, KV_VALUE_MAX},
+};
+
+typedef struct
+{
+    uint16_t len;
+    uint8_t value[KV_VALUE_MAX];
+} shadow_t;
+
+static uint32_t erases;
+static uint32_t programs;
+/* halfwords until the power cut, -1 for none */
+static int32_t cut_after = -1;
+static bool cut = false;
+
+FLASH_Status flash_standalone_erase(uint32_t address)
+{
+    if (cut)
+    {
+        return FLASH_ERROR_PG;
+    }
+
+    erases ++;
+    host_advance(SIM_PAGE_ERASE_NS);
+    memset((void *)(uintptr_t)(address & ~(SIM_PAGE_SIZE - 1)), 0xff, SIM_PAGE_SIZE);
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status flash_standalone_program(uint32_t address, const uint8_t *pbuf, uint32_t len)
+{
+    uint16_t *pdst = (uint16_t *)(uintptr_t)address;
+    for (uint32_t i = 0; i < len / 2; ++i)
+    {
+        if (0 == cut_after)
+        {
+            cut = true;
+        }
+        if (cut)
+        {
+            return FLASH_ERROR_PG;
+        }
+        if (cut_after > 0)
+        {
+            cut_after --;
+        }
+
+        uint16_t halfword;
+        memcpy(&halfword, pbuf + 2 * i, sizeof(halfword));
+        pdst[i] &= halfword;
+        programs ++;
+        host_advance(SIM_HALFWORD_PROGRAM_NS);
+    }
+
+    return FLASH_COMPLETE;
+}
+
+static bool shadow_matches(const kv_store_t *pkv, const shadow_t *pshadow, uint16_t torn_key,
+                           const shadow_t *ptorn)
+{
+    for (uint16_t key = 0; key < KV_MAX_KEYS; ++key)
+    {
+        uint8_t value[KV_VALUE_MAX];
+        uint16_t len = kv_read(pkv, key, value, sizeof(value));
+        bool ok = (len == pshadow[key].len) && (0 == memcmp(value, pshadow[key].value, len));
+        if (!ok && (key == torn_key))
+        {
+            /* a cut write leaves the old or the new value, nothing else */
+            ok = (len == ptorn->len) && (0 == memcmp(value, ptorn->value, len));
+        }
+        if (!ok)
+        {
+            printf("key %u: %u bytes, expected %u\n", key, len, pshadow[key].len);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void run(const workload_t *pworkload)
+{
+    static shadow_t shadow[KV_MAX_KEYS];
+    kv_store_t kv;
+    memset(shadow, 0, sizeof(shadow));
+    /* whatever the app image left behind */
+    memset((void *)(uintptr_t)KV_STORE_ADDR, 0x5a, KV_STORE_SIZE);
+    cut = false;
+    cut_after = -1;
+    host_check(FLASH_COMPLETE == kv_mount(&kv), "%s: mount a blank store", pworkload->name);
+
+    erases = 0;
+    programs = 0;
+    uint32_t cuts = 0;
+    uint32_t rejected = 0;
+    uint64_t total_ns = 0;
+    uint64_t worst_ns = 0;
+    bool consistent = true;
+    for (uint32_t i = 0; (i < BENCH_UPDATES) && consistent; ++i)
+    {
+        uint16_t key = pworkload->first_key + host_rand() % pworkload->keys;
+        shadow_t next;
+        next.len = 1 + host_rand() % pworkload->max_len;
+        if (0 == host_rand() % 100)
+        {
+            next.len = 0;
+        }
+        for (uint16_t j = 0; j < next.len; ++j)
+        {
+            next.value[j] = (uint8_t)host_rand();
+        }
+        if (0 == host_rand() % POWER_CUT_ONE_IN)
+        {
+            cut_after = host_rand() % 16;
+        }
+
+        uint64_t start = host_time();
+        FLASH_Status status = kv_write(&kv, key, next.value, next.len);
+        uint64_t elapsed = host_time() - start;
+        bool power_cut = cut;
+        cut = false;
+        cut_after = -1;
+
+        shadow_t old = shadow[key];
+        if (power_cut)
+        {
+            cuts ++;
+            shadow[key] = next;
+            kv_mount(&kv);
+            consistent = shadow_matches(&kv, shadow, key, &old);
+            /* settle on what the store kept */
+            shadow[key].len = kv_read(&kv, key, shadow[key].value, sizeof(shadow[key].value));
+            continue;
+        }
+
+        total_ns += elapsed;
+        worst_ns = MAX(worst_ns, elapsed);
+        if (FLASH_COMPLETE == status)
+        {
+            shadow[key] = next;
+        }
+        else
+        {
+            rejected ++;
+        }
+
+        if (0 == host_rand() % REMOUNT_ONE_IN)
+        {
+            kv_mount(&kv);
+        }
+        consistent = shadow_matches(&kv, shadow, KV_MAX_KEYS, NULL);
+    }
+    host_check(consistent, "%s: %u updates, %u power cuts, %u rejected, reads match",
+               pworkload->name, BENCH_UPDATES, cuts, rejected);
+    host_check(erases * 10 < BENCH_UPDATES, "%s: fewer than one erase per 10 updates", pworkload->name);
+
+    uint32_t written = BENCH_UPDATES - cuts;
+    printf("    %u erases per 10k updates, %u halfwords programmed\n",
+           (uint32_t)((uint64_t)erases * 10000 / BENCH_UPDATES), programs);
+    printf("    write latency: %llu us mean, %llu us worst\n",
+           (unsigned long long)(total_ns / written / 1000), (unsigned long long)(worst_ns / 1000));
+}
+
+static void random_value(shadow_t *pvalue, uint16_t len)
+{
+    pvalue->len = len;
+    for (uint16_t i = 0; i < len; ++i)
+    {
+        pvalue->value[i] = (uint8_t)host_rand();
+    }
+}
+
+static void test_capacity(void)
+{
+    static shadow_t shadow[KV_MAX_KEYS];
+    kv_store_t kv;
+    memset(shadow, 0, sizeof(shadow));
+    memset((void *)(uintptr_t)KV_STORE_ADDR, 0xff, KV_STORE_SIZE);
+    cut = false;
+    cut_after = -1;
+    kv_mount(&kv);
+
+    /* fill up until a new key is rejected */
+    uint16_t keys = 0;
+    uint32_t before;
+    FLASH_Status status;
+    do
+    {
+        before = erases;
+        random_value(&shadow[keys], KV_VALUE_MAX);
+        status = kv_write(&kv, keys, shadow[keys].value, shadow[keys].len);
+    } while ((FLASH_COMPLETE == status) && (++keys < KV_MAX_KEYS));
+    if (keys < KV_MAX_KEYS)
+    {
+        shadow[keys].len = 0;
+    }
+    host_check((FLASH_ERROR_PG == status) && (before == erases) && shadow_matches(&kv, shadow, KV_MAX_KEYS, NULL),
+               "capacity: %u values of %u bytes fill a page, the next key is rejected without an erase",
+               keys, KV_VALUE_MAX);
+
+    /* every rewrite of a full page compacts */
+    before = erases;
+    bool consistent = true;
+    for (uint32_t i = 0; (i < 100) && consistent; ++i)
+    {
+        uint16_t key = host_rand() % keys;
+        shadow_t next;
+        random_value(&next, KV_VALUE_MAX);
+        consistent = (FLASH_COMPLETE == kv_write(&kv, key, next.value, next.len));
+        shadow[key] = next;
+        consistent = consistent && shadow_matches(&kv, shadow, KV_MAX_KEYS, NULL);
+    }
+    kv_mount(&kv);
+    consistent = consistent && shadow_matches(&kv, shadow, KV_MAX_KEYS, NULL);
+    host_check(consistent && (erases - before >= 100), "capacity: 100 rewrites of a full page, %u compactions",
+               erases - before);
+
+    /* a cut compaction keeps the old page */
+    uint32_t cuts = 0;
+    consistent = true;
+    for (uint32_t i = 0; (i < 100) && consistent; ++i)
+    {
+        uint16_t key = host_rand() % keys;
+        shadow_t next;
+        shadow_t old = shadow[key];
+        random_value(&next, KV_VALUE_MAX);
+        cut_after = host_rand() % (SIM_PAGE_SIZE / 2);
+        kv_write(&kv, key, next.value, next.len);
+        cuts += cut ? 1 : 0;
+        cut = false;
+        cut_after = -1;
+        kv_mount(&kv);
+        shadow[key] = next;
+        consistent = shadow_matches(&kv, shadow, key, &old);
+        shadow[key].len = kv_read(&kv, key, shadow[key].value, sizeof(shadow[key].value));
+    }
+    host_check(consistent, "capacity: %u power cuts during compaction keep the old or the new value", cuts);
+}
+
+int main(void)
+{
+    host_srand(0x4b5653);
+    host_sim_time();
+    host_map(KV_STORE_ADDR, KV_STORE_SIZE);
+    for (uint32_t i = 0; i < N_ELEMENTS(workloads); ++i)
+    {
+        run(&workloads[i]);
+    }
+    test_capacity();
+
+    uint64_t naive_ns = SIM_PAGE_ERASE_NS + SIM_PAGE_SIZE / 2 * SIM_HALFWORD_PROGRAM_NS;
+    printf("erase and rewrite a settings page per update: 10000 erases per 10k updates, %llu us each\n",
+           (unsigned long long)(naive_ns / 1000));
+    return host_exit();
+}
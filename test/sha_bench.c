@@ -0,0 +1,260 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "sha256.h"
+#include "ed25519.h"
+
+/**
+ * sha256.c against the FIPS 180-2 examples, split updates against one
+ * shot, ed25519.c against the RFC 8032 section 7.1 vectors, a malleated
+ * S + L and a signed sha-256 digest the way the image header carries it,
+ * then host cycles per KB for sha-256 fed in 2KB blocks like the copy loops
+ * do, and host cycles per ed25519 verify.
+ */
+#define BENCH_SIZE                  (64 * 1024)
+#define BENCH_BLOCK_SIZE            2048
+#define BENCH_ROUNDS                7
+#define DIGEST_IMAGE_SIZE           10000
+
+typedef struct
+{
+    const char *msg;
+    const char *digest;
+} sha_vector_t;
+
+typedef struct
+{
+    const char *key;
+    const char *msg;
+    const char *sig;
+} ed_vector_t;
+
+static const sha_vector_t sha_vectors[] =
+{
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+};
+
+static const ed_vector_t ed_vectors[] =
+{
+    {
+        "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+        "",
+        "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+        "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b"
+    },
+    {
+        "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+        "72",
+        "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+        "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00"
+    },
+    {
+        "fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+        "af82",
+        "6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac"
+        "18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a"
+    },
+    {
+        "ec172b93ad5e563bf4932c70e1245034c35467ef2efd4d64ebf819683467e2bf",
+        "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+        "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f",
+        "dc2a4459e7369633a52b1bf277839a00201009a3efbf3ecb69bea2186c26b589"
+        "09351fc9ac90b3ecfdfbc7c66431e0303dca179c138ac17ad9bef1177331a704"
+    },
+};
+
+/* key of RFC 8032 test 1 over the sha-256 of the DIGEST_IMAGE_SIZE test image */
+static const char digest_sig[] =
+    "1ba8b91dbca40aa21c946c1d51fac5cecdff3ef27c4e2f16135d28596d6df57a"
+    "cbc36e91db5fc54dd98e41aba188a293101ce6de7348a5e2927999d0dee0f90b";
+
+static uint8_t bench_buf[BENCH_SIZE];
+
+static uint32_t unhex(const char *phex, uint8_t *pout)
+{
+    uint32_t len = strlen(phex) / 2;
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        unsigned int byte;
+        sscanf(phex + 2 * i, "%2x", &byte);
+        pout[i] = (uint8_t)byte;
+    }
+
+    return len;
+}
+
+static void sha256(const uint8_t *pdata, uint32_t len, uint8_t *pdigest)
+{
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, pdata, len);
+    sha256_final(&ctx, pdigest);
+}
+
+static void test_sha256(void)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint8_t expect[SHA256_DIGEST_SIZE];
+    for (uint32_t i = 0; i < N_ELEMENTS(sha_vectors); ++i)
+    {
+        unhex(sha_vectors[i].digest, expect);
+        sha256((const uint8_t *)sha_vectors[i].msg, strlen(sha_vectors[i].msg), digest);
+        host_check(0 == memcmp(digest, expect, sizeof(digest)), "sha256 fips 180-2 vector %u", i);
+    }
+
+    /* a million 'a' in 1000 updates */
+    sha256_ctx_t ctx;
+    memset(bench_buf, 'a', 1000);
+    sha256_init(&ctx);
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        sha256_update(&ctx, bench_buf, 1000);
+    }
+    sha256_final(&ctx, digest);
+    unhex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", expect);
+    host_check(0 == memcmp(digest, expect, sizeof(digest)), "sha256 million a");
+
+    /* odd sized updates cross the block buffer every way */
+    for (uint32_t i = 0; i < BENCH_SIZE; ++i)
+    {
+        bench_buf[i] = (uint8_t)host_rand();
+    }
+    sha256(bench_buf, BENCH_SIZE, expect);
+    sha256_init(&ctx);
+    for (uint32_t offset = 0; offset < BENCH_SIZE; )
+    {
+        uint32_t len = host_rand() % 200;
+        len = MIN(len, BENCH_SIZE - offset);
+        sha256_update(&ctx, bench_buf + offset, len);
+        offset += len;
+    }
+    sha256_final(&ctx, digest);
+    host_check(0 == memcmp(digest, expect, sizeof(digest)), "sha256 split updates");
+}
+
+static void test_ed25519(void)
+{
+    static uint8_t msg[128];
+    uint8_t key[ED25519_KEY_SIZE];
+    uint8_t sig[ED25519_SIGNATURE_SIZE];
+    for (uint32_t i = 0; i < N_ELEMENTS(ed_vectors); ++i)
+    {
+        unhex(ed_vectors[i].key, key);
+        unhex(ed_vectors[i].sig, sig);
+        uint32_t len = unhex(ed_vectors[i].msg, msg);
+        host_check(ed25519_verify(sig, msg, len, key), "ed25519 rfc 8032 vector %u", i + 1);
+
+        sig[i * 7] ^= 0x01;
+        host_check(!ed25519_verify(sig, msg, len, key), "ed25519 rfc 8032 vector %u, signature bit flipped", i + 1);
+        sig[i * 7] ^= 0x01;
+        if (len > 0)
+        {
+            msg[len - 1] ^= 0x80;
+            host_check(!ed25519_verify(sig, msg, len, key), "ed25519 rfc 8032 vector %u, message bit flipped", i + 1);
+        }
+    }
+
+    /* S + L verifies the same curve equation, it must still be rejected */
+    static const uint8_t order[32] =
+    {
+        0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+        0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+    };
+    uint32_t len = unhex(ed_vectors[1].msg, msg);
+    unhex(ed_vectors[1].key, key);
+    unhex(ed_vectors[1].sig, sig);
+    uint32_t carry = 0;
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        carry += sig[32 + i] + order[i];
+        sig[32 + i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+    host_check(!ed25519_verify(sig, msg, len, key), "ed25519 rfc 8032 vector 2, S + L rejected");
+
+    /* the signed image flow: ed25519 over the sha-256 of the image */
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    for (uint32_t i = 0; i < DIGEST_IMAGE_SIZE; ++i)
+    {
+        bench_buf[i] = (uint8_t)(i * 7 + 3);
+    }
+    sha256(bench_buf, DIGEST_IMAGE_SIZE, digest);
+    unhex(ed_vectors[0].key, key);
+    unhex(digest_sig, sig);
+    host_check(ed25519_verify(sig, digest, sizeof(digest), key), "ed25519 over image digest");
+    unhex(ed_vectors[1].key, key);
+    host_check(!ed25519_verify(sig, digest, sizeof(digest), key), "ed25519 over image digest, other key");
+}
+
+/**
+ * @return fewest host cycles of BENCH_ROUNDS runs over BENCH_SIZE bytes
+ */
+static uint64_t bench_sha256(void)
+{
+    uint64_t best = UINT64_MAX;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        sha256_ctx_t ctx;
+        uint64_t start = host_cycles();
+        sha256_init(&ctx);
+        for (uint32_t offset = 0; offset < BENCH_SIZE; offset += BENCH_BLOCK_SIZE)
+        {
+            sha256_update(&ctx, bench_buf + offset, BENCH_BLOCK_SIZE);
+        }
+        sha256_final(&ctx, digest);
+        best = MIN(best, host_cycles() - start);
+    }
+
+    return best;
+}
+
+static void bench(void)
+{
+    for (uint32_t i = 0; i < BENCH_SIZE; ++i)
+    {
+        bench_buf[i] = (uint8_t)host_rand();
+    }
+
+    uint64_t sha = bench_sha256();
+    printf("sha256 in %u byte blocks: %llu host cycles/KB\n", BENCH_BLOCK_SIZE,
+           (unsigned long long)(sha / (BENCH_SIZE / 1024)));
+
+    uint8_t key[ED25519_KEY_SIZE];
+    uint8_t sig[ED25519_SIGNATURE_SIZE];
+    uint8_t msg[2];
+    uint32_t len = unhex(ed_vectors[2].msg, msg);
+    unhex(ed_vectors[2].key, key);
+    unhex(ed_vectors[2].sig, sig);
+    uint64_t best = UINT64_MAX;
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round)
+    {
+        uint64_t start = host_cycles();
+        ed25519_verify(sig, msg, len, key);
+        best = MIN(best, host_cycles() - start);
+    }
+    printf("ed25519 verify: %llu host cycles\n", (unsigned long long)best);
+}
+
+int main(void)
+{
+    host_srand(0x5a256);
+    test_sha256();
+    test_ed25519();
+    bench();
+    return host_exit();
+}
@@ -0,0 +1,523 @@
+/**
+* This file is part of the sboot project.
+*
+* Copyright 2020, Huang Yang <george_hy@outlook.com>. All rights reserved.
+*
+* See the COPYING file for the terms of usage and distribution.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "stm32f10x.h"
+#include "spi_flash.h"
+#include "storage.h"
+#include "flash_map.h"
+#include "upgrade_flash.h"
+#include "crc32.h"
+
+/**
+ * spi nor stand-in behind the fwlib calls spi_flash.c makes: SPI1 data and
+ * flags, the PA4 chip select and the two dma channels. The chip decodes
+ * JEDEC ID, RDSR, RDSCUR, WREN, PP, SE and FAST_READ, programs only clear
+ * bits, wraps page programs inside the 256 byte page and stays busy for the
+ * typical program and erase times. It can hang busy in the next program or
+ * erase, or answer as a
+ * macronix part and fail the next program or erase in its security
+ * register. Every command other than RDSR sent
+ * while it is busy, without WREN or during a dma read counts as a
+ * violation. Time is simulated, a byte takes 8 clocks of SPI1 at 36MHz.
+ */
+#define SIM_CHIP_SIZE               0x00100000
+#define SIM_JEDEC_ID                0x00ef4014
+#define SIM_JEDEC_MACRONIX          0x00c22014
+#define SIM_BYTE_NS                 222ull
+#define SIM_POLL_NS                 100ull
+#define SIM_PAGE_PROGRAM_NS         700000ull
+#define SIM_SECTOR_ERASE_NS         45000000ull
+#define SIM_TEST_SIZE               0x00010000
+
+#define CMD_WRITE_ENABLE            0x06
+#define CMD_READ_STATUS             0x05
+#define CMD_PAGE_PROGRAM            0x02
+#define CMD_SECTOR_ERASE            0x20
+#define CMD_FAST_READ               0x0b
+#define CMD_JEDEC_ID                0x9f
+#define CMD_READ_SECURITY           0x2b
+#define STATUS_BUSY                 0x01
+#define STATUS_WEL                  0x02
+#define SECURITY_PROGRAM_FAIL       0x20
+#define SECURITY_ERASE_FAIL         0x40
+
+typedef struct
+{
+    uint8_t mem[SIM_CHIP_SIZE];
+    bool present;
+    uint32_t jedec_id;
+    bool hang_next;
+    bool fail_next;
+    uint8_t security;
+    bool selected;
+    bool ignored;
+    bool wel;
+    uint64_t busy_until;
+    uint8_t cmd;
+    uint32_t count;
+    uint32_t address;
+    uint8_t page[SPI_FLASH_PAGE_SIZE];
+    bool page_used[SPI_FLASH_PAGE_SIZE];
+    uint8_t rx;
+    uint32_t violations;
+    uint32_t programs;
+    uint32_t erases;
+} sim_chip_t;
+
+typedef struct
+{
+    uint32_t memory;
+    uint32_t len;
+    bool requests;
+    uint64_t done;
+} sim_dma_t;
+
+static sim_chip_t chip;
+static sim_dma_t dma;
+static uint8_t buf[SIM_TEST_SIZE];
+static uint8_t ref[SIM_TEST_SIZE];
+
+/* only the device is used here, the app slot is never touched */
+const storage_device_t storage_internal = {FLASH_BLOCK_SIZE, STORAGE_CAP_MAPPED, NULL, NULL, NULL,
+                                           NULL, NULL, NULL, NULL, NULL};
+
+static bool chip_busy(void)
+{
+    return host_time() < chip.busy_until;
+}
+
+static void chip_violation(const char *what)
+{
+    printf("violation: %s, cmd 0x%02x\n", what, chip.cmd);
+    chip.violations ++;
+}
+
+static void chip_select(void)
+{
+    chip.selected = true;
+    chip.ignored = false;
+    chip.count = 0;
+    chip.address = 0;
+    memset(chip.page_used, 0, sizeof(chip.page_used));
+}
+
+static void chip_release(void)
+{
+    if (!chip.selected)
+    {
+        return;
+    }
+    chip.selected = false;
+    if (chip.ignored || (chip.count < 4))
+    {
+        return;
+    }
+
+    /* a failed operation leaves the array alone, the next one clears the flags */
+    bool fail = chip.fail_next;
+    bool hang = chip.hang_next;
+    if ((CMD_PAGE_PROGRAM == chip.cmd) || (CMD_SECTOR_ERASE == chip.cmd))
+    {
+        chip.fail_next = false;
+        chip.hang_next = false;
+        chip.security = 0;
+    }
+
+    if (CMD_PAGE_PROGRAM == chip.cmd)
+    {
+        uint32_t page = chip.address & ~(SPI_FLASH_PAGE_SIZE - 1) & (SIM_CHIP_SIZE - 1);
+        for (uint32_t i = 0; (i < SPI_FLASH_PAGE_SIZE) && !fail; ++i)
+        {
+            if (chip.page_used[i])
+            {
+                chip.mem[page + i] &= chip.page[i];
+            }
+        }
+        chip.security = fail ? SECURITY_PROGRAM_FAIL : 0;
+        chip.busy_until = hang ? UINT64_MAX : host_time() + SIM_PAGE_PROGRAM_NS;
+        chip.wel = false;
+        chip.programs ++;
+    }
+    else if (CMD_SECTOR_ERASE == chip.cmd)
+    {
+        uint32_t sector = chip.address & ~(SPI_FLASH_SECTOR_SIZE - 1) & (SIM_CHIP_SIZE - 1);
+        if (!fail)
+        {
+            memset(chip.mem + sector, 0xff, SPI_FLASH_SECTOR_SIZE);
+        }
+        chip.security = fail ? SECURITY_ERASE_FAIL : 0;
+        chip.busy_until = hang ? UINT64_MAX : host_time() + SIM_SECTOR_ERASE_NS;
+        chip.wel = false;
+        chip.erases ++;
+    }
+}
+
+static uint8_t chip_transfer(uint8_t data)
+{
+    if (!chip.present || !chip.selected)
+    {
+        /* miso is pulled up */
+        return 0xff;
+    }
+
+    uint32_t index = chip.count++;
+    if (0 == index)
+    {
+        chip.cmd = data;
+        if (chip_busy() && (CMD_READ_STATUS != data))
+        {
+            chip_violation("command while busy");
+            chip.ignored = true;
+        }
+        else if (((CMD_PAGE_PROGRAM == data) || (CMD_SECTOR_ERASE == data)) && !chip.wel)
+        {
+            chip_violation("write without enable");
+            chip.ignored = true;
+        }
+        else if (CMD_WRITE_ENABLE == data)
+        {
+            chip.wel = true;
+        }
+        return 0xff;
+    }
+
+    if (chip.ignored)
+    {
+        return 0xff;
+    }
+
+    switch (chip.cmd)
+    {
+    case CMD_READ_STATUS:
+        return (chip_busy() ? STATUS_BUSY : 0) | (chip.wel ? STATUS_WEL : 0);
+    case CMD_JEDEC_ID:
+        return (index <= 3) ? (chip.jedec_id >> (8 * (3 - index))) & 0xff : 0xff;
+    case CMD_READ_SECURITY:
+        return (SIM_JEDEC_MACRONIX == chip.jedec_id) ? chip.security : 0xff;
+    case CMD_PAGE_PROGRAM:
+    case CMD_SECTOR_ERASE:
+    case CMD_FAST_READ:
+        if (index <= 3)
+        {
+            chip.address = (chip.address << 8) | data;
+            return 0xff;
+        }
+        break;
+    default:
+        return 0xff;
+    }
+
+    if (CMD_PAGE_PROGRAM == chip.cmd)
+    {
+        uint32_t offset = (chip.address + index - 4) % SPI_FLASH_PAGE_SIZE;
+        chip.page[offset] = data;
+        chip.page_used[offset] = true;
+    }
+    else if ((CMD_FAST_READ == chip.cmd) && (index > 4))
+    {
+        /* index 4 is the dummy byte */
+        return chip.mem[(chip.address + index - 5) % SIM_CHIP_SIZE];
+    }
+
+    return 0xff;
+}
+
+/* fwlib stand-ins */
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+    UNUSED(RCC_APB2Periph);
+    UNUSED(NewState);
+}
+
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+    UNUSED(RCC_AHBPeriph);
+    UNUSED(NewState);
+}
+
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct)
+{
+    UNUSED(GPIOx);
+    UNUSED(GPIO_InitStruct);
+}
+
+void GPIO_ResetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    if ((GPIOA == GPIOx) && (0 != (GPIO_Pin & GPIO_Pin_4)))
+    {
+        chip_select();
+    }
+}
+
+void GPIO_SetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    if ((GPIOA == GPIOx) && (0 != (GPIO_Pin & GPIO_Pin_4)))
+    {
+        if (host_time() < dma.done)
+        {
+            chip_violation("chip select released during dma");
+        }
+        chip_release();
+    }
+}
+
+void SPI_Init(SPI_TypeDef *SPIx, SPI_InitTypeDef *SPI_InitStruct)
+{
+    UNUSED(SPIx);
+    UNUSED(SPI_InitStruct);
+}
+
+void SPI_Cmd(SPI_TypeDef *SPIx, FunctionalState NewState)
+{
+    UNUSED(SPIx);
+    UNUSED(NewState);
+}
+
+void SPI_I2S_DMACmd(SPI_TypeDef *SPIx, uint16_t SPI_I2S_DMAReq, FunctionalState NewState)
+{
+    UNUSED(SPIx);
+    UNUSED(SPI_I2S_DMAReq);
+    dma.requests = (ENABLE == NewState);
+}
+
+void SPI_I2S_SendData(SPI_TypeDef *SPIx, uint16_t Data)
+{
+    UNUSED(SPIx);
+    if (host_time() < dma.done)
+    {
+        chip_violation("spi access during dma");
+    }
+    chip.rx = chip_transfer((uint8_t)Data);
+    host_advance(SIM_BYTE_NS);
+}
+
+uint16_t SPI_I2S_ReceiveData(SPI_TypeDef *SPIx)
+{
+    UNUSED(SPIx);
+    return chip.rx;
+}
+
+FlagStatus SPI_I2S_GetFlagStatus(SPI_TypeDef *SPIx, uint16_t SPI_I2S_FLAG)
+{
+    UNUSED(SPIx);
+    return (SPI_I2S_FLAG_BSY == SPI_I2S_FLAG) ? RESET : SET;
+}
+
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, DMA_InitTypeDef *DMA_InitStruct)
+{
+    if (DMA1_Channel2 == DMAy_Channelx)
+    {
+        dma.memory = DMA_InitStruct->DMA_MemoryBaseAddr;
+        dma.len = DMA_InitStruct->DMA_BufferSize;
+    }
+}
+
+void DMA_Cmd(DMA_Channel_TypeDef *DMAy_Channelx, FunctionalState NewState)
+{
+    /* the tx channel clocks the transfer, it is enabled last */
+    if ((DMA1_Channel3 != DMAy_Channelx) || (ENABLE != NewState))
+    {
+        return;
+    }
+
+    if (!dma.requests)
+    {
+        chip_violation("dma without spi requests");
+        return;
+    }
+
+    uint8_t *pmem = (uint8_t *)(uintptr_t)dma.memory;
+    for (uint32_t i = 0; i < dma.len; ++i)
+    {
+        pmem[i] = chip_transfer(0xff);
+    }
+    dma.done = host_time() + dma.len * SIM_BYTE_NS;
+}
+
+FlagStatus DMA_GetFlagStatus(uint32_t DMAy_FLAG)
+{
+    if (DMA1_FLAG_TC2 != DMAy_FLAG)
+    {
+        return RESET;
+    }
+
+    if (host_time() >= dma.done)
+    {
+        return SET;
+    }
+
+    host_advance(SIM_POLL_NS);
+    return RESET;
+}
+
+void DMA_ClearFlag(uint32_t DMAy_FLAG)
+{
+    UNUSED(DMAy_FLAG);
+}
+
+static void fill_random(uint8_t *pbuf, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        pbuf[i] = (uint8_t)host_rand();
+    }
+}
+
+static bool all_erased(uint32_t address, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i)
+    {
+        if (0xff != chip.mem[address + i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void test_driver(void)
+{
+    chip.present = false;
+    host_check(!spi_flash_init(), "no chip, init fails");
+    chip.present = true;
+    host_check(spi_flash_init(), "jedec id answered");
+
+    /* a program across three pages */
+    uint32_t address = 0x2000 + SPI_FLASH_PAGE_SIZE - 16;
+    uint32_t len = 2 * SPI_FLASH_PAGE_SIZE + 32;
+    fill_random(ref, len);
+    chip.programs = 0;
+    host_check(FLASH_COMPLETE == spi_flash_write(address, ref, len), "program completes");
+    host_check(0 == memcmp(chip.mem + address, ref, len), "program crosses pages");
+    host_check(4 == chip.programs, "one page program per page touched, %u", chip.programs);
+    host_check(all_erased(address - 16, 16) && all_erased(address + len, 16), "program stays in range");
+
+    memset(buf, 0, len);
+    spi_flash_read(address, buf, len);
+    host_check(0 == memcmp(buf, ref, len), "dma read back");
+
+    /* program only clears bits */
+    uint8_t pattern[4] = {0x0f, 0xf0, 0xff, 0x00};
+    uint8_t before[4];
+    memcpy(before, chip.mem + address, sizeof(before));
+    spi_flash_write(address, pattern, sizeof(pattern));
+    bool cleared = true;
+    for (uint8_t i = 0; i < sizeof(pattern); ++i)
+    {
+        cleared = cleared && (chip.mem[address + i] == (before[i] & pattern[i]));
+    }
+    host_check(cleared, "program ands into old data");
+
+    /* erase leaves the neighbour sectors alone */
+    memset(chip.mem + 0x1000, 0x5a, 3 * SPI_FLASH_SECTOR_SIZE);
+    host_check(FLASH_COMPLETE == spi_flash_sector_erase(0x2000 + 100), "erase completes");
+    host_check(all_erased(0x2000, SPI_FLASH_SECTOR_SIZE), "sector erased");
+    host_check((0x5a == chip.mem[0x1fff]) && (0x5a == chip.mem[0x3000]), "neighbours kept");
+    host_check(!chip_busy(), "erase waits until ready");
+
+    /* a chip that never gets ready times out instead of holding the boot, power cycled after */
+    chip.hang_next = true;
+    host_check(FLASH_TIMEOUT == spi_flash_sector_erase(0x3000), "hung erase times out");
+    chip.busy_until = 0;
+    chip.hang_next = true;
+    chip.programs = 0;
+    host_check((FLASH_TIMEOUT == spi_flash_write(0x3000, ref, len)) && (1 == chip.programs),
+               "hung program times out at its page");
+    chip.busy_until = 0;
+
+    /* the winbond stand-in has no fail flags, a macronix part reports them */
+    chip.jedec_id = SIM_JEDEC_MACRONIX;
+    host_check(spi_flash_init(), "macronix id answered");
+    chip.fail_next = true;
+    host_check(FLASH_ERROR_PG == spi_flash_sector_erase(0x3000), "failed erase reported");
+    host_check(FLASH_COMPLETE == spi_flash_sector_erase(0x3000), "next erase clears the flag");
+    chip.fail_next = true;
+    chip.programs = 0;
+    host_check((FLASH_ERROR_PG == spi_flash_write(0x3000, ref, len)) && (1 == chip.programs),
+               "failed program stops at its page");
+    host_check((FLASH_COMPLETE == spi_flash_write(0x3000, ref, len)) &&
+               (0 == memcmp(chip.mem + 0x3000, ref, len)), "program after a failure");
+    chip.jedec_id = SIM_JEDEC_ID;
+    host_check(spi_flash_init(), "jedec id answered again");
+}
+
+static void test_storage(void)
+{
+    const uint32_t size = 4 * SPI_FLASH_SECTOR_SIZE;
+    host_check(storage_init(&slot_staging), "staging slot on spi");
+    host_check(NULL == storage_map(&slot_staging, 0), "spi is not mapped");
+
+    for (uint32_t offset = 0; offset < size; offset += SPI_FLASH_SECTOR_SIZE)
+    {
+        storage_erase(&slot_staging, offset);
+    }
+    host_check(storage_blank(&slot_staging, 0, size), "blank after erase");
+
+    fill_random(ref, size);
+    storage_program(&slot_staging, 0, ref, size);
+    host_check(0 == memcmp(chip.mem + UPGRADE_IMAGE_ADDR, ref, size), "slot offset is device address");
+    host_check(!storage_blank(&slot_staging, size - 4, 4), "last word programmed");
+    host_check(storage_checksum(&slot_staging, 0, size) == crc32(0, ref, size), "checksum over spi");
+
+    /* background read overlaps cpu work, the bus stays with the dma */
+    memset(buf, 0, size);
+    storage_read_start(&slot_staging, 0, buf, size);
+    uint32_t sum = crc32(0, ref, size);
+    storage_read_wait(&slot_staging);
+    host_check((0 == memcmp(buf, ref, size)) && (sum == crc32(0, buf, size)), "background read");
+}
+
+static void bench(void)
+{
+    const uint32_t size = SIM_TEST_SIZE;
+    uint64_t start = host_time();
+    for (uint32_t offset = 0; offset < size; offset += FLASH_BLOCK_SIZE)
+    {
+        storage_read(&slot_staging, offset, buf + offset, FLASH_BLOCK_SIZE);
+    }
+    uint64_t read_ns = host_time() - start;
+
+    start = host_time();
+    for (uint32_t offset = 0; offset < size; offset += 64)
+    {
+        storage_read(&slot_staging, offset, buf + offset, 64);
+    }
+    uint64_t chunk_ns = host_time() - start;
+
+    start = host_time();
+    storage_erase(&slot_staging, 0);
+    storage_program(&slot_staging, 0, ref, SPI_FLASH_SECTOR_SIZE);
+    uint64_t write_ns = host_time() - start;
+
+    printf("read %u KB in %u byte dma bursts: %.0f KB/s\n", size / 1024, FLASH_BLOCK_SIZE,
+           size / 1024.0 / (read_ns / 1e9));
+    printf("read %u KB in 64 byte chunks: %.0f KB/s\n", size / 1024, size / 1024.0 / (chunk_ns / 1e9));
+    printf("erase and program one %u byte sector: %.1f ms\n", SPI_FLASH_SECTOR_SIZE, write_ns / 1e6);
+}
+
+static void run(void)
+{
+    memset(chip.mem, 0xff, sizeof(chip.mem));
+    chip.jedec_id = SIM_JEDEC_ID;
+    host_srand(0x5f1);
+    host_sim_time();
+    test_driver();
+    test_storage();
+    bench();
+    host_check(0 == chip.violations, "no protocol violations");
+}
+
+int main(void)
+{
+    host_run_low(run);
+    return host_exit();
+}